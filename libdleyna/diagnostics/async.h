@@ -35,6 +35,7 @@ struct dld_async_task_t_ {
 	dld_upnp_task_complete_t cb;
 	GError *error;
 	GUPnPServiceProxyAction *action;
+	gint64 action_time;
 	GUPnPServiceProxy *proxy;
 	GCancellable *cancellable;
 	gulong cancel_id;
@@ -21,10 +21,15 @@
  */
 
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
 #include <libsoup/soup.h>
+#ifdef HAVE_GDK_PIXBUF
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#endif
 #include <libgupnp/gupnp-control-point.h>
 
 #include <libdleyna/core/error.h>
@@ -33,10 +38,27 @@
 
 #include "async.h"
 #include "device.h"
+#include "icon-cache.h"
+#include "intern.h"
+#include "local.h"
+#include "metrics.h"
 #include "prop-defs.h"
+#include "scheduler.h"
 #include "server.h"
 #include "xml-util.h"
 
+#define DLD_DEVICE_MAX_COMPLETED_TESTS 256
+
+#define DLD_DEVICE_TEST_POLL_MAX_INTERVAL 30000
+#define DLD_DEVICE_TEST_POLL_MAX_FAILURES 5
+
+#define DLD_DEVICE_ICON_MAX_CONNS 8
+#define DLD_DEVICE_ICON_MAX_CONNS_PER_HOST 2
+
+
+#define DLD_DEVICE_LOCAL_TYPE "urn:dleyna-org:device:LocalDiagnostics:1"
+#define DLD_DEVICE_LOCAL_UDN "uuid:5d4b1e4a-9a3c-4b1e-8f0e-6c6f63616c00"
+
 typedef void (*dld_device_local_cb_t)(dld_async_task_t *cb_data);
 
 typedef struct dld_device_data_t_ dld_device_data_t;
@@ -51,21 +73,72 @@ struct prv_new_device_ct_t_ {
 	const dleyna_connector_dispatch_cb_t *dispatch_table;
 };
 
+/* Shared by all icon downloads, so connections to a device are reused */
+static SoupSession *g_icon_session;
+
 typedef struct prv_download_info_t_ prv_download_info_t;
 struct prv_download_info_t_ {
 	SoupSession *session;
 	SoupMessage *msg;
 	dld_async_task_t *task;
+	gchar *udn;
+	gchar *url;
+	gchar *key;
+	const gchar *mime_type;
+	gint width;
+	gint height;
+	gchar *icon_mime_type;
+	gint icon_width;
+	gint icon_height;
+};
+
+/* Background revalidation of an icon served from the disk cache */
+struct dld_device_icon_validation_t_ {
+	dld_device_t *device;
+	SoupMessage *msg;
+	gchar *udn;
+	gchar *url;
+	gchar *mime_type;
+};
+
+/* Final result of a completed test, as returned by the 'action' */
+typedef struct prv_test_result_entry_t_ prv_test_result_entry_t;
+struct prv_test_result_entry_t_ {
+	const gchar *action;
+	GVariant *result;
+};
+
+typedef GVariant *(*prv_test_result_end_t)(GUPnPServiceProxy *proxy,
+					   GUPnPServiceProxyAction *action,
+					   GError **error);
+
+typedef void (*prv_shared_action_done_t)(dld_device_t *device, guint test_id,
+					 const gchar *action, GVariant *result);
+
+/* A query action shared by every task asking the same thing of a device */
+typedef struct prv_shared_action_t_ prv_shared_action_t;
+struct prv_shared_action_t_ {
+	dld_device_t *device;
+	gchar *key;
+	const gchar *name;
+	guint test_id;
+	GUPnPServiceProxy *proxy;
+	GUPnPServiceProxyAction *action;
+	gint64 action_time;
+	prv_test_result_end_t end;
+	prv_shared_action_done_t done;
+	GList *waiters;
 };
 
+/* Fields of an NSLookupResult <Result>, borrowed from the parser */
 typedef struct prv_nslookup_result_t_ prv_nslookup_result_t;
 struct prv_nslookup_result_t_ {
-	gchar *status;
-	gchar *answer_type;
-	gchar *hostname_returned;
-	gchar *ip_addresses;
-	gchar *dns_server_ip;
-	gchar *response_time;
+	const gchar *status;
+	const gchar *answer_type;
+	const gchar *hostname_returned;
+	const gchar *ip_addresses;
+	const gchar *dns_server_ip;
+	const gchar *response_time;
 };
 
 static void prv_bm_device_status_cb(GUPnPServiceProxy *proxy,
@@ -85,6 +158,35 @@ static void prv_bm_active_test_ids_cb(GUPnPServiceProxy *proxy,
 
 static void prv_props_update(dld_device_t *device);
 
+static void prv_test_watch_start(dld_device_t *device,
+				 GUPnPServiceProxy *proxy,
+				 guint test_id);
+
+static void prv_test_watch_cancel(gpointer data);
+
+static void prv_test_watch_poll_start(dld_device_t *device,
+				      GUPnPServiceProxy *proxy,
+				      guint test_id);
+
+static void prv_shared_action_abort(gpointer data);
+
+static GArray *prv_test_id_set_new(GVariant *ids);
+
+
+/* Properties built from the device description, kept in the device cache */
+static const gchar *g_cached_props[] = {
+	DLD_INTERFACE_PROP_DEVICE_TYPE,
+	DLD_INTERFACE_PROP_UDN,
+	DLD_INTERFACE_PROP_FRIENDLY_NAME,
+	DLD_INTERFACE_PROP_ICON_URL,
+	DLD_INTERFACE_PROP_MANUFACTURER,
+	DLD_INTERFACE_PROP_MANUFACTURER_URL,
+	DLD_INTERFACE_PROP_MODEL_DESCRIPTION,
+	DLD_INTERFACE_PROP_MODEL_NAME,
+	DLD_INTERFACE_PROP_MODEL_NUMBER,
+	DLD_INTERFACE_PROP_SERIAL_NUMBER,
+	DLD_INTERFACE_PROP_PRESENTATION_URL
+};
 
 static void prv_unref_variant(gpointer variant)
 {
@@ -93,6 +195,14 @@ static void prv_unref_variant(gpointer variant)
 		g_variant_unref(var);
 }
 
+static void prv_test_result_entry_free(gpointer data)
+{
+	prv_test_result_entry_t *entry = data;
+
+	g_variant_unref(entry->result);
+	g_free(entry);
+}
+
 static void prv_context_unsubscribe(dld_device_context_t *ctx)
 {
 	DLEYNA_LOG_DEBUG("Enter");
@@ -139,16 +249,6 @@ static void prv_dld_context_delete(gpointer context)
 	}
 }
 
-static void prv_change_props(GHashTable *props,
-			     const gchar *key,
-			     GVariant *value,
-			     GVariantBuilder *changed_props_vb)
-{
-	g_hash_table_insert(props, (gpointer) key, value);
-	if (changed_props_vb)
-		g_variant_builder_add(changed_props_vb, "{sv}", key, value);
-}
-
 static void prv_emit_signal_properties_changed(dld_device_t *device,
 					       const char *interface,
 					       GVariant *changed_props)
@@ -182,6 +282,83 @@ static void prv_emit_signal_properties_changed(dld_device_t *device,
 	g_variant_unref(val);
 }
 
+static gboolean prv_flush_changed_props(gpointer user_data)
+{
+	dld_device_t *device = user_data;
+	GVariantBuilder vb;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	GVariant *changed_props;
+
+	device->changed_props_id = 0;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+
+	g_hash_table_iter_init(&iter, device->changed_props);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		g_variant_builder_add(&vb, "{sv}", key, value);
+
+	g_hash_table_remove_all(device->changed_props);
+
+	changed_props = g_variant_ref_sink(g_variant_builder_end(&vb));
+
+	prv_emit_signal_properties_changed(device,
+					   DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE,
+					   changed_props);
+	g_variant_unref(changed_props);
+
+	return FALSE;
+}
+
+/* props_snapshot is the a{sv} returned by GetAll. It is rebuilt by the
+ * first GetAll that follows a change to device->props.
+ */
+static void prv_props_invalidate(dld_device_t *device)
+{
+	if (device->props_snapshot) {
+		g_variant_unref(device->props_snapshot);
+		device->props_snapshot = NULL;
+	}
+}
+
+/* Stores 'value' under 'key' and schedules a PropertiesChanged signal,
+ * unless the property already has this value.  Changes made within
+ * DLD_PROPS_CHANGED_DELAY ms are reported by a single signal.
+ */
+static void prv_change_prop(dld_device_t *device, const gchar *key,
+			    GVariant *value)
+{
+	GVariant *old_value;
+
+	g_variant_ref_sink(value);
+
+	old_value = g_hash_table_lookup(device->props, key);
+	if (old_value && g_variant_equal(old_value, value)) {
+		DLEYNA_LOG_DEBUG("%s unchanged on %s", key, device->path);
+		g_variant_unref(value);
+
+		goto on_exit;
+	}
+
+	g_hash_table_insert(device->props, (gpointer) key, value);
+	prv_props_invalidate(device);
+	g_hash_table_insert(device->changed_props, (gpointer) key,
+			    g_variant_ref(value));
+
+	if (DLD_PROPS_CHANGED_DELAY == 0)
+		(void) prv_flush_changed_props(device);
+	else if (!device->changed_props_id)
+		device->changed_props_id = g_timeout_add(
+						DLD_PROPS_CHANGED_DELAY,
+						prv_flush_changed_props,
+						device);
+
+on_exit:
+
+	return;
+}
+
 static void prv_context_new(const gchar *ip_address,
 			    GUPnPDeviceProxy *proxy,
 			    GUPnPServiceProxy *bms_proxy,
@@ -270,17 +447,42 @@ void dld_device_delete(void *device)
 		if (dev->timeout_id)
 			(void) g_source_remove(dev->timeout_id);
 
+		if (dev->changed_props_id)
+			(void) g_source_remove(dev->changed_props_id);
+
 		for (i = 0; i < DLD_INTERFACE_INFO_MAX && dev->ids[i]; ++i)
 			(void) dld_diagnostics_get_connector()->unpublish_object(
 								dev->connection,
 								dev->ids[i]);
+		g_list_free_full(dev->test_watches, prv_test_watch_cancel);
+		dld_local_delete(dev->local);
+
 		g_ptr_array_unref(dev->contexts);
-		g_free(dev->path);
+		dld_intern_unref(dev->path);
 
 		g_hash_table_unref(dev->props);
+		if (dev->props_snapshot)
+			g_variant_unref(dev->props_snapshot);
+		g_hash_table_unref(dev->changed_props);
+		g_hash_table_unref(dev->completed_tests);
+		g_queue_clear(&dev->completed_order);
+		g_hash_table_unref(dev->test_results);
+		g_hash_table_unref(dev->shared_actions);
+
+		if (dev->test_id_set)
+			g_array_unref(dev->test_id_set);
+		if (dev->active_test_id_set)
+			g_array_unref(dev->active_test_id_set);
+
+		if (dev->icon_validation) {
+			dev->icon_validation->device = NULL;
+			soup_session_cancel_message(
+					g_icon_session,
+					dev->icon_validation->msg,
+					SOUP_STATUS_CANCELLED);
+		}
 
-		g_free(dev->icon.mime_type);
-		g_free(dev->icon.bytes);
+		g_hash_table_unref(dev->icons);
 
 		g_free(dev);
 	}
@@ -392,14 +594,33 @@ static GUPnPServiceProxyAction *prv_subscribe(dleyna_service_task_t *task,
 	return NULL;
 }
 
+static gboolean prv_device_publish(
+			dld_device_t *device,
+			const dleyna_connector_dispatch_cb_t *dispatch_table)
+{
+	unsigned int i;
+
+	for (i = 0; i < DLD_INTERFACE_INFO_MAX; ++i) {
+		device->ids[i] = dld_diagnostics_get_connector()->publish_object(
+					device->connection,
+					device->path,
+					FALSE,
+					dld_diagnostics_get_interface_name(i),
+					dispatch_table + i);
+
+		if (!device->ids[i])
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
 static GUPnPServiceProxyAction *prv_declare(dleyna_service_task_t *task,
 					    GUPnPServiceProxy *proxy,
 					    gboolean *failed)
 {
-	unsigned int i;
 	dld_device_t *device;
 	prv_new_device_ct_t *priv_t;
-	const dleyna_connector_dispatch_cb_t *table;
 
 	DLEYNA_LOG_DEBUG("Enter");
 
@@ -409,23 +630,7 @@ static GUPnPServiceProxyAction *prv_declare(dleyna_service_task_t *task,
 	device = priv_t->dev;
 	device->construct_step++;
 
-	table = priv_t->dispatch_table;
-
-	for (i = 0; i < DLD_INTERFACE_INFO_MAX; ++i) {
-		device->ids[i] = dld_diagnostics_get_connector()->publish_object(
-					device->connection,
-					device->path,
-					FALSE,
-					dld_diagnostics_get_interface_name(i),
-					table + i);
-
-		if (!device->ids[i]) {
-			*failed = TRUE;
-			goto on_error;
-		}
-	}
-
-on_error:
+	*failed = !prv_device_publish(device, priv_t->dispatch_table);
 
 	DLEYNA_LOG_DEBUG("Exit");
 
@@ -463,6 +668,49 @@ void dld_device_construct(
 	DLEYNA_LOG_DEBUG("Exit");
 }
 
+static void prv_device_icon_free(gpointer data)
+{
+	dld_device_icon_t *icon = data;
+
+	g_free(icon->mime_type);
+	g_free(icon->bytes);
+	g_free(icon);
+}
+
+static dld_device_t *prv_device_alloc(dleyna_connector_id_t connection,
+				      guint counter)
+{
+	dld_device_t *dev;
+	gchar *new_path;
+
+	new_path = g_strdup_printf("%s/%u", DLEYNA_DIAGNOSTICS_PATH, counter);
+	DLEYNA_LOG_DEBUG("Diagnostics Device Path %s", new_path);
+
+	dev = g_new0(dld_device_t, 1);
+
+	dev->connection = connection;
+	dev->contexts = g_ptr_array_new_with_free_func(prv_dld_context_delete);
+	dev->path = dld_intern_ref(new_path);
+	g_free(new_path);
+
+	dev->props = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					   prv_unref_variant);
+	dev->changed_props = g_hash_table_new_full(g_str_hash, g_str_equal,
+						   NULL, prv_unref_variant);
+	dev->completed_tests = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_queue_init(&dev->completed_order);
+	dev->test_results = g_hash_table_new_full(g_direct_hash,
+						  g_direct_equal, NULL,
+						  prv_test_result_entry_free);
+	dev->shared_actions = g_hash_table_new_full(g_str_hash, g_str_equal,
+						    NULL,
+						    prv_shared_action_abort);
+	dev->icons = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+					   prv_device_icon_free);
+
+	return dev;
+}
+
 dld_device_t *dld_device_new(
 			dleyna_connector_id_t connection,
 			GUPnPDeviceProxy *proxy,
@@ -473,21 +721,11 @@ dld_device_t *dld_device_new(
 			const dleyna_task_queue_key_t *queue_id)
 {
 	dld_device_t *dev;
-	gchar *new_path;
 	dld_device_context_t *context;
 
 	DLEYNA_LOG_DEBUG("New Diagnostics Device on %s", ip_address);
 
-	new_path = g_strdup_printf("%s/%u", DLEYNA_DIAGNOSTICS_PATH, counter);
-	DLEYNA_LOG_DEBUG("Diagnostics Device Path %s", new_path);
-
-	dev = g_new0(dld_device_t, 1);
-
-	dev->connection = connection;
-	dev->contexts = g_ptr_array_new_with_free_func(prv_dld_context_delete);
-	dev->path = new_path;
-	dev->props = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
-					   prv_unref_variant);
+	dev = prv_device_alloc(connection, counter);
 
 	prv_device_append_new_context(dev, ip_address, proxy, bms_proxy);
 
@@ -503,23 +741,183 @@ dld_device_t *dld_device_new(
 	return dev;
 }
 
-dld_device_t *dld_device_from_path(const gchar *path, GHashTable *device_list)
+dld_device_t *dld_device_new_from_cache(
+			dleyna_connector_id_t connection,
+			GKeyFile *cache,
+			const gchar *udn,
+			guint counter,
+			const dleyna_connector_dispatch_cb_t *dispatch_table)
 {
-	GHashTableIter iter;
-	gpointer value;
-	dld_device_t *device;
-	dld_device_t *retval = NULL;
+	dld_device_t *dev;
+	unsigned int i;
+	gchar *str;
+	GVariant *val;
 
-	g_hash_table_iter_init(&iter, device_list);
-	while (g_hash_table_iter_next(&iter, NULL, &value)) {
-		device = value;
-		if (!strcmp(device->path, path)) {
-			retval = device;
-			break;
+	DLEYNA_LOG_DEBUG("Cached Diagnostics Device %s", udn);
+
+	dev = prv_device_alloc(connection, counter);
+
+	for (i = 0; i < G_N_ELEMENTS(g_cached_props); ++i) {
+		str = g_key_file_get_string(cache, udn, g_cached_props[i],
+					    NULL);
+		if (!str)
+			continue;
+
+		val = g_variant_parse(NULL, str, NULL, NULL, NULL);
+		g_free(str);
+
+		if (val)
+			g_hash_table_insert(dev->props,
+					    (gpointer)g_cached_props[i], val);
+	}
+
+	if (!g_hash_table_lookup(dev->props, DLD_INTERFACE_PROP_UDN))
+		goto on_error;
+
+	/* Subscription happens when SSDP hands over the first context */
+	dev->construct_step = 2;
+
+	if (!prv_device_publish(dev, dispatch_table))
+		goto on_error;
+
+	return dev;
+
+on_error:
+
+	DLEYNA_LOG_WARNING("Invalid cache entry for %s", udn);
+
+	dld_device_delete(dev);
+
+	return NULL;
+}
+
+dld_device_t *dld_device_new_local(
+			dleyna_connector_id_t connection,
+			guint counter,
+			const dleyna_connector_dispatch_cb_t *dispatch_table)
+{
+	dld_device_t *dev;
+	GVariant *val;
+
+	DLEYNA_LOG_DEBUG("Local Diagnostics Device");
+
+	dev = prv_device_alloc(connection, counter);
+	dev->local = dld_local_new(dev);
+
+	val = g_variant_ref_sink(g_variant_new_string(DLD_DEVICE_LOCAL_TYPE));
+	g_hash_table_insert(dev->props, DLD_INTERFACE_PROP_DEVICE_TYPE, val);
+
+	val = g_variant_ref_sink(g_variant_new_string(DLD_DEVICE_LOCAL_UDN));
+	g_hash_table_insert(dev->props, DLD_INTERFACE_PROP_UDN, val);
+
+	val = g_variant_ref_sink(g_variant_new_string(g_get_host_name()));
+	g_hash_table_insert(dev->props, DLD_INTERFACE_PROP_FRIENDLY_NAME, val);
+
+	val = g_variant_ref_sink(g_variant_new_array(G_VARIANT_TYPE_UINT32,
+						     NULL, 0));
+	dev->test_id_set = prv_test_id_set_new(val);
+	dev->active_test_id_set = prv_test_id_set_new(val);
+	g_hash_table_insert(dev->props, DLD_INTERFACE_PROP_TEST_IDS,
+			    g_variant_ref(val));
+	g_hash_table_insert(dev->props, DLD_INTERFACE_PROP_ACTIVE_TEST_IDS,
+			    val);
+
+	dev->construct_step = 2;
+
+	if (!prv_device_publish(dev, dispatch_table))
+		goto on_error;
+
+	return dev;
+
+on_error:
+
+	DLEYNA_LOG_WARNING("Unable to publish the local device");
+
+	dld_device_delete(dev);
+
+	return NULL;
+}
+
+void dld_device_cache_save(dld_device_t *device, GKeyFile *cache)
+{
+	const gchar *udn;
+	gchar *str;
+	GVariant *val;
+	unsigned int i;
+
+	val = g_hash_table_lookup(device->props, DLD_INTERFACE_PROP_UDN);
+	if (!val || !device->contexts->len)
+		goto on_exit;
+
+	udn = g_variant_get_string(val, NULL);
+
+	(void) g_key_file_remove_group(cache, udn, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(g_cached_props); ++i) {
+		val = g_hash_table_lookup(device->props, g_cached_props[i]);
+		if (!val)
+			continue;
+
+		str = g_variant_print(val, TRUE);
+		g_key_file_set_string(cache, udn, g_cached_props[i], str);
+		g_free(str);
+	}
+
+on_exit:
+
+	return;
+}
+
+void dld_device_refresh_props(dld_device_t *device)
+{
+	GVariant *old_vals[G_N_ELEMENTS(g_cached_props)];
+	GVariant *val;
+	GVariantBuilder vb;
+	gboolean changed = FALSE;
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(g_cached_props); ++i) {
+		old_vals[i] = g_hash_table_lookup(device->props,
+						  g_cached_props[i]);
+		if (old_vals[i])
+			g_variant_ref(old_vals[i]);
+	}
+
+	prv_props_update(device);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+
+	for (i = 0; i < G_N_ELEMENTS(g_cached_props); ++i) {
+		val = g_hash_table_lookup(device->props, g_cached_props[i]);
+
+		if (val && (!old_vals[i] || !g_variant_equal(old_vals[i],
+							     val))) {
+			g_variant_builder_add(&vb, "{sv}", g_cached_props[i],
+					      val);
+			changed = TRUE;
 		}
+
+		if (old_vals[i])
+			g_variant_unref(old_vals[i]);
 	}
 
-	return retval;
+	val = g_variant_ref_sink(g_variant_builder_end(&vb));
+
+	if (changed)
+		prv_emit_signal_properties_changed(
+					device,
+					DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE,
+					val);
+
+	g_variant_unref(val);
+}
+
+dld_device_t *dld_device_from_path(const gchar *path, GHashTable *device_map)
+{
+	const gchar *interned = dld_intern_lookup(path);
+
+	/* device_map is the path indexed registry owned by dld_upnp_t */
+	return interned ? g_hash_table_lookup(device_map, interned) : NULL;
 }
 
 dld_device_context_t *dld_device_get_context(dld_device_t *device)
@@ -590,118 +988,336 @@ static void prv_add_props(GHashTable *props, GVariantBuilder *vb)
 static void prv_get_props(dld_async_task_t *cb_data)
 {
 	dld_task_get_props_t *get_props = &cb_data->task.ut.get_props;
-	GVariantBuilder *vb;
+	dld_device_t *device = cb_data->device;
+	GVariantBuilder vb;
 
 	DLEYNA_LOG_DEBUG("Enter");
 
-	vb = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
-
-	if (!strcmp(get_props->interface_name,
-		    DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE) ||
-	    !strcmp(get_props->interface_name, "")) {
-		prv_add_props(cb_data->device->props, vb);
-	} else {
+	if (strcmp(get_props->interface_name,
+		   DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE) &&
+	    strcmp(get_props->interface_name, "")) {
 		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
 					     DLEYNA_ERROR_UNKNOWN_INTERFACE,
 					     "Unknown Interface");
 		goto on_error;
 	}
 
-	cb_data->task.result = g_variant_ref_sink(g_variant_builder_end(vb));
+	if (!device->props_snapshot) {
+		g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+		prv_add_props(device->props, &vb);
+		device->props_snapshot =
+			g_variant_ref_sink(g_variant_builder_end(&vb));
+	}
+
+	cb_data->task.result = g_variant_ref(device->props_snapshot);
 
 on_error:
 
-	g_variant_builder_unref(vb);
-
 	DLEYNA_LOG_DEBUG("Exit");
 }
 
-static void prv_bm_device_status_cb(GUPnPServiceProxy *proxy,
-				    const char *variable,
-				    GValue *value,
-				    gpointer user_data)
+/* Returns the next item of the comma separated list '*csv', stripped of
+ * white space, and advances '*csv' past it.  The list is not modified,
+ * so the item is not NUL terminated: its length is stored in 'length'.
+ */
+static const gchar *prv_csv_next(const gchar **csv, gsize *length)
 {
-	dld_device_t *device = user_data;
-	GVariantBuilder *changed_props_vb;
-	GVariant *changed_props;
-	GVariantBuilder device_status_vb;
-	gchar **parts;
-	unsigned int i = 0;
-	const gchar *device_status_str;
-	GVariant *device_status;
+	const gchar *start = *csv;
+	const gchar *end;
 
-	device_status_str = g_value_get_string(value);
-
-	DLEYNA_LOG_DEBUG("prv_bm_device_status_cb: %s", device_status_str);
+	if (start == NULL)
+		return NULL;
 
-	changed_props_vb = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+	end = strchr(start, ',');
+	*csv = end ? end + 1 : NULL;
+	if (end == NULL)
+		end = start + strlen(start);
 
-	g_variant_builder_init(&device_status_vb, G_VARIANT_TYPE("as"));
+	while (start < end && g_ascii_isspace(*start))
+		++start;
+	while (end > start && g_ascii_isspace(end[-1]))
+		--end;
 
-	parts = g_strsplit(device_status_str, ",", 0);
-	while (parts[i]) {
-		g_strstrip(parts[i]);
+	*length = end - start;
 
-		g_variant_builder_add(&device_status_vb, "s", parts[i]);
-		++i;
-	}
+	return start;
+}
 
-	device_status = g_variant_builder_end(&device_status_vb);
+static gboolean prv_csv_parse_uint(const gchar *item, gsize length,
+				   guint *value)
+{
+	gchar *end;
+	gulong number;
 
-	prv_change_props(device->props, DLD_INTERFACE_PROP_STATUS_INFO,
-			 g_variant_ref_sink(device_status),
-			 changed_props_vb);
+	if (length == 0 || !g_ascii_isdigit(*item))
+		return FALSE;
 
-	changed_props = g_variant_ref_sink(
-				g_variant_builder_end(changed_props_vb));
+	errno = 0;
+	number = strtoul(item, &end, 10);
+	if (errno == ERANGE || number > G_MAXUINT32 || end != item + length)
+		return FALSE;
 
-	prv_emit_signal_properties_changed(device,
-					   DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE,
-					   changed_props);
-	g_variant_unref(changed_props);
-	g_variant_builder_unref(changed_props_vb);
+	*value = number;
 
-	g_strfreev(parts);
+	return TRUE;
 }
 
-static void prv_bm_test_ids_prop_change(dld_device_t *device, const gchar *key,
-					const gchar *ids_str)
+/* Splits 'csv' in place, no item is copied before reaching 'vb' */
+static void prv_csv_add_strings(gchar *csv, GVariantBuilder *vb)
 {
-	GVariantBuilder *changed_props_vb;
-	GVariant *changed_props;
-	GVariantBuilder ids_vb;
-	gchar **parts;
-	unsigned int i = 0;
-	GVariant *ids;
-
-	changed_props_vb = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
+	const gchar *next = (csv && *csv) ? csv : NULL;
+	gchar *item;
+	gsize length;
 
-	g_variant_builder_init(&ids_vb, G_VARIANT_TYPE("au"));
+	while ((item = (gchar *)prv_csv_next(&next, &length)) != NULL) {
+		item[length] = 0;
+		g_variant_builder_add(vb, "s", item);
+	}
+}
+
+static void prv_csv_add_uints(const gchar *csv, GVariantBuilder *vb)
+{
+	const gchar *next = (csv && *csv) ? csv : NULL;
+	const gchar *item;
+	gsize length;
+	guint value;
+
+	while ((item = prv_csv_next(&next, &length)) != NULL) {
+		if (prv_csv_parse_uint(item, length, &value))
+			g_variant_builder_add(vb, "u", value);
+		else
+			DLEYNA_LOG_WARNING("Ignoring invalid number '%.*s'",
+					   (int)length, item);
+	}
+}
+
+static void prv_bm_device_status_cb(GUPnPServiceProxy *proxy,
+				    const char *variable,
+				    GValue *value,
+				    gpointer user_data)
+{
+	dld_device_t *device = user_data;
+	GVariantBuilder device_status_vb;
+	gchar *device_status_str;
+
+	dld_metrics_event_received(device->path, variable);
+
+	device_status_str = g_value_dup_string(value);
+
+	DLEYNA_LOG_DEBUG("prv_bm_device_status_cb: %s", device_status_str);
+
+	g_variant_builder_init(&device_status_vb, G_VARIANT_TYPE("as"));
+
+	prv_csv_add_strings(device_status_str, &device_status_vb);
+
+	prv_change_prop(device, DLD_INTERFACE_PROP_STATUS_INFO,
+			g_variant_builder_end(&device_status_vb));
+
+	g_free(device_status_str);
+}
+
+static gint prv_compare_test_ids(gconstpointer a, gconstpointer b)
+{
+	guint32 id_a = *(const guint32 *)a;
+	guint32 id_b = *(const guint32 *)b;
+
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+/* Returns the ids of 'ids' as a sorted array without duplicates */
+static GArray *prv_test_id_set_new(GVariant *ids)
+{
+	const guint32 *array;
+	gsize count;
+	GArray *set;
+	guint32 *data;
+	guint i;
+	guint len = 0;
+
+	array = g_variant_get_fixed_array(ids, &count, sizeof(guint32));
+
+	set = g_array_sized_new(FALSE, FALSE, sizeof(guint32), count);
+	g_array_append_vals(set, array, count);
+	g_array_sort(set, prv_compare_test_ids);
+
+	data = (guint32 *)set->data;
+	for (i = 0; i < set->len; ++i)
+		if (len == 0 || data[len - 1] != data[i])
+			data[len++] = data[i];
+	g_array_set_size(set, len);
+
+	return set;
+}
 
-	parts = g_strsplit(ids_str, ",", 0);
-	while (parts[i]) {
-		g_strstrip(parts[i]);
+static gboolean prv_test_id_set_contains(GArray *set, guint test_id)
+{
+	guint32 id = test_id;
+
+	return set && bsearch(&id, set->data, set->len, sizeof(guint32),
+			      prv_compare_test_ids) != NULL;
+}
+
+static void prv_emit_signal_test_ids_delta(dld_device_t *device,
+					   const gchar *signal,
+					   const gchar *property,
+					   GArray *ids)
+{
+	DLEYNA_LOG_DEBUG("Emitted Signal: %s.%s - ObjectPath: %s - %s: %u",
+			 DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE, signal,
+			 device->path, property, ids->len);
+
+	(void) dld_diagnostics_get_connector()->notify(
+					device->connection,
+					device->path,
+					DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE,
+					signal,
+					g_variant_new("(s@au)", property,
+						g_variant_new_fixed_array(
+							G_VARIANT_TYPE_UINT32,
+							ids->data, ids->len,
+							sizeof(guint32))),
+					NULL);
+}
+
+/* Emits the PropertiesChanged signal held back by the coalescing timer */
+static void prv_flush_pending_props(dld_device_t *device)
+{
+	if (device->changed_props_id) {
+		(void) g_source_remove(device->changed_props_id);
+		(void) prv_flush_changed_props(device);
+	}
+}
+
+/* Replaces '*set' by the ids of 'ids' and signals the difference.
+ * The first update of a set only records it.  The new value of
+ * 'property' must already be staged by prv_change_prop, it is notified
+ * before the difference.  Returns the removed ids, or NULL if there are
+ * none.
+ */
+static GArray *prv_test_id_set_update(dld_device_t *device,
+				      const gchar *property,
+				      GArray **set,
+				      GVariant *ids)
+{
+	GArray *old_set = *set;
+	GArray *new_set;
+	GArray *added;
+	GArray *removed = NULL;
+	guint32 *old_ids;
+	guint32 *new_ids;
+	guint i = 0;
+	guint j = 0;
+
+	new_set = prv_test_id_set_new(ids);
+	*set = new_set;
+
+	if (old_set == NULL)
+		goto on_exit;
 
-		g_variant_builder_add(&ids_vb, "u", atoi(parts[i]));
-		++i;
+	old_ids = (guint32 *)old_set->data;
+	new_ids = (guint32 *)new_set->data;
+	added = g_array_new(FALSE, FALSE, sizeof(guint32));
+	removed = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	while (i < old_set->len || j < new_set->len) {
+		if (j == new_set->len ||
+		    (i < old_set->len && old_ids[i] < new_ids[j])) {
+			g_array_append_val(removed, old_ids[i]);
+			++i;
+		} else if (i == old_set->len || new_ids[j] < old_ids[i]) {
+			g_array_append_val(added, new_ids[j]);
+			++j;
+		} else {
+			++i;
+			++j;
+		}
 	}
 
-	ids = g_variant_builder_end(&ids_vb);
+	if (added->len || removed->len)
+		prv_flush_pending_props(device);
 
-	prv_change_props(device->props, key,
-			 g_variant_ref_sink(ids),
-			 changed_props_vb);
+	if (added->len)
+		prv_emit_signal_test_ids_delta(device,
+					       DLD_INTERFACE_TESTS_ADDED,
+					       property, added);
 
-	changed_props = g_variant_ref_sink(
-				g_variant_builder_end(changed_props_vb));
+	if (removed->len) {
+		prv_emit_signal_test_ids_delta(device,
+					       DLD_INTERFACE_TESTS_REMOVED,
+					       property, removed);
+	} else {
+		g_array_unref(removed);
+		removed = NULL;
+	}
 
-	prv_emit_signal_properties_changed(device,
-					   DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE,
-					   changed_props);
-	g_variant_unref(changed_props);
-	g_variant_builder_unref(changed_props_vb);
+	g_array_unref(added);
+	g_array_unref(old_set);
+
+on_exit:
+
+	return removed;
+}
+
+static GArray *prv_bm_test_ids_prop_change(dld_device_t *device,
+					   const gchar *key,
+					   const gchar *ids_str,
+					   GArray **set)
+{
+	GVariantBuilder ids_vb;
+	GVariant *ids;
+	GArray *removed;
+
+	g_variant_builder_init(&ids_vb, G_VARIANT_TYPE("au"));
+
+	prv_csv_add_uints(ids_str, &ids_vb);
+
+	ids = g_variant_ref_sink(g_variant_builder_end(&ids_vb));
+
+	prv_change_prop(device, key, ids);
+	removed = prv_test_id_set_update(device, key, set, ids);
+
+	g_variant_unref(ids);
+
+	return removed;
+}
+
+void dld_device_tests_changed(dld_device_t *device, GVariant *test_ids,
+			      GVariant *active_test_ids)
+{
+	GArray *removed;
+
+	g_variant_ref_sink(test_ids);
+	g_variant_ref_sink(active_test_ids);
+
+	prv_change_prop(device, DLD_INTERFACE_PROP_TEST_IDS, test_ids);
+	removed = prv_test_id_set_update(device, DLD_INTERFACE_PROP_TEST_IDS,
+					 &device->test_id_set, test_ids);
+	if (removed)
+		g_array_unref(removed);
+
+	prv_change_prop(device, DLD_INTERFACE_PROP_ACTIVE_TEST_IDS,
+			active_test_ids);
+	removed = prv_test_id_set_update(device,
+					 DLD_INTERFACE_PROP_ACTIVE_TEST_IDS,
+					 &device->active_test_id_set,
+					 active_test_ids);
+	if (removed)
+		g_array_unref(removed);
+
+	g_variant_unref(test_ids);
+	g_variant_unref(active_test_ids);
+}
+
+static void prv_prune_test_table(GHashTable *table, GArray *test_ids)
+{
+	GHashTableIter iter;
+	gpointer key;
 
-	g_strfreev(parts);
+	g_hash_table_iter_init(&iter, table);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+		if (!prv_test_id_set_contains(test_ids,
+					      GPOINTER_TO_UINT(key)))
+			g_hash_table_iter_remove(&iter);
 }
 
 static void prv_bm_test_ids_cb(GUPnPServiceProxy *proxy,
@@ -711,13 +1327,32 @@ static void prv_bm_test_ids_cb(GUPnPServiceProxy *proxy,
 {
 	dld_device_t *device = user_data;
 	const gchar *test_ids_str;
+	GArray *removed;
+	GList *link;
+	GList *next;
+
+	dld_metrics_event_received(device->path, variable);
 
 	test_ids_str = g_value_get_string(value);
 
 	DLEYNA_LOG_DEBUG("prv_bm_test_ids_cb: %s", test_ids_str);
 
-	prv_bm_test_ids_prop_change(device, DLD_INTERFACE_PROP_TEST_IDS,
-				    test_ids_str);
+	removed = prv_bm_test_ids_prop_change(device,
+					      DLD_INTERFACE_PROP_TEST_IDS,
+					      test_ids_str,
+					      &device->test_id_set);
+	if (removed)
+		g_array_unref(removed);
+
+	/* Deleted tests can not be queried anymore, drop what we know */
+	prv_prune_test_table(device->completed_tests, device->test_id_set);
+	prv_prune_test_table(device->test_results, device->test_id_set);
+
+	for (link = device->completed_order.head; link; link = next) {
+		next = link->next;
+		if (!g_hash_table_lookup(device->completed_tests, link->data))
+			g_queue_delete_link(&device->completed_order, link);
+	}
 }
 
 static void prv_bm_active_test_ids_cb(GUPnPServiceProxy *proxy,
@@ -727,13 +1362,29 @@ static void prv_bm_active_test_ids_cb(GUPnPServiceProxy *proxy,
 {
 	dld_device_t *device = user_data;
 	const gchar *active_test_ids_str;
+	GArray *removed;
+	guint i;
+
+	dld_metrics_event_received(device->path, variable);
 
 	active_test_ids_str = g_value_get_string(value);
 
 	DLEYNA_LOG_DEBUG("prv_bm_active_test_ids_cb: %s", active_test_ids_str);
 
-	prv_bm_test_ids_prop_change(device, DLD_INTERFACE_PROP_ACTIVE_TEST_IDS,
-				    active_test_ids_str);
+	removed = prv_bm_test_ids_prop_change(
+					device,
+					DLD_INTERFACE_PROP_ACTIVE_TEST_IDS,
+					active_test_ids_str,
+					&device->active_test_id_set);
+
+	/* Tests leaving the active set have completed or been cancelled */
+	if (removed) {
+		for (i = 0; i < removed->len; ++i)
+			prv_test_watch_start(device, proxy,
+					     g_array_index(removed, guint32,
+							   i));
+		g_array_unref(removed);
+	}
 }
 
 static void prv_props_update(dld_device_t *device)
@@ -802,6 +1453,8 @@ static void prv_props_update(dld_device_t *device)
 	val = g_variant_ref_sink(g_variant_new_string(str));
 	g_hash_table_insert(props, DLD_INTERFACE_PROP_PRESENTATION_URL, val);
 	g_free(str);
+
+	prv_props_invalidate(device);
 }
 
 void dld_device_get_prop(dld_device_t *device, dld_task_t *task,
@@ -832,18 +1485,167 @@ void dld_device_get_all_props(dld_device_t *device, dld_task_t *task,
 	(void) g_idle_add(dld_async_task_complete, cb_data);
 }
 
-static void prv_build_icon_result(dld_device_t *device, dld_task_t *task)
+static SoupSession *prv_icon_session_get(void)
+{
+	if (!g_icon_session)
+		g_icon_session = soup_session_async_new_with_options(
+				SOUP_SESSION_MAX_CONNS,
+				DLD_DEVICE_ICON_MAX_CONNS,
+				SOUP_SESSION_MAX_CONNS_PER_HOST,
+				DLD_DEVICE_ICON_MAX_CONNS_PER_HOST,
+				NULL);
+
+	return g_icon_session;
+}
+
+void dld_device_icon_session_delete(void)
+{
+	if (g_icon_session) {
+		soup_session_abort(g_icon_session);
+		g_object_unref(g_icon_session);
+		g_icon_session = NULL;
+	}
+}
+
+static gchar *prv_icon_key(const gchar *mime_type, gint width, gint height)
+{
+	return g_strdup_printf("%s/%dx%d", mime_type ? mime_type : "",
+			       width, height);
+}
+
+static gboolean prv_icon_parse_resolution(const gchar *resolution,
+					  gint *width, gint *height)
+{
+	gchar *end;
+
+	*width = -1;
+	*height = -1;
+
+	if (!*resolution)
+		return TRUE;
+
+	*width = strtol(resolution, &end, 10);
+	if (*end != 'x' || *width <= 0)
+		return FALSE;
+
+	*height = strtol(end + 1, &end, 10);
+	if (*end || *height <= 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static void prv_build_icon_result(dld_device_icon_t *icon, dld_task_t *task)
 {
 	GVariant *out_p[2];
 
 	out_p[0] = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE,
-					     device->icon.bytes,
-					     device->icon.size,
+					     icon->bytes,
+					     icon->size,
 					     1);
-	out_p[1] = g_variant_new_string(device->icon.mime_type);
+	out_p[1] = g_variant_new_string(icon->mime_type ? icon->mime_type : "");
 	task->result = g_variant_ref_sink(g_variant_new_tuple(out_p, 2));
 }
 
+#ifdef HAVE_GDK_PIXBUF
+static void prv_icon_scale(dld_device_icon_t *icon, const gchar *mime_type,
+			   gint width, gint height)
+{
+	GdkPixbufLoader *loader;
+	GdkPixbuf *pixbuf;
+	GdkPixbuf *scaled = NULL;
+	gboolean written;
+	gchar *buffer;
+	gsize size;
+	gint src_width;
+	gint src_height;
+	gdouble scale;
+	const gchar *type = "png";
+	GError *error = NULL;
+
+	loader = gdk_pixbuf_loader_new();
+
+	written = gdk_pixbuf_loader_write(loader, icon->bytes, icon->size,
+					  &error);
+	if (!gdk_pixbuf_loader_close(loader, written ? &error : NULL) ||
+	    !written)
+		goto on_error;
+
+	pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+	src_width = gdk_pixbuf_get_width(pixbuf);
+	src_height = gdk_pixbuf_get_height(pixbuf);
+
+	if (width > 0 && (src_width > width || src_height > height)) {
+		scale = MIN((gdouble)width / src_width,
+			    (gdouble)height / src_height);
+		scaled = gdk_pixbuf_scale_simple(
+					pixbuf,
+					MAX(1, (gint)(src_width * scale)),
+					MAX(1, (gint)(src_height * scale)),
+					GDK_INTERP_BILINEAR);
+	} else {
+		scaled = g_object_ref(pixbuf);
+	}
+
+	if (mime_type && !strcmp(mime_type, "image/jpeg"))
+		type = "jpeg";
+
+	if (!gdk_pixbuf_save_to_buffer(scaled, &buffer, &size, type, &error,
+				       NULL))
+		goto on_error;
+
+	DLEYNA_LOG_DEBUG("Scaled icon from %dx%d %s to %dx%d %s",
+			 src_width, src_height,
+			 icon->mime_type ? icon->mime_type : "(none)",
+			 gdk_pixbuf_get_width(scaled),
+			 gdk_pixbuf_get_height(scaled), type);
+
+	g_free(icon->bytes);
+	g_free(icon->mime_type);
+	icon->bytes = (guchar *)buffer;
+	icon->size = size;
+	icon->mime_type = g_strconcat("image/", type, NULL);
+
+on_error:
+
+	if (error) {
+		DLEYNA_LOG_WARNING("Unable to scale icon: %s", error->message);
+		g_error_free(error);
+	}
+
+	if (scaled)
+		g_object_unref(scaled);
+	g_object_unref(loader);
+}
+#endif
+
+static dld_device_icon_t *prv_icon_add_variant(dld_device_t *device,
+					       prv_download_info_t *download,
+					       const gchar *mime_type,
+					       guchar *bytes, gsize size)
+{
+	dld_device_icon_t *icon;
+
+	icon = g_new0(dld_device_icon_t, 1);
+	icon->mime_type = g_strdup(mime_type);
+	icon->bytes = bytes;
+	icon->size = size;
+
+#ifdef HAVE_GDK_PIXBUF
+	if ((download->width > 0 &&
+	     (download->icon_width <= 0 ||
+	      download->icon_width > download->width ||
+	      download->icon_height > download->height)) ||
+	    (download->mime_type && g_strcmp0(download->mime_type, mime_type)))
+		prv_icon_scale(icon, download->mime_type, download->width,
+			       download->height);
+#endif
+
+	g_hash_table_insert(device->icons, g_strdup(download->key), icon);
+
+	return icon;
+}
+
 static void prv_get_icon_cancelled(GCancellable *cancellable,
 				   gpointer user_data)
 {
@@ -863,9 +1665,109 @@ static void prv_free_download_info(prv_download_info_t *download)
 	if (download->msg)
 		g_object_unref(download->msg);
 	g_object_unref(download->session);
+	g_free(download->udn);
+	g_free(download->url);
+	g_free(download->key);
+	g_free(download->icon_mime_type);
 	g_free(download);
 }
 
+static void prv_icon_cache_store_message(const gchar *udn, const gchar *url,
+					 const gchar *mime_type,
+					 SoupMessage *msg)
+{
+	dld_icon_cache_entry_t entry;
+
+	entry.mime_type = (gchar *)mime_type;
+	entry.bytes = (guchar *)msg->response_body->data;
+	entry.size = msg->response_body->length;
+	entry.etag = (gchar *)soup_message_headers_get_one(
+						msg->response_headers, "ETag");
+	entry.last_modified = (gchar *)soup_message_headers_get_one(
+					msg->response_headers, "Last-Modified");
+
+	dld_icon_cache_store(udn, url, &entry);
+}
+
+static void prv_icon_validation_cb(SoupSession *session,
+				   SoupMessage *msg,
+				   gpointer user_data)
+{
+	dld_device_icon_validation_t *validation = user_data;
+	dld_device_t *device = validation->device;
+
+	if (!device)
+		goto out;
+
+	device->icon_validation = NULL;
+
+	if (msg->status_code == SOUP_STATUS_NOT_MODIFIED) {
+		DLEYNA_LOG_DEBUG("Cached icon of %s is up to date",
+				 validation->udn);
+	} else if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) {
+		DLEYNA_LOG_DEBUG("Icon of %s has changed", validation->udn);
+
+		g_hash_table_remove_all(device->icons);
+		prv_icon_cache_store_message(validation->udn, validation->url,
+					     validation->mime_type, msg);
+	} else {
+		DLEYNA_LOG_DEBUG("Failed to revalidate device icon: %s",
+				 msg->reason_phrase);
+	}
+
+out:
+
+	g_free(validation->udn);
+	g_free(validation->url);
+	g_free(validation->mime_type);
+	g_free(validation);
+}
+
+static void prv_icon_validate(dld_device_t *device, const gchar *udn,
+			      const gchar *url,
+			      const dld_icon_cache_entry_t *entry)
+{
+	dld_device_icon_validation_t *validation;
+	SoupMessage *msg;
+
+	/* A second request would orphan the message dld_device_delete has
+	 * to cancel, and its callback would then outlive the device.
+	 */
+	if (device->icon_validation)
+		goto on_exit;
+
+	if (!entry->etag && !entry->last_modified)
+		goto on_exit;
+
+	msg = soup_message_new(SOUP_METHOD_GET, url);
+	if (!msg)
+		goto on_exit;
+
+	if (entry->etag)
+		soup_message_headers_append(msg->request_headers,
+					    "If-None-Match", entry->etag);
+	if (entry->last_modified)
+		soup_message_headers_append(msg->request_headers,
+					    "If-Modified-Since",
+					    entry->last_modified);
+
+	validation = g_new0(dld_device_icon_validation_t, 1);
+	validation->device = device;
+	validation->msg = msg;
+	validation->udn = g_strdup(udn);
+	validation->url = g_strdup(url);
+	validation->mime_type = g_strdup(entry->mime_type);
+
+	device->icon_validation = validation;
+
+	soup_session_queue_message(prv_icon_session_get(), msg,
+				   prv_icon_validation_cb, validation);
+
+on_exit:
+
+	return;
+}
+
 static void prv_get_icon_session_cb(SoupSession *session,
 				    SoupMessage *msg,
 				    gpointer user_data)
@@ -873,17 +1775,22 @@ static void prv_get_icon_session_cb(SoupSession *session,
 	prv_download_info_t *download = (prv_download_info_t *)user_data;
 	dld_async_task_t *cb_data = (dld_async_task_t *)download->task;
 	dld_device_t *device = (dld_device_t *)cb_data->device;
+	dld_device_icon_t *icon;
 
 	if (msg->status_code == SOUP_STATUS_CANCELLED)
 		goto out;
 
 	if (SOUP_STATUS_IS_SUCCESSFUL(msg->status_code)) {
-		device->icon.size = msg->response_body->length;
-		device->icon.bytes = g_malloc(device->icon.size);
-		memcpy(device->icon.bytes, msg->response_body->data,
-		       device->icon.size);
+		prv_icon_cache_store_message(download->udn, download->url,
+					     download->icon_mime_type, msg);
 
-		prv_build_icon_result(device, &cb_data->task);
+		icon = prv_icon_add_variant(
+				device, download, download->icon_mime_type,
+				g_memdup(msg->response_body->data,
+					 msg->response_body->length),
+				msg->response_body->length);
+
+		prv_build_icon_result(icon, &cb_data->task);
 	} else {
 		DLEYNA_LOG_DEBUG("Failed to GET device icon: %s",
 				 msg->reason_phrase);
@@ -907,34 +1814,92 @@ void dld_device_get_icon(dld_device_t *device, dld_task_t *task,
 	GUPnPDeviceInfo *info;
 	dld_device_context_t *context;
 	dld_async_task_t *cb_data = (dld_async_task_t *)task;
-	gchar *url;
+	dld_task_get_icon_t *task_data = &task->ut.get_icon;
+	dld_device_icon_t *icon;
+	gchar *url = NULL;
 	prv_download_info_t *download;
+	dld_icon_cache_entry_t entry = { 0 };
 
 	cb_data->cb = cb;
 	cb_data->device = device;
 
-	if (device->icon.size != 0) {
-		prv_build_icon_result(device, task);
-		goto end;
+	download = g_new0(prv_download_info_t, 1);
+	download->task = cb_data;
+	download->session = g_object_ref(prv_icon_session_get());
+
+	if (*task_data->mime_type)
+		download->mime_type = task_data->mime_type;
+
+	if (!prv_icon_parse_resolution(task_data->resolution,
+				       &download->width, &download->height)) {
+		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
+					     DLEYNA_ERROR_BAD_QUERY,
+					     "Invalid resolution %s",
+					     task_data->resolution);
+		goto on_error;
+	}
+
+	download->key = prv_icon_key(download->mime_type, download->width,
+				     download->height);
+
+	icon = g_hash_table_lookup(device->icons, download->key);
+	if (icon) {
+		prv_build_icon_result(icon, task);
+		goto on_error;
+	}
+
+	if (device->local) {
+		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
+					     DLEYNA_ERROR_NOT_SUPPORTED,
+					     "No icon available");
+		goto on_error;
 	}
 
 	context = dld_device_get_context(device);
 	info = (GUPnPDeviceInfo *)context->device_proxy;
 
-	url = gupnp_device_info_get_icon_url(info, NULL, -1, -1, -1, FALSE,
-					     &device->icon.mime_type, NULL,
-					     NULL, NULL);
+	url = gupnp_device_info_get_icon_url(info, download->mime_type, -1,
+					     download->width, download->height,
+					     download->width > 0,
+					     &download->icon_mime_type,
+					     NULL, &download->icon_width,
+					     &download->icon_height);
+	if (url == NULL && download->mime_type)
+		url = gupnp_device_info_get_icon_url(info, NULL, -1,
+						     download->width,
+						     download->height,
+						     download->width > 0,
+						     &download->icon_mime_type,
+						     NULL,
+						     &download->icon_width,
+						     &download->icon_height);
 	if (url == NULL) {
 		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
 					     DLEYNA_ERROR_NOT_SUPPORTED,
 					     "No icon available");
-		goto end;
+		goto on_error;
+	}
+
+	download->udn = g_strdup(gupnp_device_info_get_udn(info));
+	download->url = url;
+
+	if (dld_icon_cache_lookup(download->udn, url, &entry)) {
+		DLEYNA_LOG_DEBUG("Serving icon of %s from cache",
+				 download->udn);
+
+		icon = prv_icon_add_variant(device, download, entry.mime_type,
+					    entry.bytes, entry.size);
+		entry.bytes = NULL;
+
+		prv_build_icon_result(icon, task);
+		prv_icon_validate(device, download->udn, url, &entry);
+
+		dld_icon_cache_entry_clear(&entry);
+
+		goto on_error;
 	}
 
-	download = g_new0(prv_download_info_t, 1);
-	download->session = soup_session_async_new();
 	download->msg = soup_message_new(SOUP_METHOD_GET, url);
-	download->task = cb_data;
 
 	if (!download->msg) {
 		DLEYNA_LOG_WARNING("Invalid URL %s", url);
@@ -942,10 +1907,7 @@ void dld_device_get_icon(dld_device_t *device, dld_task_t *task,
 		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
 					     DLEYNA_ERROR_BAD_RESULT,
 					     "Invalid URL %s", url);
-		prv_free_download_info(download);
-		g_free(url);
-
-		goto end;
+		goto on_error;
 	}
 
 	cb_data->cancel_id =
@@ -957,74 +1919,312 @@ void dld_device_get_icon(dld_device_t *device, dld_task_t *task,
 	soup_session_queue_message(download->session, download->msg,
 				   prv_get_icon_session_cb, download);
 
-	g_free(url);
-
 	return;
 
-end:
+on_error:
+
+	prv_free_download_info(download);
 
 	(void) g_idle_add(dld_async_task_complete, cb_data);
 }
 
-static void prv_generic_test_action(dld_device_t *device, dld_task_t *task,
-				    dld_upnp_task_complete_t cb,
-				    const gchar *action,
-				    GUPnPServiceProxyActionCallback action_cb)
+/* Devices that never send TestIDs events would make the completed tests
+ * and their results grow forever, the oldest ones are forgotten first.
+ */
+static void prv_test_mark_completed(dld_device_t *device, guint test_id)
 {
-	dld_device_context_t *context;
-	dld_async_task_t *cb_data = (dld_async_task_t *)task;
-	dld_task_test_t *test = &task->ut.test;
-	guint test_id = test->id;
+	gpointer key = GUINT_TO_POINTER(test_id);
+	gpointer oldest;
 
-	context = dld_device_get_context(device);
-	cb_data->cb = cb;
-	cb_data->device = device;
+	if (g_hash_table_lookup(device->completed_tests, key))
+		goto on_exit;
 
-	cb_data->cancel_id =
-		g_cancellable_connect(cb_data->cancellable,
-				      G_CALLBACK(dld_async_task_cancelled),
-				      cb_data, NULL);
-	cb_data->proxy = context->bms.proxy;
+	if (g_queue_get_length(&device->completed_order) >=
+					DLD_DEVICE_MAX_COMPLETED_TESTS) {
+		oldest = g_queue_pop_head(&device->completed_order);
+		(void) g_hash_table_remove(device->completed_tests, oldest);
+		(void) g_hash_table_remove(device->test_results, oldest);
+	}
 
-	g_object_add_weak_pointer((G_OBJECT(context->bms.proxy)),
-				  (gpointer *)&cb_data->proxy);
+	g_hash_table_insert(device->completed_tests, key,
+			    GINT_TO_POINTER(TRUE));
+	g_queue_push_tail(&device->completed_order, key);
 
-	cb_data->action =
-		gupnp_service_proxy_begin_action(cb_data->proxy, action,
-						 action_cb, cb_data,
-						 "TestID", G_TYPE_UINT, test_id,
-						 NULL);
+on_exit:
+
+	return;
 }
 
-static void prv_get_test_info_cb(GUPnPServiceProxy *proxy,
-				 GUPnPServiceProxyAction *action,
-				 gpointer user_data)
+static void prv_test_result_cache_store(dld_device_t *device, guint test_id,
+					const gchar *action, GVariant *result)
 {
-	GError *error = NULL;
-	dld_async_task_t *cb_data = user_data;
-	const gchar *message;
-	gchar *type = NULL;
-	gchar *state = NULL;
-	gboolean end;
-	GVariant *out_params[2];
+	prv_test_result_entry_t *entry;
 
-	DLEYNA_LOG_DEBUG("Enter");
+	if (!g_hash_table_lookup(device->completed_tests,
+				 GUINT_TO_POINTER(test_id)))
+		goto on_exit;
 
-	end = gupnp_service_proxy_end_action(cb_data->proxy, cb_data->action,
-					     &error,
-					     "Type", G_TYPE_STRING, &type,
-					     "State", G_TYPE_STRING, &state,
-					     NULL);
-	if (!end || (type == NULL) || (state == NULL)) {
-		message = (error != NULL) ? error->message : "Invalid result";
-		DLEYNA_LOG_WARNING("GetTestInfo operation failed: %s",
-				   message);
+	DLEYNA_LOG_DEBUG("Caching %s of test %u", action, test_id);
 
+	entry = g_new(prv_test_result_entry_t, 1);
+	entry->action = action;
+	entry->result = g_variant_ref(result);
+
+	g_hash_table_replace(device->test_results, GUINT_TO_POINTER(test_id),
+			     entry);
+
+on_exit:
+
+	return;
+}
+
+static gboolean prv_test_result_from_cache(dld_device_t *device,
+					   dld_task_t *task,
+					   dld_upnp_task_complete_t cb,
+					   const gchar *action)
+{
+	dld_async_task_t *cb_data = (dld_async_task_t *)task;
+	prv_test_result_entry_t *entry;
+
+	entry = g_hash_table_lookup(device->test_results,
+				    GUINT_TO_POINTER(task->ut.test.id));
+
+	if (!entry || strcmp(entry->action, action))
+		return FALSE;
+
+	DLEYNA_LOG_DEBUG("%s of test %u served from cache", action,
+			 task->ut.test.id);
+
+	cb_data->cb = cb;
+	cb_data->device = device;
+	task->result = g_variant_ref(entry->result);
+
+	(void) g_idle_add(dld_async_task_complete, cb_data);
+
+	return TRUE;
+}
+
+static void prv_shared_action_free(prv_shared_action_t *shared)
+{
+	g_object_unref(shared->proxy);
+	g_free(shared->key);
+	g_free(shared);
+}
+
+static void prv_shared_action_abort(gpointer data)
+{
+	prv_shared_action_t *shared = data;
+	dld_async_task_t *cb_data;
+	GList *l;
+
+	for (l = shared->waiters; l != NULL; l = l->next) {
+		cb_data = l->data;
+		cb_data->private = NULL;
+		g_cancellable_disconnect(cb_data->cancellable,
+					 cb_data->cancel_id);
+	}
+
+	g_list_free(shared->waiters);
+
+	gupnp_service_proxy_cancel_action(shared->proxy, shared->action);
+	prv_shared_action_free(shared);
+}
+
+static void prv_shared_action_detach(prv_shared_action_t *shared)
+{
+	(void) g_hash_table_steal(shared->device->shared_actions, shared->key);
+}
+
+static void prv_shared_action_cb(GUPnPServiceProxy *proxy,
+				 GUPnPServiceProxyAction *action,
+				 gpointer user_data)
+{
+	prv_shared_action_t *shared = user_data;
+	dld_async_task_t *cb_data;
+	GError *error = NULL;
+	GVariant *result;
+	GList *l;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	prv_shared_action_detach(shared);
+	dld_metrics_action_completed(shared->device->path, shared->name,
+				     shared->action_time);
+
+	result = shared->end(proxy, action, &error);
+	if (result)
+		shared->done(shared->device, shared->test_id, shared->name,
+			     result);
+
+	DLEYNA_LOG_DEBUG("%s of test %u answers %u task(s)", shared->name,
+			 shared->test_id, g_list_length(shared->waiters));
+
+	for (l = shared->waiters; l != NULL; l = l->next) {
+		cb_data = l->data;
+		cb_data->private = NULL;
+
+		if (result)
+			cb_data->task.result = g_variant_ref(result);
+		else
+			cb_data->error = g_error_copy(error);
+
+		(void) g_idle_add(dld_async_task_complete, cb_data);
+		g_cancellable_disconnect(cb_data->cancellable,
+					 cb_data->cancel_id);
+	}
+
+	g_list_free(shared->waiters);
+	prv_shared_action_free(shared);
+
+	if (result)
+		g_variant_unref(result);
+
+	if (error != NULL)
+		g_error_free(error);
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
+static void prv_shared_action_cancelled(GCancellable *cancellable,
+					gpointer user_data)
+{
+	dld_async_task_t *cb_data = user_data;
+	prv_shared_action_t *shared = cb_data->private;
+
+	shared->waiters = g_list_remove(shared->waiters, cb_data);
+	cb_data->private = NULL;
+
+	if (!shared->waiters) {
+		DLEYNA_LOG_DEBUG("No task left waiting for %s of test %u",
+				 shared->name, shared->test_id);
+
+		prv_shared_action_detach(shared);
+		gupnp_service_proxy_cancel_action(shared->proxy,
+						  shared->action);
+		prv_shared_action_free(shared);
+	}
+
+	if (!cb_data->error)
 		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
-					     DLEYNA_ERROR_OPERATION_FAILED,
-					     "GetTestInfo operation "
-					     "failed: %s",
-					     message);
+					     DLEYNA_ERROR_CANCELLED,
+					     "Operation cancelled.");
+
+	(void) g_idle_add(dld_async_task_complete, cb_data);
+}
+
+static void prv_shared_test_action(dld_device_t *device, dld_task_t *task,
+				   dld_upnp_task_complete_t cb,
+				   const gchar *action,
+				   prv_test_result_end_t end,
+				   prv_shared_action_done_t done)
+{
+	dld_device_context_t *context;
+	dld_async_task_t *cb_data = (dld_async_task_t *)task;
+	prv_shared_action_t *shared;
+	guint test_id = task->ut.test.id;
+	gchar *key;
+
+	cb_data->cb = cb;
+	cb_data->device = device;
+
+	key = g_strdup_printf("%s/%u", action, test_id);
+	shared = g_hash_table_lookup(device->shared_actions, key);
+
+	if (shared) {
+		DLEYNA_LOG_DEBUG("Joining in-flight %s of test %u", action,
+				 test_id);
+
+		g_free(key);
+	} else {
+		context = dld_device_get_context(device);
+
+		shared = g_new0(prv_shared_action_t, 1);
+		shared->device = device;
+		shared->key = key;
+		shared->name = action;
+		shared->test_id = test_id;
+		shared->proxy = g_object_ref(context->bms.proxy);
+		shared->end = end;
+		shared->done = done;
+
+		g_hash_table_insert(device->shared_actions, key, shared);
+
+		shared->action_time = g_get_monotonic_time();
+		shared->action = gupnp_service_proxy_begin_action(
+						shared->proxy, action,
+						prv_shared_action_cb, shared,
+						"TestID", G_TYPE_UINT, test_id,
+						NULL);
+	}
+
+	/* Connected last: an already cancelled task detaches immediately */
+	shared->waiters = g_list_append(shared->waiters, cb_data);
+	cb_data->private = shared;
+	cb_data->cancel_id =
+		g_cancellable_connect(cb_data->cancellable,
+				      G_CALLBACK(prv_shared_action_cancelled),
+				      cb_data, NULL);
+}
+
+static void prv_generic_test_action(dld_device_t *device, dld_task_t *task,
+				    dld_upnp_task_complete_t cb,
+				    const gchar *action,
+				    GUPnPServiceProxyActionCallback action_cb)
+{
+	dld_device_context_t *context;
+	dld_async_task_t *cb_data = (dld_async_task_t *)task;
+	dld_task_test_t *test = &task->ut.test;
+	guint test_id = test->id;
+
+	context = dld_device_get_context(device);
+	cb_data->cb = cb;
+	cb_data->device = device;
+
+	cb_data->cancel_id =
+		g_cancellable_connect(cb_data->cancellable,
+				      G_CALLBACK(dld_async_task_cancelled),
+				      cb_data, NULL);
+	cb_data->proxy = context->bms.proxy;
+
+	g_object_add_weak_pointer((G_OBJECT(context->bms.proxy)),
+				  (gpointer *)&cb_data->proxy);
+
+	cb_data->action_time = g_get_monotonic_time();
+	cb_data->action =
+		gupnp_service_proxy_begin_action(cb_data->proxy, action,
+						 action_cb, cb_data,
+						 "TestID", G_TYPE_UINT, test_id,
+						 NULL);
+}
+
+static GVariant *prv_test_info_end(GUPnPServiceProxy *proxy,
+				   GUPnPServiceProxyAction *action,
+				   GError **error)
+{
+	GError *upnp_error = NULL;
+	const gchar *message;
+	gchar *type = NULL;
+	gchar *state = NULL;
+	gboolean end;
+	GVariant *out_params[2];
+	GVariant *result = NULL;
+
+	end = gupnp_service_proxy_end_action(proxy, action,
+					     &upnp_error,
+					     "Type", G_TYPE_STRING, &type,
+					     "State", G_TYPE_STRING, &state,
+					     NULL);
+	if (!end || (type == NULL) || (state == NULL)) {
+		message = (upnp_error != NULL) ? upnp_error->message :
+						 "Invalid result";
+		DLEYNA_LOG_WARNING("GetTestInfo operation failed: %s",
+				   message);
+
+		*error = g_error_new(DLEYNA_SERVER_ERROR,
+				     DLEYNA_ERROR_OPERATION_FAILED,
+				     "GetTestInfo operation "
+				     "failed: %s",
+				     message);
 
 		goto on_error;
 	}
@@ -1034,21 +2234,33 @@ static void prv_get_test_info_cb(GUPnPServiceProxy *proxy,
 	out_params[0] = g_variant_new_string(type);
 	out_params[1] = g_variant_new_string(state);
 
-	cb_data->task.result = g_variant_ref_sink(
-					g_variant_new_tuple(out_params, 2));
+	result = g_variant_ref_sink(g_variant_new_tuple(out_params, 2));
 
 on_error:
 
-	(void) g_idle_add(dld_async_task_complete, cb_data);
-	g_cancellable_disconnect(cb_data->cancellable, cb_data->cancel_id);
-
 	g_free(type);
 	g_free(state);
 
-	if (error != NULL)
-		g_error_free(error);
+	if (upnp_error != NULL)
+		g_error_free(upnp_error);
 
-	DLEYNA_LOG_DEBUG("Exit");
+	return result;
+}
+
+static gboolean prv_test_info_is_completed(GVariant *info)
+{
+	const gchar *state;
+
+	g_variant_get_child(info, 1, "&s", &state);
+
+	return !strcmp(state, "Completed");
+}
+
+static void prv_test_info_done(dld_device_t *device, guint test_id,
+			       const gchar *action, GVariant *info)
+{
+	if (prv_test_info_is_completed(info))
+		prv_test_mark_completed(device, test_id);
 }
 
 void dld_device_get_test_info(dld_device_t *device, dld_task_t *task,
@@ -1056,8 +2268,11 @@ void dld_device_get_test_info(dld_device_t *device, dld_task_t *task,
 {
 	DLEYNA_LOG_DEBUG("Enter");
 
-	prv_generic_test_action(device, task, cb,
-				"GetTestInfo", prv_get_test_info_cb);
+	if (device->local)
+		dld_local_get_test_info(device->local, task, cb);
+	else
+		prv_shared_test_action(device, task, cb, "GetTestInfo",
+				       prv_test_info_end, prv_test_info_done);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -1072,6 +2287,9 @@ static void prv_cancel_test_cb(GUPnPServiceProxy *proxy,
 
 	DLEYNA_LOG_DEBUG("Enter");
 
+	dld_metrics_action_completed(cb_data->device->path, "CancelTest",
+				     cb_data->action_time);
+
 	if (!gupnp_service_proxy_end_action(cb_data->proxy, cb_data->action,
 					    &error,
 					    NULL)) {
@@ -1100,8 +2318,11 @@ void dld_device_cancel_test(dld_device_t *device, dld_task_t *task,
 {
 	DLEYNA_LOG_DEBUG("Enter");
 
-	prv_generic_test_action(device, task, cb,
-				"CancelTest", prv_cancel_test_cb);
+	if (device->local)
+		dld_local_cancel_test(device->local, task, cb);
+	else
+		prv_generic_test_action(device, task, cb,
+					"CancelTest", prv_cancel_test_cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -1117,6 +2338,9 @@ static void prv_generic_test_action_cb(GUPnPServiceProxy *proxy,
 	guint test_id = G_MAXUINT32;
 	gboolean end;
 
+	dld_metrics_action_completed(cb_data->device->path, action_str,
+				     cb_data->action_time);
+
 	end = gupnp_service_proxy_end_action(cb_data->proxy, cb_data->action,
 					     &error,
 					     "TestID", G_TYPE_UINT, &test_id,
@@ -1139,6 +2363,8 @@ static void prv_generic_test_action_cb(GUPnPServiceProxy *proxy,
 	cb_data->task.result = g_variant_ref_sink(
 					g_variant_new_uint32(test_id));
 
+	prv_test_watch_poll_start(cb_data->device, proxy, test_id);
+
 on_error:
 
 	(void) g_idle_add(dld_async_task_complete, cb_data);
@@ -1171,6 +2397,11 @@ void dld_device_ping(dld_device_t *device, dld_task_t *task,
 	guint data_block_size = ping->data_block_size;
 	guint dscp = ping->dscp;
 
+	if (device->local) {
+		dld_local_start_test(device->local, task, cb);
+		return;
+	}
+
 	context = dld_device_get_context(device);
 	cb_data->cb = cb;
 	cb_data->device = device;
@@ -1184,6 +2415,7 @@ void dld_device_ping(dld_device_t *device, dld_task_t *task,
 	g_object_add_weak_pointer((G_OBJECT(context->bms.proxy)),
 				  (gpointer *)&cb_data->proxy);
 
+	cb_data->action_time = g_get_monotonic_time();
 	cb_data->action = gupnp_service_proxy_begin_action(
 				cb_data->proxy, "Ping",
 				prv_ping_cb, cb_data,
@@ -1195,12 +2427,11 @@ void dld_device_ping(dld_device_t *device, dld_task_t *task,
 				NULL);
 }
 
-static void prv_get_ping_result_cb(GUPnPServiceProxy *proxy,
-				   GUPnPServiceProxyAction *action,
-				   gpointer user_data)
+static GVariant *prv_ping_result_end(GUPnPServiceProxy *proxy,
+				     GUPnPServiceProxyAction *action,
+				     GError **error)
 {
-	GError *error = NULL;
-	dld_async_task_t *cb_data = user_data;
+	GError *upnp_error = NULL;
 	const gchar *message;
 	gchar *status = NULL;
 	gchar *info = NULL;
@@ -1211,12 +2442,11 @@ static void prv_get_ping_result_cb(GUPnPServiceProxy *proxy,
 	guint max_rsp_time = G_MAXUINT32;
 	gboolean end;
 	GVariant *out_params[7];
-
-	DLEYNA_LOG_DEBUG("Enter");
+	GVariant *result = NULL;
 
 	end = gupnp_service_proxy_end_action(
-			cb_data->proxy, cb_data->action,
-			&error,
+			proxy, action,
+			&upnp_error,
 			"Status", G_TYPE_STRING, &status,
 			"AdditionalInfo", G_TYPE_STRING, &info,
 			"SuccessCount", G_TYPE_UINT, &success,
@@ -1229,15 +2459,16 @@ static void prv_get_ping_result_cb(GUPnPServiceProxy *proxy,
 	    (success == G_MAXUINT32) || (failure == G_MAXUINT32) ||
 	    (avg_rsp_time == G_MAXUINT32) || (min_rsp_time == G_MAXUINT32) ||
 	    (max_rsp_time == G_MAXUINT32)) {
-		message = (error != NULL) ? error->message : "Invalid result";
+		message = (upnp_error != NULL) ? upnp_error->message :
+						 "Invalid result";
 		DLEYNA_LOG_WARNING("Ping operation failed: %s",
 				   message);
 
-		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
-					     DLEYNA_ERROR_OPERATION_FAILED,
-					     "Ping operation "
-					     "failed: %s",
-					     message);
+		*error = g_error_new(DLEYNA_SERVER_ERROR,
+				     DLEYNA_ERROR_OPERATION_FAILED,
+				     "Ping operation "
+				     "failed: %s",
+				     message);
 
 		goto on_error;
 	}
@@ -1258,21 +2489,17 @@ static void prv_get_ping_result_cb(GUPnPServiceProxy *proxy,
 	out_params[5] = g_variant_new_uint32(min_rsp_time);
 	out_params[6] = g_variant_new_uint32(max_rsp_time);
 
-	cb_data->task.result = g_variant_ref_sink(
-					g_variant_new_tuple(out_params, 7));
+	result = g_variant_ref_sink(g_variant_new_tuple(out_params, 7));
 
 on_error:
 
-	(void) g_idle_add(dld_async_task_complete, cb_data);
-	g_cancellable_disconnect(cb_data->cancellable, cb_data->cancel_id);
-
 	g_free(status);
 	g_free(info);
 
-	if (error != NULL)
-		g_error_free(error);
+	if (upnp_error != NULL)
+		g_error_free(upnp_error);
 
-	DLEYNA_LOG_DEBUG("Exit");
+	return result;
 }
 
 void dld_device_get_ping_result(dld_device_t *device, dld_task_t *task,
@@ -1280,9 +2507,14 @@ void dld_device_get_ping_result(dld_device_t *device, dld_task_t *task,
 {
 	DLEYNA_LOG_DEBUG("Enter");
 
-	prv_generic_test_action(device, task, cb,
-				"GetPingResult",
-				prv_get_ping_result_cb);
+	if (device->local)
+		dld_local_get_test_result(device->local, task, cb);
+	else if (!prv_test_result_from_cache(device, task, cb,
+					     "GetPingResult"))
+		prv_shared_test_action(device, task, cb,
+				       "GetPingResult",
+				       prv_ping_result_end,
+				       prv_test_result_cache_store);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -1309,6 +2541,11 @@ void dld_device_nslookup(dld_device_t *device, dld_task_t *task,
 	guint repeat = nslookup->repeat_count;
 	guint interval = nslookup->interval;
 
+	if (device->local) {
+		dld_local_start_test(device->local, task, cb);
+		return;
+	}
+
 	context = dld_device_get_context(device);
 	cb_data->cb = cb;
 	cb_data->device = device;
@@ -1322,6 +2559,7 @@ void dld_device_nslookup(dld_device_t *device, dld_task_t *task,
 	g_object_add_weak_pointer((G_OBJECT(context->bms.proxy)),
 				  (gpointer *)&cb_data->proxy);
 
+	cb_data->action_time = g_get_monotonic_time();
 	cb_data->action = gupnp_service_proxy_begin_action(
 				cb_data->proxy, "NSLookup",
 				prv_nslookup_cb, cb_data,
@@ -1332,55 +2570,28 @@ void dld_device_nslookup(dld_device_t *device, dld_task_t *task,
 				NULL);
 }
 
-static void prv_free_nslookup_result(prv_nslookup_result_t *result)
-{
-	if (result != NULL) {
-		g_free(result->status);
-		g_free(result->answer_type);
-		g_free(result->hostname_returned);
-		g_free(result->ip_addresses);
-		g_free(result->dns_server_ip);
-		g_free(result->response_time);
-
-		g_free(result);
-	}
-}
+static const xml_util_field_t g_nslookup_fields[] = {
+	{ "Status",
+	  G_STRUCT_OFFSET(prv_nslookup_result_t, status) },
+	{ "AnswerType",
+	  G_STRUCT_OFFSET(prv_nslookup_result_t, answer_type) },
+	{ "HostNameReturned",
+	  G_STRUCT_OFFSET(prv_nslookup_result_t, hostname_returned) },
+	{ "IPAddresses",
+	  G_STRUCT_OFFSET(prv_nslookup_result_t, ip_addresses) },
+	{ "DNSServerIP",
+	  G_STRUCT_OFFSET(prv_nslookup_result_t, dns_server_ip) },
+	{ "ResponseTime",
+	  G_STRUCT_OFFSET(prv_nslookup_result_t, response_time) }
+};
 
-static prv_nslookup_result_t *prv_extract_nslookup_result(xmlNode *result_node)
+static void prv_nslookup_add_result(gpointer record, gpointer user_data)
 {
-	prv_nslookup_result_t *result = NULL;
-
-	result = g_new0(prv_nslookup_result_t, 1);
-
-	result->status = xml_util_get_child_string_content_by_name(
-						result_node,
-						"Status",
-						NULL);
-
-	result->answer_type = xml_util_get_child_string_content_by_name(
-						result_node,
-						"AnswerType",
-						NULL);
-
-	result->hostname_returned = xml_util_get_child_string_content_by_name(
-						result_node,
-						"HostNameReturned",
-						NULL);
-
-	result->ip_addresses = xml_util_get_child_string_content_by_name(
-						result_node,
-						"IPAddresses",
-						NULL);
-
-	result->dns_server_ip = xml_util_get_child_string_content_by_name(
-						result_node,
-						"DNSServerIP",
-						NULL);
-
-	result->response_time = xml_util_get_child_string_content_by_name(
-						result_node,
-						"ResponseTime",
-						NULL);
+	prv_nslookup_result_t *result = record;
+	GVariantBuilder *results_vb = user_data;
+	GVariantBuilder ip_addresses_vb;
+	gchar ip_addresses[257];
+	guint response_time;
 
 	if ((result->hostname_returned == NULL ||
 	     strlen(result->hostname_returned) > 256) ||
@@ -1390,141 +2601,74 @@ static prv_nslookup_result_t *prv_extract_nslookup_result(xmlNode *result_node)
 	    (result->dns_server_ip == NULL) || (result->response_time == NULL))
 		goto on_error;
 
-	return result;
-
-on_error:
-	prv_free_nslookup_result(result);
-
-	return NULL;
-}
-
-static GList *prv_nslookup_result_decode(const gchar *nslookup_xml)
-{
-	xmlDoc *doc;
-	xmlNode *node;
-	GList *result_list = NULL;
-	prv_nslookup_result_t *nslookup_result;
-
-	DLEYNA_LOG_DEBUG("Enter");
-
-	DLEYNA_LOG_DEBUG_NL();
-	DLEYNA_LOG_DEBUG("NSLookupResult XML: %s", nslookup_xml);
-	DLEYNA_LOG_DEBUG_NL();
-
-	doc = xmlParseMemory(nslookup_xml, strlen(nslookup_xml) + 1);
-	if (doc == NULL) {
-		DLEYNA_LOG_WARNING("XML: invalid document");
-
-		goto on_exit;
-	}
-
-	node = xmlDocGetRootElement(doc);
-	if (node == NULL) {
-		DLEYNA_LOG_WARNING("XML: empty document");
-
-		goto on_exit;
-	}
-
-	if (node->name == NULL) {
-		DLEYNA_LOG_WARNING("XML: empty document name");
-
-		goto on_exit;
-	}
-
-	if (strcmp((char *)node->name, "NSLookupResult")) {
-		DLEYNA_LOG_WARNING("XML: invalid document name");
-
-		goto on_exit;
-	}
-
-	for (node = node->children; node; node = node->next) {
-		if (node->name != NULL &&
-		    !strcmp((char *)node->name, "Result")) {
-			nslookup_result = prv_extract_nslookup_result(node);
-
-			if (nslookup_result != NULL)
-				result_list = g_list_prepend(result_list,
-							     nslookup_result);
-		}
+	if (!prv_csv_parse_uint(result->response_time,
+				strlen(result->response_time),
+				&response_time)) {
+		DLEYNA_LOG_WARNING("Invalid ResponseTime '%s'",
+				   result->response_time);
+		goto on_error;
 	}
 
-on_exit:
-	DLEYNA_LOG_DEBUG("Exit");
-
-	if (doc != NULL)
-		xmlFreeDoc(doc);
-
-	return result_list;
-}
-
-static void prv_results_list_add_result(prv_nslookup_result_t *result,
-					GVariantBuilder *results_vb)
-{
-	GVariant *results;
-	GVariantBuilder ip_addresses_vb;
-	GVariant *ip_addresses_array;
-	gchar **ip_addresses;
-	unsigned int i = 0;
-
-	g_variant_builder_init(&ip_addresses_vb, G_VARIANT_TYPE("as"));
-
 	DLEYNA_LOG_DEBUG("Result: NSLookupResult");
 	DLEYNA_LOG_DEBUG("-> status: %s", result->status);
 	DLEYNA_LOG_DEBUG("-> answer_type: %s", result->answer_type);
 	DLEYNA_LOG_DEBUG("-> hostname_returned: %s", result->hostname_returned);
-	DLEYNA_LOG_DEBUG("-> result->ip_addresses: %s", result->ip_addresses);
+	DLEYNA_LOG_DEBUG("-> ip_addresses: %s", result->ip_addresses);
 	DLEYNA_LOG_DEBUG("-> dns_server_ip: %s", result->dns_server_ip);
 	DLEYNA_LOG_DEBUG("-> response_time: %s", result->response_time);
 
-	ip_addresses = g_strsplit(result->ip_addresses, ",", 0);
-	while (ip_addresses[i]) {
-		g_strstrip(ip_addresses[i]);
-
-		g_variant_builder_add(&ip_addresses_vb, "s", ip_addresses[i]);
-		++i;
-	}
-
-	ip_addresses_array = g_variant_builder_end(&ip_addresses_vb);
+	g_variant_builder_init(&ip_addresses_vb, G_VARIANT_TYPE("as"));
 
-	g_strfreev(ip_addresses);
+	/* The record is borrowed, split a copy of its bounded address list */
+	(void) g_strlcpy(ip_addresses, result->ip_addresses,
+			 sizeof(ip_addresses));
+	prv_csv_add_strings(ip_addresses, &ip_addresses_vb);
 
 	g_variant_builder_add(results_vb, "(sss@assu)", result->status,
 			      result->answer_type, result->hostname_returned,
-			      ip_addresses_array, result->dns_server_ip,
-			      atoi(result->response_time));
+			      g_variant_builder_end(&ip_addresses_vb),
+			      result->dns_server_ip, response_time);
+
+on_error:
+
+	return;
 }
 
 GVariant *prv_results_list_build(const gchar *nslookup_result)
 {
-	GList *result_list;
-	GList *next;
-	prv_nslookup_result_t *result;
+	prv_nslookup_result_t result;
 	GVariantBuilder results_vb;
 
-	result_list = prv_nslookup_result_decode(nslookup_result);
+	DLEYNA_LOG_DEBUG("Enter");
 
-	g_variant_builder_init(&results_vb, G_VARIANT_TYPE("a(sssassu)"));
+	DLEYNA_LOG_DEBUG_NL();
+	DLEYNA_LOG_DEBUG("NSLookupResult XML: %s", nslookup_result);
+	DLEYNA_LOG_DEBUG_NL();
 
-	next = result_list;
-	while (next != NULL) {
-		result = (prv_nslookup_result_t *)next->data;
+	g_variant_builder_init(&results_vb, G_VARIANT_TYPE("a(sssassu)"));
 
-		prv_results_list_add_result(result, &results_vb);
+	if (!xml_util_parse_records(nslookup_result, "NSLookupResult",
+				    "Result", g_nslookup_fields,
+				    G_N_ELEMENTS(g_nslookup_fields),
+				    &result, prv_nslookup_add_result,
+				    &results_vb)) {
+		DLEYNA_LOG_WARNING("XML: invalid document");
 
-		next = g_list_next(next);
+		g_variant_builder_clear(&results_vb);
+		g_variant_builder_init(&results_vb,
+				       G_VARIANT_TYPE("a(sssassu)"));
 	}
 
-	g_list_free_full(result_list, (GDestroyNotify)prv_free_nslookup_result);
+	DLEYNA_LOG_DEBUG("Exit");
 
 	return g_variant_builder_end(&results_vb);
 }
 
-static void prv_get_nslookup_result_cb(GUPnPServiceProxy *proxy,
-				       GUPnPServiceProxyAction *action,
-				       gpointer user_data)
+static GVariant *prv_nslookup_result_end(GUPnPServiceProxy *proxy,
+					 GUPnPServiceProxyAction *action,
+					 GError **error)
 {
-	GError *error = NULL;
-	dld_async_task_t *cb_data = user_data;
+	GError *upnp_error = NULL;
 	const gchar *message;
 	gchar *status = NULL;
 	gchar *info = NULL;
@@ -1532,12 +2676,11 @@ static void prv_get_nslookup_result_cb(GUPnPServiceProxy *proxy,
 	gchar *nslookup_result = NULL;
 	gboolean end;
 	GVariant *out_params[4];
-
-	DLEYNA_LOG_DEBUG("Enter");
+	GVariant *result = NULL;
 
 	end = gupnp_service_proxy_end_action(
-			  cb_data->proxy, cb_data->action,
-			  &error,
+			  proxy, action,
+			  &upnp_error,
 			  "Status", G_TYPE_STRING, &status,
 			  "AdditionalInfo", G_TYPE_STRING, &info,
 			  "SuccessCount", G_TYPE_UINT, &success,
@@ -1545,15 +2688,16 @@ static void prv_get_nslookup_result_cb(GUPnPServiceProxy *proxy,
 			  NULL);
 	if (!end || (status == NULL) || (info == NULL) ||
 	    (success == G_MAXUINT32) || (nslookup_result == NULL)) {
-		message = (error != NULL) ? error->message : "Invalid result";
+		message = (upnp_error != NULL) ? upnp_error->message :
+						 "Invalid result";
 		DLEYNA_LOG_WARNING("NSLookup operation failed: %s",
 				   message);
 
-		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
-					     DLEYNA_ERROR_OPERATION_FAILED,
-					     "NSLookup operation "
-					     "failed: %s",
-					     message);
+		*error = g_error_new(DLEYNA_SERVER_ERROR,
+				     DLEYNA_ERROR_OPERATION_FAILED,
+				     "NSLookup operation "
+				     "failed: %s",
+				     message);
 
 		goto on_error;
 	}
@@ -1567,22 +2711,18 @@ static void prv_get_nslookup_result_cb(GUPnPServiceProxy *proxy,
 	out_params[2] = g_variant_new_uint32(success);
 	out_params[3] = prv_results_list_build(nslookup_result);
 
-	cb_data->task.result = g_variant_ref_sink(
-					g_variant_new_tuple(out_params, 4));
+	result = g_variant_ref_sink(g_variant_new_tuple(out_params, 4));
 
 on_error:
 
-	(void) g_idle_add(dld_async_task_complete, cb_data);
-	g_cancellable_disconnect(cb_data->cancellable, cb_data->cancel_id);
-
 	g_free(status);
 	g_free(info);
 	g_free(nslookup_result);
 
-	if (error != NULL)
-		g_error_free(error);
+	if (upnp_error != NULL)
+		g_error_free(upnp_error);
 
-	DLEYNA_LOG_DEBUG("Exit");
+	return result;
 }
 
 void dld_device_get_nslookup_result(dld_device_t *device, dld_task_t *task,
@@ -1590,9 +2730,14 @@ void dld_device_get_nslookup_result(dld_device_t *device, dld_task_t *task,
 {
 	DLEYNA_LOG_DEBUG("Enter");
 
-	prv_generic_test_action(device, task, cb,
-				"GetNSLookupResult",
-				prv_get_nslookup_result_cb);
+	if (device->local)
+		dld_local_get_test_result(device->local, task, cb);
+	else if (!prv_test_result_from_cache(device, task, cb,
+					     "GetNSLookupResult"))
+		prv_shared_test_action(device, task, cb,
+				       "GetNSLookupResult",
+				       prv_nslookup_result_end,
+				       prv_test_result_cache_store);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -1620,6 +2765,11 @@ void dld_device_traceroute(dld_device_t *device, dld_task_t *task,
 	guint max_hop_count = traceroute->max_hop_count;
 	guint dscp = traceroute->dscp;
 
+	if (device->local) {
+		dld_local_start_test(device->local, task, cb);
+		return;
+	}
+
 	context = dld_device_get_context(device);
 	cb_data->cb = cb;
 	cb_data->device = device;
@@ -1633,6 +2783,7 @@ void dld_device_traceroute(dld_device_t *device, dld_task_t *task,
 	g_object_add_weak_pointer((G_OBJECT(context->bms.proxy)),
 				  (gpointer *)&cb_data->proxy);
 
+	cb_data->action_time = g_get_monotonic_time();
 	cb_data->action = gupnp_service_proxy_begin_action(
 				cb_data->proxy, "Traceroute",
 				prv_traceroute_cb, cb_data,
@@ -1644,12 +2795,11 @@ void dld_device_traceroute(dld_device_t *device, dld_task_t *task,
 				NULL);
 }
 
-static void prv_get_traceroute_result_cb(GUPnPServiceProxy *proxy,
-					 GUPnPServiceProxyAction *action,
-					 gpointer user_data)
+static GVariant *prv_traceroute_result_end(GUPnPServiceProxy *proxy,
+					   GUPnPServiceProxyAction *action,
+					   GError **error)
 {
-	GError *error = NULL;
-	dld_async_task_t *cb_data = user_data;
+	GError *upnp_error = NULL;
 	const gchar *message;
 	gchar *status = NULL;
 	gchar *info = NULL;
@@ -1657,15 +2807,12 @@ static void prv_get_traceroute_result_cb(GUPnPServiceProxy *proxy,
 	gchar *hop_hosts = NULL;
 	gboolean end;
 	GVariantBuilder vb;
-	gchar **parts;
-	unsigned int i = 0;
 	GVariant *out_params[4];
-
-	DLEYNA_LOG_DEBUG("Enter");
+	GVariant *result = NULL;
 
 	end = gupnp_service_proxy_end_action(
-					cb_data->proxy, cb_data->action,
-					&error,
+					proxy, action,
+					&upnp_error,
 					"Status", G_TYPE_STRING, &status,
 					"AdditionalInfo", G_TYPE_STRING, &info,
 					"ResponseTime", G_TYPE_UINT, &rsp_time,
@@ -1673,15 +2820,16 @@ static void prv_get_traceroute_result_cb(GUPnPServiceProxy *proxy,
 					NULL);
 	if (!end || (status == NULL) || (info == NULL) ||
 	    (rsp_time == G_MAXUINT32) || (hop_hosts == NULL)) {
-		message = (error != NULL) ? error->message : "Invalid result";
+		message = (upnp_error != NULL) ? upnp_error->message :
+						 "Invalid result";
 		DLEYNA_LOG_WARNING("Traceroute operation failed: %s",
 				   message);
 
-		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
-					     DLEYNA_ERROR_OPERATION_FAILED,
-					     "Traceroute operation "
-					     "failed: %s",
-					     message);
+		*error = g_error_new(DLEYNA_SERVER_ERROR,
+				     DLEYNA_ERROR_OPERATION_FAILED,
+				     "Traceroute operation "
+				     "failed: %s",
+				     message);
 
 		goto on_error;
 	}
@@ -1693,37 +2841,25 @@ static void prv_get_traceroute_result_cb(GUPnPServiceProxy *proxy,
 
 	g_variant_builder_init(&vb, G_VARIANT_TYPE("as"));
 
-	parts = g_strsplit(hop_hosts, ",", 0);
-	while (parts[i]) {
-		g_strstrip(parts[i]);
-
-		g_variant_builder_add(&vb, "s", parts[i]);
-		++i;
-	}
+	prv_csv_add_strings(hop_hosts, &vb);
 
 	out_params[0] = g_variant_new_string(status);
 	out_params[1] = g_variant_new_string(info);
 	out_params[2] = g_variant_new_uint32(rsp_time);
 	out_params[3] = g_variant_builder_end(&vb);
 
-	cb_data->task.result = g_variant_ref_sink(
-					g_variant_new_tuple(out_params, 4));
-
-	g_strfreev(parts);
+	result = g_variant_ref_sink(g_variant_new_tuple(out_params, 4));
 
 on_error:
 
-	(void) g_idle_add(dld_async_task_complete, cb_data);
-	g_cancellable_disconnect(cb_data->cancellable, cb_data->cancel_id);
-
 	g_free(status);
 	g_free(info);
 	g_free(hop_hosts);
 
-	if (error != NULL)
-		g_error_free(error);
+	if (upnp_error != NULL)
+		g_error_free(upnp_error);
 
-	DLEYNA_LOG_DEBUG("Exit");
+	return result;
 }
 
 void dld_device_get_traceroute_result(dld_device_t *device, dld_task_t *task,
@@ -1731,9 +2867,379 @@ void dld_device_get_traceroute_result(dld_device_t *device, dld_task_t *task,
 {
 	DLEYNA_LOG_DEBUG("Enter");
 
-	prv_generic_test_action(device, task, cb,
-				"GetTracerouteResult",
-				prv_get_traceroute_result_cb);
+	if (device->local)
+		dld_local_get_test_result(device->local, task, cb);
+	else if (!prv_test_result_from_cache(device, task, cb,
+					     "GetTracerouteResult"))
+		prv_shared_test_action(device, task, cb,
+				       "GetTracerouteResult",
+				       prv_traceroute_result_end,
+				       prv_test_result_cache_store);
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
+typedef struct prv_test_result_def_t_ prv_test_result_def_t;
+struct prv_test_result_def_t_ {
+	const gchar *type;
+	const gchar *action;
+	prv_test_result_end_t end;
+};
+
+static const prv_test_result_def_t g_test_result_defs[] = {
+	{ "Ping", "GetPingResult", prv_ping_result_end },
+	{ "NSLookup", "GetNSLookupResult", prv_nslookup_result_end },
+	{ "Traceroute", "GetTracerouteResult", prv_traceroute_result_end }
+};
+
+/* Tracks a test until its result is published.  Tests started by the
+ * daemon are also polled, in case the device does not report them
+ * leaving ActiveTestIDs.  Its actions count against the per device
+ * limit of the scheduler, like those of the clients.
+ */
+typedef struct prv_test_watch_t_ prv_test_watch_t;
+struct prv_test_watch_t_ {
+	dld_device_t *device;
+	GUPnPServiceProxy *proxy;
+	dld_scheduler_slot_t *slot;
+	GUPnPServiceProxyAction *action;
+	gint64 action_time;
+	guint test_id;
+	const prv_test_result_def_t *def;
+	guint poll_interval;
+	guint poll_id;
+	guint failures;
+	gboolean event_pending;
+};
+
+static const prv_test_result_def_t *prv_test_result_def_lookup(
+							const gchar *type)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(g_test_result_defs); ++i)
+		if (!strcmp(g_test_result_defs[i].type, type))
+			return &g_test_result_defs[i];
+
+	return NULL;
+}
+
+static void prv_test_watch_free(prv_test_watch_t *watch)
+{
+	if (watch->poll_id)
+		(void) g_source_remove(watch->poll_id);
+	g_object_unref(watch->proxy);
+	g_free(watch);
+}
+
+static dld_scheduler_t *prv_test_watch_scheduler(void)
+{
+	return dld_upnp_get_scheduler(dld_diagnostics_service_get_upnp());
+}
+
+static void prv_test_watch_release(prv_test_watch_t *watch)
+{
+	dld_scheduler_release(prv_test_watch_scheduler(), watch->slot);
+	watch->slot = NULL;
+}
+
+static void prv_test_watch_cancel(gpointer data)
+{
+	prv_test_watch_t *watch = data;
+
+	if (watch->action)
+		gupnp_service_proxy_cancel_action(watch->proxy, watch->action);
+	if (watch->slot)
+		prv_test_watch_release(watch);
+
+	prv_test_watch_free(watch);
+}
+
+static void prv_test_watch_done(prv_test_watch_t *watch)
+{
+	dld_device_t *device = watch->device;
+
+	device->test_watches = g_list_remove(device->test_watches, watch);
+	prv_test_watch_free(watch);
+}
+
+static prv_test_watch_t *prv_test_watch_find(dld_device_t *device,
+					     guint test_id)
+{
+	GList *next;
+	prv_test_watch_t *watch;
+
+	for (next = device->test_watches; next; next = next->next) {
+		watch = next->data;
+		if (watch->test_id == test_id)
+			return watch;
+	}
+
+	return NULL;
+}
+
+static void prv_test_watch_reschedule(prv_test_watch_t *watch);
+
+static void prv_test_watch_query(prv_test_watch_t *watch);
+
+static void prv_emit_signal_test_completed(dld_device_t *device,
+					   guint test_id,
+					   const gchar *type,
+					   GVariant *result)
+{
+	DLEYNA_LOG_DEBUG("Emitted Signal: %s.%s - ObjectPath: %s - Test: %u",
+			 DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE,
+			 DLD_INTERFACE_TEST_COMPLETED,
+			 device->path, test_id);
+
+	(void) dld_diagnostics_get_connector()->notify(
+					device->connection,
+					device->path,
+					DLEYNA_DIAGNOSTICS_INTERFACE_DEVICE,
+					DLD_INTERFACE_TEST_COMPLETED,
+					g_variant_new("(usv)", test_id, type,
+						      result),
+					NULL);
+}
+
+void dld_device_test_completed(dld_device_t *device, guint test_id,
+			       const gchar *type, GVariant *result)
+{
+	prv_emit_signal_test_completed(device, test_id, type, result);
+}
+
+static void prv_test_watch_result_cb(GUPnPServiceProxy *proxy,
+				     GUPnPServiceProxyAction *action,
+				     gpointer user_data)
+{
+	prv_test_watch_t *watch = user_data;
+	GError *error = NULL;
+	GVariant *result;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	watch->action = NULL;
+	prv_test_watch_release(watch);
+	dld_metrics_action_completed(watch->device->path, watch->def->action,
+				     watch->action_time);
+
+	result = watch->def->end(proxy, action, &error);
+
+	if (result) {
+		prv_test_result_cache_store(watch->device, watch->test_id,
+					    watch->def->action, result);
+		prv_emit_signal_test_completed(watch->device, watch->test_id,
+					       watch->def->type, result);
+		g_variant_unref(result);
+	} else {
+		g_error_free(error);
+	}
+
+	prv_test_watch_done(watch);
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
+static void prv_test_watch_fetch_start(gpointer user_data)
+{
+	prv_test_watch_t *watch = user_data;
+
+	watch->action_time = g_get_monotonic_time();
+	watch->action = gupnp_service_proxy_begin_action(
+					watch->proxy, watch->def->action,
+					prv_test_watch_result_cb, watch,
+					"TestID", G_TYPE_UINT, watch->test_id,
+					NULL);
+}
+
+static void prv_test_watch_info_cb(GUPnPServiceProxy *proxy,
+				   GUPnPServiceProxyAction *action,
+				   gpointer user_data)
+{
+	prv_test_watch_t *watch = user_data;
+	GError *error = NULL;
+	GVariant *info;
+	const gchar *type;
+	const gchar *state;
+	gboolean event_pending;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	watch->action = NULL;
+	prv_test_watch_release(watch);
+	dld_metrics_action_completed(watch->device->path, "GetTestInfo",
+				     watch->action_time);
+
+	/* An event that arrived during the query may predate its answer */
+	event_pending = watch->event_pending;
+	watch->event_pending = FALSE;
+
+	info = prv_test_info_end(proxy, action, &error);
+
+	if (!info) {
+		DLEYNA_LOG_WARNING("Test %u: GetTestInfo failed: %s",
+				   watch->test_id, error->message);
+		g_error_free(error);
+
+		if (!watch->poll_interval ||
+		    ++watch->failures >= DLD_DEVICE_TEST_POLL_MAX_FAILURES)
+			goto on_done;
+
+		prv_test_watch_reschedule(watch);
+
+		DLEYNA_LOG_DEBUG("Exit");
+
+		return;
+	}
+
+	watch->failures = 0;
+
+	g_variant_get(info, "(&s&s)", &type, &state);
+	watch->def = prv_test_result_def_lookup(type);
+
+	if (watch->def && watch->poll_interval &&
+	    (!strcmp(state, "Requested") || !strcmp(state, "InProgress"))) {
+		g_variant_unref(info);
+
+		if (event_pending)
+			prv_test_watch_query(watch);
+		else
+			prv_test_watch_reschedule(watch);
+
+		DLEYNA_LOG_DEBUG("Exit");
+
+		return;
+	}
+
+	if (!watch->def || strcmp(state, "Completed")) {
+		DLEYNA_LOG_DEBUG("Test %u: type %s, state %s. Not notified",
+				 watch->test_id, type, state);
+		g_variant_unref(info);
+		goto on_done;
+	}
+
+	g_variant_unref(info);
+
+	prv_test_mark_completed(watch->device, watch->test_id);
+
+	watch->slot = dld_scheduler_acquire(prv_test_watch_scheduler(),
+					    watch->device->path,
+					    prv_test_watch_fetch_start, watch);
+
+	DLEYNA_LOG_DEBUG("Exit");
+
+	return;
+
+on_done:
+
+	prv_test_watch_done(watch);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
+
+static void prv_test_watch_query_start(gpointer user_data)
+{
+	prv_test_watch_t *watch = user_data;
+
+	watch->action_time = g_get_monotonic_time();
+	watch->action = gupnp_service_proxy_begin_action(
+					watch->proxy, "GetTestInfo",
+					prv_test_watch_info_cb, watch,
+					"TestID", G_TYPE_UINT, watch->test_id,
+					NULL);
+}
+
+static void prv_test_watch_query(prv_test_watch_t *watch)
+{
+	watch->slot = dld_scheduler_acquire(prv_test_watch_scheduler(),
+					    watch->device->path,
+					    prv_test_watch_query_start, watch);
+}
+
+static gboolean prv_test_watch_poll(gpointer user_data)
+{
+	prv_test_watch_t *watch = user_data;
+	dld_device_t *device = watch->device;
+	dld_device_context_t *context = NULL;
+
+	watch->poll_id = 0;
+
+	if (device->contexts->len)
+		context = dld_device_get_context(device);
+
+	/* Still listed as active: the event will tell when the test ends */
+	if (context && context->bms.subscribed &&
+	    prv_test_id_set_contains(device->active_test_id_set,
+				     watch->test_id)) {
+		prv_test_watch_reschedule(watch);
+	} else {
+		DLEYNA_LOG_DEBUG("Polling test %u on %s", watch->test_id,
+				 device->path);
+		prv_test_watch_query(watch);
+	}
+
+	return FALSE;
+}
+
+static void prv_test_watch_reschedule(prv_test_watch_t *watch)
+{
+	watch->poll_id = g_timeout_add(watch->poll_interval,
+				       prv_test_watch_poll, watch);
+	watch->poll_interval = MIN(watch->poll_interval * 2,
+				   DLD_DEVICE_TEST_POLL_MAX_INTERVAL);
+}
+
+static prv_test_watch_t *prv_test_watch_new(dld_device_t *device,
+					    GUPnPServiceProxy *proxy,
+					    guint test_id)
+{
+	prv_test_watch_t *watch;
+
+	watch = g_new0(prv_test_watch_t, 1);
+	watch->device = device;
+	watch->proxy = g_object_ref(proxy);
+	watch->test_id = test_id;
+
+	device->test_watches = g_list_prepend(device->test_watches, watch);
+
+	return watch;
+}
+
+static void prv_test_watch_start(dld_device_t *device,
+				 GUPnPServiceProxy *proxy,
+				 guint test_id)
+{
+	prv_test_watch_t *watch;
+
+	DLEYNA_LOG_DEBUG("Test %u is no longer active on %s", test_id,
+			 device->path);
+
+	watch = prv_test_watch_find(device, test_id);
+	if (watch) {
+		/* Waiting for the next poll, or already being queried */
+		if (watch->poll_id) {
+			(void) g_source_remove(watch->poll_id);
+			watch->poll_id = 0;
+			prv_test_watch_query(watch);
+		} else if (watch->action) {
+			watch->event_pending = TRUE;
+		}
+	} else {
+		watch = prv_test_watch_new(device, proxy, test_id);
+		prv_test_watch_query(watch);
+	}
+}
+
+static void prv_test_watch_poll_start(dld_device_t *device,
+				      GUPnPServiceProxy *proxy,
+				      guint test_id)
+{
+	prv_test_watch_t *watch;
+
+	if (!DLD_TEST_POLL_INTERVAL || prv_test_watch_find(device, test_id))
+		return;
+
+	watch = prv_test_watch_new(device, proxy, test_id);
+	watch->poll_interval = DLD_TEST_POLL_INTERVAL;
+	prv_test_watch_reschedule(watch);
+}
@@ -49,6 +49,8 @@ struct dld_device_context_t_ {
 	dld_device_t *device;
 };
 
+typedef struct dld_device_icon_validation_t_ dld_device_icon_validation_t;
+
 typedef struct dld_device_icon_t_ dld_device_icon_t;
 struct dld_device_icon_t_ {
 	gchar *mime_type;
@@ -59,12 +61,24 @@ struct dld_device_icon_t_ {
 struct dld_device_t_ {
 	dleyna_connector_id_t connection;
 	guint ids[DLD_INTERFACE_INFO_MAX];
-	gchar *path;
+	const gchar *path;
 	GPtrArray *contexts;
 	GHashTable *props;
+	GVariant *props_snapshot;
+	GHashTable *changed_props;
+	guint changed_props_id;
 	guint timeout_id;
 	guint construct_step;
-	dld_device_icon_t icon;
+	GHashTable *icons;
+	dld_device_icon_validation_t *icon_validation;
+	GList *test_watches;
+	GHashTable *completed_tests;
+	GQueue completed_order;
+	GHashTable *test_results;
+	GHashTable *shared_actions;
+	GArray *test_id_set;
+	GArray *active_test_id_set;
+	dld_local_t *local;
 };
 
 void dld_device_construct(
@@ -83,6 +97,22 @@ dld_device_t *dld_device_new(
 			const dleyna_connector_dispatch_cb_t *dispatch_table,
 			const dleyna_task_queue_key_t *queue_id);
 
+dld_device_t *dld_device_new_from_cache(
+			dleyna_connector_id_t connection,
+			GKeyFile *cache,
+			const gchar *udn,
+			guint counter,
+			const dleyna_connector_dispatch_cb_t *dispatch_table);
+
+dld_device_t *dld_device_new_local(
+			dleyna_connector_id_t connection,
+			guint counter,
+			const dleyna_connector_dispatch_cb_t *dispatch_table);
+
+void dld_device_cache_save(dld_device_t *device, GKeyFile *cache);
+
+void dld_device_refresh_props(dld_device_t *device);
+
 void dld_device_delete(void *device);
 
 void dld_device_unsubscribe(void *device);
@@ -92,12 +122,18 @@ void dld_device_append_new_context(dld_device_t *device,
 				   GUPnPDeviceProxy *proxy,
 				   GUPnPServiceProxy *bms_proxy);
 
-dld_device_t *dld_device_from_path(const gchar *path, GHashTable *device_list);
+dld_device_t *dld_device_from_path(const gchar *path, GHashTable *device_map);
 
 dld_device_context_t *dld_device_get_context(dld_device_t *device);
 
 void dld_device_subscribe_to_service_changes(dld_device_t *device);
 
+void dld_device_tests_changed(dld_device_t *device, GVariant *test_ids,
+			      GVariant *active_test_ids);
+
+void dld_device_test_completed(dld_device_t *device, guint test_id,
+			       const gchar *type, GVariant *result);
+
 
 void dld_device_set_prop(dld_device_t *device, dld_task_t *task,
 			 dld_upnp_task_complete_t cb);
@@ -111,6 +147,8 @@ void dld_device_get_all_props(dld_device_t *device, dld_task_t *task,
 void dld_device_get_icon(dld_device_t *device, dld_task_t *task,
 			 dld_upnp_task_complete_t cb);
 
+void dld_device_icon_session_delete(void);
+
 void dld_device_get_test_info(dld_device_t *device, dld_task_t *task,
 			      dld_upnp_task_complete_t cb);
 
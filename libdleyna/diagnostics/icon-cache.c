@@ -0,0 +1,326 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+
+#include <libdleyna/core/log.h>
+
+#include "icon-cache.h"
+
+#define DLD_ICON_CACHE_DIR "dleyna-diagnostics"
+#define DLD_ICON_CACHE_SUBDIR "icons"
+#define DLD_ICON_CACHE_INDEX "index"
+#define DLD_ICON_CACHE_SAVE_DELAY 10
+
+#define DLD_ICON_CACHE_KEY_UDN "UDN"
+#define DLD_ICON_CACHE_KEY_URL "URL"
+#define DLD_ICON_CACHE_KEY_MIME_TYPE "MimeType"
+#define DLD_ICON_CACHE_KEY_ETAG "ETag"
+#define DLD_ICON_CACHE_KEY_LAST_MODIFIED "LastModified"
+#define DLD_ICON_CACHE_KEY_SIZE "Size"
+#define DLD_ICON_CACHE_KEY_LAST_USED "LastUsed"
+
+/* One group per icon in the index, named after the icon file */
+typedef struct prv_icon_cache_t_ prv_icon_cache_t;
+struct prv_icon_cache_t_ {
+	gchar *dir;
+	gchar *index_path;
+	GKeyFile *index;
+	guint64 size;
+	guint save_id;
+};
+
+static prv_icon_cache_t *g_icon_cache;
+
+static prv_icon_cache_t *prv_icon_cache_get(void)
+{
+	prv_icon_cache_t *cache = g_icon_cache;
+	gchar **groups;
+	unsigned int i;
+
+	if (cache)
+		goto on_exit;
+
+	cache = g_new0(prv_icon_cache_t, 1);
+
+	cache->dir = g_build_filename(g_get_user_cache_dir(),
+				      DLD_ICON_CACHE_DIR,
+				      DLD_ICON_CACHE_SUBDIR,
+				      NULL);
+	(void) g_mkdir_with_parents(cache->dir, 0700);
+
+	cache->index_path = g_build_filename(cache->dir, DLD_ICON_CACHE_INDEX,
+					     NULL);
+	cache->index = g_key_file_new();
+	(void) g_key_file_load_from_file(cache->index, cache->index_path,
+					 G_KEY_FILE_NONE, NULL);
+
+	groups = g_key_file_get_groups(cache->index, NULL);
+	for (i = 0; groups[i]; ++i)
+		cache->size += g_key_file_get_uint64(cache->index, groups[i],
+						     DLD_ICON_CACHE_KEY_SIZE,
+						     NULL);
+	g_strfreev(groups);
+
+	DLEYNA_LOG_DEBUG("Icon cache: %u icons, %" G_GUINT64_FORMAT " bytes",
+			 i, cache->size);
+
+	g_icon_cache = cache;
+
+on_exit:
+
+	return cache;
+}
+
+static gchar *prv_icon_cache_key(const gchar *udn, const gchar *url)
+{
+	gchar *str;
+	gchar *key;
+
+	str = g_strconcat(udn, "\n", url, NULL);
+	key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, str, -1);
+	g_free(str);
+
+	return key;
+}
+
+static void prv_icon_cache_save_index(prv_icon_cache_t *cache)
+{
+	gchar *data;
+	gsize length;
+	GError *error = NULL;
+
+	data = g_key_file_to_data(cache->index, &length, NULL);
+
+	if (!g_file_set_contents(cache->index_path, data, length, &error)) {
+		DLEYNA_LOG_WARNING("Unable to save icon cache index: %s",
+				   error->message);
+		g_error_free(error);
+	}
+
+	g_free(data);
+}
+
+static gboolean prv_icon_cache_save_cb(gpointer user_data)
+{
+	prv_icon_cache_t *cache = user_data;
+
+	cache->save_id = 0;
+	prv_icon_cache_save_index(cache);
+
+	return FALSE;
+}
+
+/* Cache hits only refresh LastUsed, which is written back in batches */
+static void prv_icon_cache_schedule_save(prv_icon_cache_t *cache)
+{
+	if (!cache->save_id)
+		cache->save_id = g_timeout_add_seconds(
+						DLD_ICON_CACHE_SAVE_DELAY,
+						prv_icon_cache_save_cb, cache);
+}
+
+static void prv_icon_cache_remove(prv_icon_cache_t *cache, const gchar *key)
+{
+	gchar *path;
+
+	cache->size -= g_key_file_get_uint64(cache->index, key,
+					     DLD_ICON_CACHE_KEY_SIZE, NULL);
+	(void) g_key_file_remove_group(cache->index, key, NULL);
+
+	path = g_build_filename(cache->dir, key, NULL);
+	(void) g_unlink(path);
+	g_free(path);
+}
+
+static void prv_icon_cache_evict(prv_icon_cache_t *cache)
+{
+	gchar **groups;
+	gchar *oldest;
+	gint64 oldest_used;
+	gint64 used;
+	unsigned int i;
+
+	while (cache->size > DLD_ICON_CACHE_SIZE) {
+		groups = g_key_file_get_groups(cache->index, NULL);
+		oldest = NULL;
+		oldest_used = G_MAXINT64;
+
+		for (i = 0; groups[i]; ++i) {
+			used = g_key_file_get_int64(cache->index, groups[i],
+						    DLD_ICON_CACHE_KEY_LAST_USED,
+						    NULL);
+			if (used < oldest_used) {
+				oldest_used = used;
+				oldest = groups[i];
+			}
+		}
+
+		if (oldest) {
+			DLEYNA_LOG_DEBUG("Evicting icon %s", oldest);
+			prv_icon_cache_remove(cache, oldest);
+		}
+
+		g_strfreev(groups);
+
+		if (!oldest)
+			break;
+	}
+}
+
+void dld_icon_cache_entry_clear(dld_icon_cache_entry_t *entry)
+{
+	g_free(entry->mime_type);
+	g_free(entry->bytes);
+	g_free(entry->etag);
+	g_free(entry->last_modified);
+
+	memset(entry, 0, sizeof(*entry));
+}
+
+gboolean dld_icon_cache_lookup(const gchar *udn, const gchar *url,
+			       dld_icon_cache_entry_t *entry)
+{
+	prv_icon_cache_t *cache = prv_icon_cache_get();
+	gchar *key;
+	gchar *path = NULL;
+	gchar *bytes;
+	gsize size;
+	gboolean found = FALSE;
+
+	key = prv_icon_cache_key(udn, url);
+
+	if (!g_key_file_has_group(cache->index, key))
+		goto on_exit;
+
+	path = g_build_filename(cache->dir, key, NULL);
+
+	if (!g_file_get_contents(path, &bytes, &size, NULL) ||
+	    size != g_key_file_get_uint64(cache->index, key,
+					  DLD_ICON_CACHE_KEY_SIZE, NULL)) {
+		DLEYNA_LOG_WARNING("Icon cache entry %s is damaged", key);
+
+		prv_icon_cache_remove(cache, key);
+		prv_icon_cache_save_index(cache);
+
+		goto on_exit;
+	}
+
+	entry->bytes = (guchar *)bytes;
+	entry->size = size;
+	entry->mime_type = g_key_file_get_string(cache->index, key,
+						 DLD_ICON_CACHE_KEY_MIME_TYPE,
+						 NULL);
+	entry->etag = g_key_file_get_string(cache->index, key,
+					    DLD_ICON_CACHE_KEY_ETAG, NULL);
+	entry->last_modified = g_key_file_get_string(
+					cache->index, key,
+					DLD_ICON_CACHE_KEY_LAST_MODIFIED,
+					NULL);
+
+	g_key_file_set_int64(cache->index, key, DLD_ICON_CACHE_KEY_LAST_USED,
+			     g_get_real_time());
+	prv_icon_cache_schedule_save(cache);
+
+	found = TRUE;
+
+on_exit:
+
+	g_free(path);
+	g_free(key);
+
+	return found;
+}
+
+void dld_icon_cache_store(const gchar *udn, const gchar *url,
+			  const dld_icon_cache_entry_t *entry)
+{
+	prv_icon_cache_t *cache = prv_icon_cache_get();
+	gchar *key;
+	gchar *path;
+	GError *error = NULL;
+
+	if (entry->size > DLD_ICON_CACHE_SIZE)
+		return;
+
+	key = prv_icon_cache_key(udn, url);
+	path = g_build_filename(cache->dir, key, NULL);
+
+	if (g_key_file_has_group(cache->index, key))
+		prv_icon_cache_remove(cache, key);
+
+	if (!g_file_set_contents(path, (const gchar *)entry->bytes,
+				 entry->size, &error)) {
+		DLEYNA_LOG_WARNING("Unable to cache icon: %s", error->message);
+		g_error_free(error);
+
+		goto on_exit;
+	}
+
+	g_key_file_set_string(cache->index, key, DLD_ICON_CACHE_KEY_UDN, udn);
+	g_key_file_set_string(cache->index, key, DLD_ICON_CACHE_KEY_URL, url);
+	if (entry->mime_type)
+		g_key_file_set_string(cache->index, key,
+				      DLD_ICON_CACHE_KEY_MIME_TYPE,
+				      entry->mime_type);
+	if (entry->etag)
+		g_key_file_set_string(cache->index, key,
+				      DLD_ICON_CACHE_KEY_ETAG, entry->etag);
+	if (entry->last_modified)
+		g_key_file_set_string(cache->index, key,
+				      DLD_ICON_CACHE_KEY_LAST_MODIFIED,
+				      entry->last_modified);
+	g_key_file_set_uint64(cache->index, key, DLD_ICON_CACHE_KEY_SIZE,
+			      entry->size);
+	g_key_file_set_int64(cache->index, key, DLD_ICON_CACHE_KEY_LAST_USED,
+			     g_get_real_time());
+
+	cache->size += entry->size;
+	prv_icon_cache_evict(cache);
+	prv_icon_cache_save_index(cache);
+
+on_exit:
+
+	g_free(path);
+	g_free(key);
+}
+
+void dld_icon_cache_delete(void)
+{
+	prv_icon_cache_t *cache = g_icon_cache;
+
+	if (cache) {
+		if (cache->save_id) {
+			(void) g_source_remove(cache->save_id);
+			prv_icon_cache_save_index(cache);
+		}
+
+		g_key_file_free(cache->index);
+		g_free(cache->index_path);
+		g_free(cache->dir);
+		g_free(cache);
+
+		g_icon_cache = NULL;
+	}
+}
@@ -0,0 +1,47 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#ifndef DLD_ICON_CACHE_H__
+#define DLD_ICON_CACHE_H__
+
+#include <glib.h>
+
+typedef struct dld_icon_cache_entry_t_ dld_icon_cache_entry_t;
+struct dld_icon_cache_entry_t_ {
+	gchar *mime_type;
+	guchar *bytes;
+	gsize size;
+	gchar *etag;
+	gchar *last_modified;
+};
+
+void dld_icon_cache_entry_clear(dld_icon_cache_entry_t *entry);
+
+gboolean dld_icon_cache_lookup(const gchar *udn, const gchar *url,
+			       dld_icon_cache_entry_t *entry);
+
+void dld_icon_cache_store(const gchar *udn, const gchar *url,
+			  const dld_icon_cache_entry_t *entry);
+
+void dld_icon_cache_delete(void);
+
+#endif /* DLD_ICON_CACHE_H__ */
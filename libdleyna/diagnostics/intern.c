@@ -0,0 +1,98 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include "intern.h"
+
+typedef struct prv_intern_entry_t_ prv_intern_entry_t;
+struct prv_intern_entry_t_ {
+	gchar *str;
+	guint count;
+};
+
+/* Device paths and UDNs, each stored once and compared by pointer. An
+ * entry is freed with its last reference, so the table only ever holds
+ * the strings of known devices.
+ */
+static GHashTable *g_intern_table;
+
+static void prv_intern_entry_free(gpointer data)
+{
+	prv_intern_entry_t *entry = data;
+
+	g_free(entry->str);
+	g_free(entry);
+}
+
+const gchar *dld_intern_ref(const gchar *str)
+{
+	prv_intern_entry_t *entry;
+
+	if (!g_intern_table)
+		g_intern_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						       NULL,
+						       prv_intern_entry_free);
+
+	entry = g_hash_table_lookup(g_intern_table, str);
+	if (!entry) {
+		entry = g_new0(prv_intern_entry_t, 1);
+		entry->str = g_strdup(str);
+		g_hash_table_insert(g_intern_table, entry->str, entry);
+	}
+
+	entry->count++;
+
+	return entry->str;
+}
+
+void dld_intern_unref(const gchar *str)
+{
+	prv_intern_entry_t *entry;
+
+	if (!str || !g_intern_table)
+		return;
+
+	entry = g_hash_table_lookup(g_intern_table, str);
+	if (!entry || --entry->count)
+		return;
+
+	(void) g_hash_table_remove(g_intern_table, str);
+
+	if (!g_hash_table_size(g_intern_table)) {
+		g_hash_table_unref(g_intern_table);
+		g_intern_table = NULL;
+	}
+}
+
+/* Never inserts: strings received from clients or from the network are
+ * only resolved to the copy held for a known device.
+ */
+const gchar *dld_intern_lookup(const gchar *str)
+{
+	prv_intern_entry_t *entry;
+
+	if (!str || !g_intern_table)
+		return NULL;
+
+	entry = g_hash_table_lookup(g_intern_table, str);
+
+	return entry ? entry->str : NULL;
+}
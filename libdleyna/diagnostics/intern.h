@@ -0,0 +1,34 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#ifndef DLD_INTERN_H__
+#define DLD_INTERN_H__
+
+#include <glib.h>
+
+const gchar *dld_intern_ref(const gchar *str);
+
+void dld_intern_unref(const gchar *str);
+
+const gchar *dld_intern_lookup(const gchar *str);
+
+#endif /* DLD_INTERN_H__ */
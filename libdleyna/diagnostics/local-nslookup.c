@@ -0,0 +1,639 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <libdleyna/core/log.h>
+
+#include "local.h"
+
+#define DLD_LOCAL_NSLOOKUP_DEFAULT_TIMEOUT 5000
+#define DLD_LOCAL_NSLOOKUP_MAX_PARALLEL 8
+#define DLD_LOCAL_NSLOOKUP_MAX_REPEAT 1024
+#define DLD_LOCAL_NSLOOKUP_PORT 53
+#define DLD_LOCAL_NSLOOKUP_RESOLV_CONF "/etc/resolv.conf"
+
+#define DLD_DNS_HEADER_SIZE 12
+#define DLD_DNS_MAX_PACKET 512
+#define DLD_DNS_MAX_NAME 255
+#define DLD_DNS_MAX_LABEL 63
+#define DLD_DNS_MAX_POINTERS 16
+#define DLD_DNS_FLAG_RESPONSE 0x8000
+#define DLD_DNS_FLAG_AUTHORITATIVE 0x0400
+#define DLD_DNS_FLAG_RECURSION 0x0100
+#define DLD_DNS_RCODE_MASK 0x000f
+#define DLD_DNS_RCODE_NAME_ERROR 3
+#define DLD_DNS_TYPE_A 1
+#define DLD_DNS_CLASS_IN 1
+
+typedef struct prv_nslookup_t_ prv_nslookup_t;
+
+typedef struct prv_query_t_ prv_query_t;
+struct prv_query_t_ {
+	prv_nslookup_t *nslookup;
+	gint64 sent_time;
+	guint timeout_id;
+	GVariant *result;
+};
+
+/* Up to DLD_LOCAL_NSLOOKUP_MAX_PARALLEL queries are in flight at once on
+ * a UDP socket connected to the DNS server.  Query i uses the DNS ID
+ * base_id + i.
+ */
+struct prv_nslookup_t_ {
+	dld_local_test_t *test;
+	GIOChannel *channel;
+	guint watch_id;
+	gchar *server_ip;
+	GByteArray *packet;
+	guint timeout;
+	guint16 base_id;
+	guint repeat_count;
+	prv_query_t *queries;
+	guint sent;
+	guint running;
+	guint done;
+};
+
+static guint16 prv_dns_get16(const guint8 *data)
+{
+	return (data[0] << 8) | data[1];
+}
+
+static void prv_dns_put16(guint8 *data, guint16 value)
+{
+	data[0] = value >> 8;
+	data[1] = value & 0xff;
+}
+
+static GByteArray *prv_dns_query_new(const gchar *hostname)
+{
+	GByteArray *packet;
+	guint8 header[DLD_DNS_HEADER_SIZE] = { 0 };
+	guint8 tail[5] = { 0 };
+	const gchar *label = hostname;
+	const gchar *end;
+	guint8 length;
+
+	packet = g_byte_array_sized_new(DLD_DNS_HEADER_SIZE +
+					strlen(hostname) + 6);
+
+	prv_dns_put16(header + 2, DLD_DNS_FLAG_RECURSION);
+	prv_dns_put16(header + 4, 1);
+	g_byte_array_append(packet, header, sizeof(header));
+
+	while (*label) {
+		end = strchr(label, '.');
+		if (!end)
+			end = label + strlen(label);
+
+		if (end == label || end - label > DLD_DNS_MAX_LABEL)
+			goto on_error;
+
+		length = end - label;
+		g_byte_array_append(packet, &length, 1);
+		g_byte_array_append(packet, (const guint8 *)label, length);
+
+		label = *end ? end + 1 : end;
+	}
+
+	if (packet->len == DLD_DNS_HEADER_SIZE ||
+	    packet->len - DLD_DNS_HEADER_SIZE >= DLD_DNS_MAX_NAME)
+		goto on_error;
+
+	prv_dns_put16(tail + 1, DLD_DNS_TYPE_A);
+	prv_dns_put16(tail + 3, DLD_DNS_CLASS_IN);
+	g_byte_array_append(packet, tail, sizeof(tail));
+
+	return packet;
+
+on_error:
+
+	g_byte_array_unref(packet);
+
+	return NULL;
+}
+
+/* Reads the name at *offset, following compression pointers, and moves
+ * *offset past it.  'name' may be NULL to only skip it.
+ */
+static gboolean prv_dns_name_read(const guint8 *packet, gsize length,
+				  gsize *offset, GString *name)
+{
+	gsize pos = *offset;
+	gboolean jumped = FALSE;
+	guint pointers = 0;
+	guint8 label;
+
+	if (name)
+		g_string_truncate(name, 0);
+
+	for (;;) {
+		if (pos >= length)
+			return FALSE;
+
+		label = packet[pos];
+
+		if ((label & 0xc0) == 0xc0) {
+			if (pos + 1 >= length ||
+			    ++pointers > DLD_DNS_MAX_POINTERS)
+				return FALSE;
+
+			if (!jumped)
+				*offset = pos + 2;
+			jumped = TRUE;
+
+			pos = ((label & 0x3f) << 8) | packet[pos + 1];
+			continue;
+		}
+
+		if (label & 0xc0)
+			return FALSE;
+
+		pos++;
+
+		if (!label)
+			break;
+
+		if (pos + label > length)
+			return FALSE;
+
+		if (name) {
+			if (name->len)
+				g_string_append_c(name, '.');
+			g_string_append_len(name, (const gchar *)packet + pos,
+					    label);
+		}
+
+		pos += label;
+	}
+
+	if (!jumped)
+		*offset = pos;
+
+	return TRUE;
+}
+
+static GVariant *prv_nslookup_result_new(prv_nslookup_t *nslookup,
+					 const gchar *status,
+					 const gchar *answer_type,
+					 const gchar *hostname,
+					 GVariantBuilder *ip_addresses,
+					 guint rsp_time)
+{
+	GVariant *addresses;
+
+	if (ip_addresses)
+		addresses = g_variant_builder_end(ip_addresses);
+	else
+		addresses = g_variant_new_array(G_VARIANT_TYPE_STRING, NULL,
+						0);
+
+	return g_variant_ref_sink(g_variant_new("(sss@assu)", status,
+						answer_type, hostname,
+						addresses,
+						nslookup->server_ip,
+						rsp_time));
+}
+
+static GVariant *prv_nslookup_parse(prv_nslookup_t *nslookup,
+				    const guint8 *packet, gsize length,
+				    guint rsp_time)
+{
+	GVariantBuilder ip_addresses;
+	GString *owner;
+	GString *hostname;
+	gchar address[INET_ADDRSTRLEN];
+	const gchar *status = "Error_Other";
+	const gchar *answer_type = "None";
+	GVariant *result;
+	guint16 flags;
+	guint16 count;
+	guint16 type;
+	guint16 class;
+	guint16 rdlength;
+	guint found = 0;
+	gsize offset = DLD_DNS_HEADER_SIZE;
+
+	g_variant_builder_init(&ip_addresses, G_VARIANT_TYPE("as"));
+	owner = g_string_new(NULL);
+	hostname = g_string_new(NULL);
+
+	flags = prv_dns_get16(packet + 2);
+
+	for (count = prv_dns_get16(packet + 4); count; --count)
+		if (!prv_dns_name_read(packet, length, &offset, NULL) ||
+		    (offset += 4) > length)
+			goto on_exit;
+
+	for (count = prv_dns_get16(packet + 6); count; --count) {
+		if (!prv_dns_name_read(packet, length, &offset, owner) ||
+		    offset + 10 > length)
+			goto on_exit;
+
+		type = prv_dns_get16(packet + offset);
+		class = prv_dns_get16(packet + offset + 2);
+		rdlength = prv_dns_get16(packet + offset + 8);
+		offset += 10;
+
+		if (offset + rdlength > length)
+			goto on_exit;
+
+		if (type == DLD_DNS_TYPE_A && class == DLD_DNS_CLASS_IN &&
+		    rdlength == 4 &&
+		    inet_ntop(AF_INET, packet + offset, address,
+			      sizeof(address))) {
+			if (!found++)
+				g_string_assign(hostname, owner->str);
+			g_variant_builder_add(&ip_addresses, "s", address);
+		}
+
+		offset += rdlength;
+	}
+
+	if (prv_dns_get16(packet + 6))
+		answer_type = (flags & DLD_DNS_FLAG_AUTHORITATIVE) ?
+				"Authoritative" : "NonAuthoritative";
+
+	if ((flags & DLD_DNS_RCODE_MASK) == 0 && found)
+		status = "Success";
+	else if ((flags & DLD_DNS_RCODE_MASK) == 0 ||
+		 (flags & DLD_DNS_RCODE_MASK) == DLD_DNS_RCODE_NAME_ERROR)
+		status = "Error_HostNameNotResolved";
+
+on_exit:
+
+	result = prv_nslookup_result_new(nslookup, status, answer_type,
+					 hostname->str, &ip_addresses,
+					 rsp_time);
+
+	g_string_free(owner, TRUE);
+	g_string_free(hostname, TRUE);
+
+	return result;
+}
+
+static void prv_nslookup_free(prv_nslookup_t *nslookup)
+{
+	guint i;
+
+	if (nslookup->watch_id)
+		(void) g_source_remove(nslookup->watch_id);
+
+	if (nslookup->channel)
+		g_io_channel_unref(nslookup->channel);
+
+	for (i = 0; i < nslookup->repeat_count; ++i) {
+		if (nslookup->queries[i].timeout_id)
+			(void) g_source_remove(nslookup->queries[i].timeout_id);
+		if (nslookup->queries[i].result)
+			g_variant_unref(nslookup->queries[i].result);
+	}
+
+	if (nslookup->packet)
+		g_byte_array_unref(nslookup->packet);
+
+	g_free(nslookup->queries);
+	g_free(nslookup->server_ip);
+	g_free(nslookup);
+}
+
+static void prv_nslookup_cancel(dld_local_test_t *test)
+{
+	prv_nslookup_free(test->engine);
+}
+
+static void prv_nslookup_finish(prv_nslookup_t *nslookup,
+				const gchar *status, const gchar *info)
+{
+	dld_local_test_t *test = nslookup->test;
+	GVariantBuilder results;
+	GVariant *result;
+	const gchar *result_status;
+	guint success = 0;
+	guint i;
+
+	DLEYNA_LOG_DEBUG("NSLookup test %u: %s %s", test->id, status, info);
+
+	g_variant_builder_init(&results, G_VARIANT_TYPE("a(sssassu)"));
+
+	for (i = 0; i < nslookup->repeat_count; ++i) {
+		result = nslookup->queries[i].result;
+		if (!result)
+			continue;
+
+		g_variant_get_child(result, 0, "&s", &result_status);
+		if (!strcmp(result_status, "Success"))
+			success++;
+
+		g_variant_builder_add_value(&results, result);
+	}
+
+	result = g_variant_new("(ssu@a(sssassu))", status, info, success,
+			       g_variant_builder_end(&results));
+
+	prv_nslookup_free(nslookup);
+	dld_local_test_complete(test, result);
+}
+
+static void prv_query_complete(prv_query_t *query, GVariant *result)
+{
+	prv_nslookup_t *nslookup = query->nslookup;
+
+	if (query->timeout_id) {
+		(void) g_source_remove(query->timeout_id);
+		query->timeout_id = 0;
+	}
+
+	query->result = result;
+
+	nslookup->running--;
+	nslookup->done++;
+}
+
+static gboolean prv_query_timeout_cb(gpointer user_data);
+
+/* Returns FALSE once every query has completed */
+static gboolean prv_nslookup_send(prv_nslookup_t *nslookup)
+{
+	prv_query_t *query;
+	int fd;
+
+	fd = g_io_channel_unix_get_fd(nslookup->channel);
+
+	while (nslookup->sent < nslookup->repeat_count &&
+	       nslookup->running < DLD_LOCAL_NSLOOKUP_MAX_PARALLEL) {
+		query = &nslookup->queries[nslookup->sent];
+		query->nslookup = nslookup;
+
+		prv_dns_put16(nslookup->packet->data,
+			      nslookup->base_id + nslookup->sent);
+
+		nslookup->sent++;
+		nslookup->running++;
+		query->sent_time = g_get_monotonic_time();
+
+		if (send(fd, nslookup->packet->data, nslookup->packet->len,
+			 0) < 0) {
+			DLEYNA_LOG_WARNING("NSLookup test %u: send failed: %s",
+					   nslookup->test->id,
+					   g_strerror(errno));
+
+			prv_query_complete(query, prv_nslookup_result_new(
+					nslookup,
+					"Error_DNSServerNotAvailable",
+					"None", "", NULL, 0));
+			continue;
+		}
+
+		query->timeout_id = g_timeout_add(nslookup->timeout,
+						  prv_query_timeout_cb, query);
+	}
+
+	return nslookup->done < nslookup->repeat_count;
+}
+
+static gboolean prv_query_timeout_cb(gpointer user_data)
+{
+	prv_query_t *query = user_data;
+	prv_nslookup_t *nslookup = query->nslookup;
+
+	DLEYNA_LOG_DEBUG("NSLookup test %u: query timed out",
+			 nslookup->test->id);
+
+	query->timeout_id = 0;
+	prv_query_complete(query, prv_nslookup_result_new(nslookup,
+							  "Error_Timeout",
+							  "None", "", NULL,
+							  0));
+
+	if (!prv_nslookup_send(nslookup))
+		prv_nslookup_finish(nslookup, "Success", "");
+
+	return FALSE;
+}
+
+/* The server is unreachable: fail every query still in flight */
+static void prv_nslookup_refused(prv_nslookup_t *nslookup)
+{
+	prv_query_t *query;
+	guint i;
+
+	for (i = 0; i < nslookup->sent; ++i) {
+		query = &nslookup->queries[i];
+		if (query->result)
+			continue;
+
+		prv_query_complete(query, prv_nslookup_result_new(
+					nslookup,
+					"Error_DNSServerNotAvailable",
+					"None", "", NULL, 0));
+	}
+}
+
+static gboolean prv_nslookup_read_cb(GIOChannel *source,
+				     GIOCondition condition,
+				     gpointer user_data)
+{
+	prv_nslookup_t *nslookup = user_data;
+	guint8 packet[DLD_DNS_MAX_PACKET];
+	prv_query_t *query;
+	ssize_t length;
+	guint16 index;
+	gint64 rsp_time;
+	int fd;
+
+	fd = g_io_channel_unix_get_fd(source);
+
+	while ((length = recv(fd, packet, sizeof(packet), 0)) >= 0) {
+		if (length < DLD_DNS_HEADER_SIZE ||
+		    !(prv_dns_get16(packet + 2) & DLD_DNS_FLAG_RESPONSE))
+			continue;
+
+		index = prv_dns_get16(packet) - nslookup->base_id;
+		if (index >= nslookup->sent)
+			continue;
+
+		query = &nslookup->queries[index];
+		if (query->result)
+			continue;
+
+		rsp_time = g_get_monotonic_time() - query->sent_time;
+		prv_query_complete(query,
+				   prv_nslookup_parse(nslookup, packet, length,
+						      (rsp_time + 500) / 1000));
+	}
+
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		DLEYNA_LOG_WARNING("NSLookup test %u: receive failed: %s",
+				   nslookup->test->id, g_strerror(errno));
+
+		prv_nslookup_refused(nslookup);
+	}
+
+	if (!prv_nslookup_send(nslookup)) {
+		nslookup->watch_id = 0;
+		prv_nslookup_finish(nslookup, "Success", "");
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gchar *prv_nslookup_system_server(void)
+{
+	gchar *contents;
+	gchar **lines;
+	gchar address[INET_ADDRSTRLEN];
+	struct in_addr addr;
+	gchar *server = NULL;
+	guint i;
+
+	if (!g_file_get_contents(DLD_LOCAL_NSLOOKUP_RESOLV_CONF, &contents,
+				 NULL, NULL))
+		return NULL;
+
+	lines = g_strsplit(contents, "\n", -1);
+
+	for (i = 0; lines[i] && !server; ++i)
+		if (sscanf(lines[i], " nameserver %15s", address) == 1 &&
+		    inet_pton(AF_INET, address, &addr) == 1)
+			server = g_strdup(address);
+
+	g_strfreev(lines);
+	g_free(contents);
+
+	return server;
+}
+
+/* DNSServer is an IPv4 address, optionally followed by ":port" */
+static gboolean prv_nslookup_server_parse(prv_nslookup_t *nslookup,
+					  const gchar *dns_server,
+					  struct sockaddr_in *addr)
+{
+	const gchar *colon;
+	gchar *end;
+	gulong port = DLD_LOCAL_NSLOOKUP_PORT;
+
+	if (*dns_server)
+		nslookup->server_ip = g_strdup(dns_server);
+	else
+		nslookup->server_ip = prv_nslookup_system_server();
+
+	if (!nslookup->server_ip)
+		return FALSE;
+
+	colon = strchr(nslookup->server_ip, ':');
+	if (colon) {
+		errno = 0;
+		port = strtoul(colon + 1, &end, 10);
+		if (errno || *end || end == colon + 1 || !port ||
+		    port > G_MAXUINT16)
+			return FALSE;
+
+		nslookup->server_ip[colon - nslookup->server_ip] = 0;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+
+	return inet_pton(AF_INET, nslookup->server_ip, &addr->sin_addr) == 1;
+}
+
+void dld_local_nslookup_start(dld_local_test_t *test, dld_task_t *task)
+{
+	dld_task_nslookup_t *task_data = &task->ut.nslookup;
+	prv_nslookup_t *nslookup;
+	struct sockaddr_in addr;
+	int fd;
+	int error;
+
+	nslookup = g_new0(prv_nslookup_t, 1);
+	nslookup->test = test;
+	nslookup->repeat_count = MIN(task_data->repeat_count,
+				     DLD_LOCAL_NSLOOKUP_MAX_REPEAT);
+	nslookup->timeout = task_data->interval;
+
+	if (!nslookup->repeat_count)
+		nslookup->repeat_count = 1;
+
+	if (!nslookup->timeout)
+		nslookup->timeout = DLD_LOCAL_NSLOOKUP_DEFAULT_TIMEOUT;
+
+	nslookup->queries = g_new0(prv_query_t, nslookup->repeat_count);
+	nslookup->base_id = g_random_int_range(0, G_MAXUINT16 + 1);
+
+	test->engine = nslookup;
+	test->cancel = prv_nslookup_cancel;
+
+	if (!prv_nslookup_server_parse(nslookup, task_data->dns_server,
+				       &addr)) {
+		if (!nslookup->server_ip)
+			nslookup->server_ip = g_strdup("");
+
+		prv_nslookup_finish(nslookup, "Error_DNSServerNotResolved",
+				    "Invalid or missing DNS server");
+		return;
+	}
+
+	nslookup->packet = prv_dns_query_new(task_data->hostname);
+	if (!nslookup->packet) {
+		prv_nslookup_finish(nslookup, "Error_Other",
+				    "Invalid host name");
+		return;
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr,
+			      sizeof(addr)) < 0) {
+		error = errno;
+		DLEYNA_LOG_WARNING("Unable to reach DNS server %s: %s",
+				   nslookup->server_ip, g_strerror(error));
+
+		if (fd >= 0)
+			(void) close(fd);
+
+		prv_nslookup_finish(nslookup, "Error_Internal",
+				    g_strerror(error));
+		return;
+	}
+
+	nslookup->channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(nslookup->channel, TRUE);
+	/* A refused query is reported as POLLERR, without POLLIN */
+	nslookup->watch_id = g_io_add_watch(nslookup->channel,
+					    G_IO_IN | G_IO_ERR,
+					    prv_nslookup_read_cb, nslookup);
+
+	if (!prv_nslookup_send(nslookup))
+		prv_nslookup_finish(nslookup, "Success", "");
+}
@@ -0,0 +1,366 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <sys/socket.h>
+
+#include <libdleyna/core/log.h>
+
+#include "local.h"
+
+#define DLD_LOCAL_PING_PERIOD 1000
+#define DLD_LOCAL_PING_DEFAULT_TIMEOUT 1000
+#define DLD_LOCAL_PING_MAX_DATA_SIZE (IP_MAXPACKET - sizeof(struct iphdr) - \
+				      sizeof(struct icmphdr))
+
+/* The probes of every ping test share one unprivileged ICMP socket.  The
+ * kernel picks the echo identifier and only hands us our own replies, so
+ * replies are matched on their sequence number.
+ */
+typedef struct prv_ping_socket_t_ prv_ping_socket_t;
+struct prv_ping_socket_t_ {
+	GIOChannel *channel;
+	guint watch_id;
+	GHashTable *probes;
+	guint16 next_sequence;
+	guint8 *buffer;
+};
+
+typedef struct prv_ping_t_ prv_ping_t;
+struct prv_ping_t_ {
+	dld_local_test_t *test;
+	GCancellable *cancellable;
+	struct sockaddr_in addr;
+	guint repeat_count;
+	guint timeout;
+	gsize data_size;
+	int tos;
+	guint sent;
+	guint success;
+	guint failure;
+	gint64 total_time;
+	gint64 min_time;
+	gint64 max_time;
+	gboolean waiting;
+	guint16 sequence;
+	gint64 sent_time;
+	guint timeout_id;
+};
+
+static prv_ping_socket_t g_ping_socket;
+
+static void prv_ping_send(prv_ping_t *ping);
+
+static void prv_ping_probe_done(prv_ping_t *ping)
+{
+	(void) g_hash_table_remove(g_ping_socket.probes,
+				   GUINT_TO_POINTER(ping->sequence));
+	ping->waiting = FALSE;
+}
+
+static void prv_ping_free(prv_ping_t *ping)
+{
+	if (ping->cancellable) {
+		g_cancellable_cancel(ping->cancellable);
+		g_object_unref(ping->cancellable);
+	}
+
+	if (ping->timeout_id)
+		(void) g_source_remove(ping->timeout_id);
+
+	if (ping->waiting)
+		prv_ping_probe_done(ping);
+
+	g_free(ping);
+}
+
+static void prv_ping_cancel(dld_local_test_t *test)
+{
+	prv_ping_free(test->engine);
+}
+
+static guint prv_ping_msecs(gint64 usecs)
+{
+	return (guint)((usecs + 500) / 1000);
+}
+
+static void prv_ping_finish(prv_ping_t *ping, const gchar *status,
+			    const gchar *info)
+{
+	dld_local_test_t *test = ping->test;
+	GVariant *result;
+	guint avg_rsp_time = 0;
+
+	DLEYNA_LOG_DEBUG("Ping test %u: %s %s", test->id, status, info);
+
+	if (ping->success)
+		avg_rsp_time = prv_ping_msecs(ping->total_time /
+					      ping->success);
+
+	result = g_variant_new("(ssuuuuu)", status, info, ping->success,
+			       ping->failure, avg_rsp_time,
+			       prv_ping_msecs(ping->min_time),
+			       prv_ping_msecs(ping->max_time));
+
+	prv_ping_free(ping);
+	dld_local_test_complete(test, result);
+}
+
+static gboolean prv_ping_timeout_cb(gpointer user_data)
+{
+	prv_ping_t *ping = user_data;
+
+	ping->timeout_id = 0;
+
+	if (ping->waiting) {
+		DLEYNA_LOG_DEBUG("Ping test %u: probe %u timed out",
+				 ping->test->id, ping->sequence);
+
+		prv_ping_probe_done(ping);
+		ping->failure++;
+	}
+
+	prv_ping_send(ping);
+
+	return FALSE;
+}
+
+/* Probes go out at most once per DLD_LOCAL_PING_PERIOD */
+static void prv_ping_schedule(prv_ping_t *ping)
+{
+	gint64 elapsed;
+
+	elapsed = (g_get_monotonic_time() - ping->sent_time) / 1000;
+
+	if (ping->sent == ping->repeat_count ||
+	    elapsed >= DLD_LOCAL_PING_PERIOD)
+		prv_ping_send(ping);
+	else
+		ping->timeout_id = g_timeout_add(
+					DLD_LOCAL_PING_PERIOD - elapsed,
+					prv_ping_timeout_cb, ping);
+}
+
+static void prv_ping_reply(prv_ping_t *ping)
+{
+	gint64 rsp_time;
+
+	rsp_time = g_get_monotonic_time() - ping->sent_time;
+
+	prv_ping_probe_done(ping);
+	(void) g_source_remove(ping->timeout_id);
+	ping->timeout_id = 0;
+
+	if (!ping->success || rsp_time < ping->min_time)
+		ping->min_time = rsp_time;
+	if (rsp_time > ping->max_time)
+		ping->max_time = rsp_time;
+
+	ping->total_time += rsp_time;
+	ping->success++;
+
+	prv_ping_schedule(ping);
+}
+
+static gboolean prv_ping_socket_read_cb(GIOChannel *source,
+					GIOCondition condition,
+					gpointer user_data)
+{
+	struct icmphdr *hdr = (struct icmphdr *)g_ping_socket.buffer;
+	struct sockaddr_in from;
+	socklen_t from_len;
+	ssize_t len;
+	prv_ping_t *ping;
+	guint16 sequence;
+	int fd;
+
+	fd = g_io_channel_unix_get_fd(source);
+
+	for (;;) {
+		from_len = sizeof(from);
+		len = recvfrom(fd, g_ping_socket.buffer, IP_MAXPACKET, 0,
+			       (struct sockaddr *)&from, &from_len);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				DLEYNA_LOG_WARNING("ICMP receive failed: %s",
+						   g_strerror(errno));
+			break;
+		}
+
+		if ((gsize)len < sizeof(*hdr) || hdr->type != ICMP_ECHOREPLY)
+			continue;
+
+		sequence = ntohs(hdr->un.echo.sequence);
+		ping = g_hash_table_lookup(g_ping_socket.probes,
+					   GUINT_TO_POINTER(sequence));
+
+		if (ping && from.sin_addr.s_addr == ping->addr.sin_addr.s_addr)
+			prv_ping_reply(ping);
+	}
+
+	return TRUE;
+}
+
+static gboolean prv_ping_socket_open(int *error)
+{
+	int fd;
+
+	if (g_ping_socket.channel)
+		return TRUE;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    IPPROTO_ICMP);
+	if (fd < 0) {
+		*error = errno;
+		DLEYNA_LOG_WARNING("Unable to open ICMP socket: %s",
+				   g_strerror(*error));
+
+		return FALSE;
+	}
+
+	g_ping_socket.channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(g_ping_socket.channel, TRUE);
+	g_ping_socket.watch_id = g_io_add_watch(g_ping_socket.channel,
+						G_IO_IN,
+						prv_ping_socket_read_cb,
+						NULL);
+	g_ping_socket.probes = g_hash_table_new(g_direct_hash,
+						g_direct_equal);
+	g_ping_socket.buffer = g_malloc(IP_MAXPACKET);
+
+	return TRUE;
+}
+
+void dld_local_ping_cleanup(void)
+{
+	if (g_ping_socket.channel) {
+		(void) g_source_remove(g_ping_socket.watch_id);
+		g_io_channel_unref(g_ping_socket.channel);
+		g_hash_table_unref(g_ping_socket.probes);
+		g_free(g_ping_socket.buffer);
+
+		memset(&g_ping_socket, 0, sizeof(g_ping_socket));
+	}
+}
+
+static void prv_ping_send(prv_ping_t *ping)
+{
+	struct icmphdr *hdr;
+	gsize size = sizeof(*hdr) + ping->data_size;
+	int fd;
+
+	if (ping->sent == ping->repeat_count) {
+		prv_ping_finish(ping, "Success", "");
+		return;
+	}
+
+	hdr = g_malloc0(size);
+	hdr->type = ICMP_ECHO;
+	ping->sequence = g_ping_socket.next_sequence++;
+	hdr->un.echo.sequence = htons(ping->sequence);
+
+	fd = g_io_channel_unix_get_fd(g_ping_socket.channel);
+	(void) setsockopt(fd, IPPROTO_IP, IP_TOS, &ping->tos,
+			  sizeof(ping->tos));
+
+	ping->sent++;
+	ping->sent_time = g_get_monotonic_time();
+
+	if (sendto(fd, hdr, size, 0, (struct sockaddr *)&ping->addr,
+		   sizeof(ping->addr)) < 0) {
+		DLEYNA_LOG_WARNING("Ping test %u: send failed: %s",
+				   ping->test->id, g_strerror(errno));
+
+		ping->failure++;
+		prv_ping_schedule(ping);
+	} else {
+		g_hash_table_insert(g_ping_socket.probes,
+				    GUINT_TO_POINTER(ping->sequence), ping);
+		ping->waiting = TRUE;
+		ping->timeout_id = g_timeout_add(ping->timeout,
+						 prv_ping_timeout_cb, ping);
+	}
+
+	g_free(hdr);
+}
+
+static void prv_ping_resolved(GInetAddress *address, const gchar *error,
+			      gpointer user_data)
+{
+	prv_ping_t *ping = user_data;
+	int socket_error;
+
+	g_object_unref(ping->cancellable);
+	ping->cancellable = NULL;
+
+	if (!address) {
+		prv_ping_finish(ping, "Error_CannotResolveHostName", error);
+		return;
+	}
+
+	memcpy(&ping->addr.sin_addr, g_inet_address_to_bytes(address),
+	       sizeof(ping->addr.sin_addr));
+
+	if (!prv_ping_socket_open(&socket_error)) {
+		prv_ping_finish(ping, "Error_Internal",
+				g_strerror(socket_error));
+		return;
+	}
+
+	prv_ping_send(ping);
+}
+
+void dld_local_ping_start(dld_local_test_t *test, dld_task_t *task)
+{
+	dld_task_ping_t *task_data = &task->ut.ping;
+	prv_ping_t *ping;
+
+	ping = g_new0(prv_ping_t, 1);
+	ping->test = test;
+	ping->addr.sin_family = AF_INET;
+	ping->repeat_count = task_data->repeat_count;
+	ping->timeout = task_data->interval;
+	ping->data_size = MIN(task_data->data_block_size,
+			      DLD_LOCAL_PING_MAX_DATA_SIZE);
+	ping->tos = (task_data->dscp & 0x3f) << 2;
+
+	if (!ping->repeat_count)
+		ping->repeat_count = 1;
+
+	if (!ping->timeout)
+		ping->timeout = DLD_LOCAL_PING_DEFAULT_TIMEOUT;
+
+	test->engine = ping;
+	test->cancel = prv_ping_cancel;
+
+	ping->cancellable = g_cancellable_new();
+	dld_local_resolve(task_data->host, ping->cancellable,
+			  prv_ping_resolved, ping);
+}
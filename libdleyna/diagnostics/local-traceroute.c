@@ -0,0 +1,372 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#include <libdleyna/core/log.h>
+
+#include "local.h"
+
+#define DLD_LOCAL_TRACEROUTE_DEFAULT_TIMEOUT 5000
+#define DLD_LOCAL_TRACEROUTE_DEFAULT_MAX_HOPS 30
+#define DLD_LOCAL_TRACEROUTE_MAX_HOPS 64
+#define DLD_LOCAL_TRACEROUTE_BASE_PORT 33434
+#define DLD_LOCAL_TRACEROUTE_MAX_DATA_SIZE (IP_MAXPACKET - \
+					    sizeof(struct iphdr) - \
+					    sizeof(struct udphdr))
+
+typedef struct prv_hop_t_ prv_hop_t;
+struct prv_hop_t_ {
+	gboolean answered;
+	gchar host[INET_ADDRSTRLEN];
+};
+
+/* One UDP probe is sent per TTL, all at once, to port BASE_PORT + TTL.
+ * The ICMP errors they trigger are read from the socket error queue,
+ * which reports the original destination, hence the TTL of the probe.
+ */
+typedef struct prv_traceroute_t_ prv_traceroute_t;
+struct prv_traceroute_t_ {
+	dld_local_test_t *test;
+	GCancellable *cancellable;
+	GIOChannel *channel;
+	guint watch_id;
+	guint timeout_id;
+	struct sockaddr_in addr;
+	guint timeout;
+	gsize data_size;
+	int tos;
+	guint max_hops;
+	prv_hop_t hops[DLD_LOCAL_TRACEROUTE_MAX_HOPS];
+	guint last_hop;
+	gboolean reached;
+	gint64 sent_time;
+	gint64 total_time;
+	guint reached_count;
+};
+
+static void prv_traceroute_free(prv_traceroute_t *traceroute)
+{
+	if (traceroute->cancellable) {
+		g_cancellable_cancel(traceroute->cancellable);
+		g_object_unref(traceroute->cancellable);
+	}
+
+	if (traceroute->timeout_id)
+		(void) g_source_remove(traceroute->timeout_id);
+
+	if (traceroute->watch_id)
+		(void) g_source_remove(traceroute->watch_id);
+
+	if (traceroute->channel)
+		g_io_channel_unref(traceroute->channel);
+
+	g_free(traceroute);
+}
+
+static void prv_traceroute_cancel(dld_local_test_t *test)
+{
+	prv_traceroute_free(test->engine);
+}
+
+static void prv_traceroute_finish(prv_traceroute_t *traceroute,
+				  const gchar *status, const gchar *info)
+{
+	dld_local_test_t *test = traceroute->test;
+	GVariantBuilder hop_hosts;
+	GVariant *result;
+	guint rsp_time = 0;
+	guint last = 0;
+	guint i;
+
+	DLEYNA_LOG_DEBUG("Traceroute test %u: %s %s", test->id, status, info);
+
+	/* Rounded up, so that a reached host never reports zero */
+	if (traceroute->reached_count)
+		rsp_time = (traceroute->total_time /
+			    traceroute->reached_count + 999) / 1000;
+
+	if (traceroute->last_hop)
+		last = traceroute->last_hop;
+	else
+		for (i = 0; i < traceroute->max_hops; ++i)
+			if (traceroute->hops[i].answered)
+				last = i + 1;
+
+	g_variant_builder_init(&hop_hosts, G_VARIANT_TYPE("as"));
+
+	for (i = 0; i < last; ++i)
+		g_variant_builder_add(&hop_hosts, "s",
+				      traceroute->hops[i].answered ?
+				      traceroute->hops[i].host : "*");
+
+	result = g_variant_new("(ssu@as)", status, info, rsp_time,
+			       g_variant_builder_end(&hop_hosts));
+
+	prv_traceroute_free(traceroute);
+	dld_local_test_complete(test, result);
+}
+
+static void prv_traceroute_done(prv_traceroute_t *traceroute)
+{
+	if (traceroute->reached)
+		prv_traceroute_finish(traceroute, "Success", "");
+	else if (traceroute->last_hop)
+		prv_traceroute_finish(traceroute, "Error_Other",
+				      "Destination unreachable");
+	else
+		prv_traceroute_finish(traceroute, "Error_MaxHopCountExceeded",
+				      "");
+}
+
+static gboolean prv_traceroute_timeout_cb(gpointer user_data)
+{
+	prv_traceroute_t *traceroute = user_data;
+
+	traceroute->timeout_id = 0;
+	prv_traceroute_done(traceroute);
+
+	return FALSE;
+}
+
+/* The route is known once the last hop and every hop before it answered */
+static gboolean prv_traceroute_complete(prv_traceroute_t *traceroute)
+{
+	guint i;
+
+	if (!traceroute->last_hop)
+		return FALSE;
+
+	for (i = 0; i < traceroute->last_hop; ++i)
+		if (!traceroute->hops[i].answered)
+			return FALSE;
+
+	return TRUE;
+}
+
+static void prv_traceroute_error(prv_traceroute_t *traceroute,
+				 const struct sockaddr_in *dest,
+				 const struct sock_extended_err *ee,
+				 gint64 rsp_time)
+{
+	const struct sockaddr_in *offender;
+	prv_hop_t *hop;
+	guint ttl;
+	gboolean final;
+
+	ttl = ntohs(dest->sin_port) - DLD_LOCAL_TRACEROUTE_BASE_PORT;
+	if (ee->ee_origin != SO_EE_ORIGIN_ICMP || !ttl ||
+	    ttl > traceroute->max_hops)
+		return;
+
+	offender = (const struct sockaddr_in *)SO_EE_OFFENDER(ee);
+	final = ee->ee_type == ICMP_DEST_UNREACH;
+
+	if (final && offender->sin_addr.s_addr ==
+	    traceroute->addr.sin_addr.s_addr) {
+		traceroute->total_time += rsp_time;
+		traceroute->reached_count++;
+	}
+
+	hop = &traceroute->hops[ttl - 1];
+	if (hop->answered)
+		return;
+
+	hop->answered = TRUE;
+	(void) inet_ntop(AF_INET, &offender->sin_addr, hop->host,
+			 sizeof(hop->host));
+
+	if (final && (!traceroute->last_hop || ttl < traceroute->last_hop)) {
+		traceroute->last_hop = ttl;
+		traceroute->reached = offender->sin_addr.s_addr ==
+				      traceroute->addr.sin_addr.s_addr;
+	}
+}
+
+static gboolean prv_traceroute_read_cb(GIOChannel *source,
+				       GIOCondition condition,
+				       gpointer user_data)
+{
+	prv_traceroute_t *traceroute = user_data;
+	guint8 data[64];
+	guint8 control[512];
+	struct sockaddr_in dest;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	gint64 rsp_time;
+	int fd;
+
+	fd = g_io_channel_unix_get_fd(source);
+	rsp_time = g_get_monotonic_time() - traceroute->sent_time;
+
+	/* Datagrams sent back to us carry no TTL, drop them */
+	while (recv(fd, data, sizeof(data), MSG_DONTWAIT) >= 0)
+		;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = data;
+		iov.iov_len = sizeof(data);
+		msg.msg_name = &dest;
+		msg.msg_namelen = sizeof(dest);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg))
+			if (cmsg->cmsg_level == SOL_IP &&
+			    cmsg->cmsg_type == IP_RECVERR)
+				prv_traceroute_error(
+					traceroute, &dest,
+					(struct sock_extended_err *)
+						CMSG_DATA(cmsg),
+					rsp_time);
+	}
+
+	if (prv_traceroute_complete(traceroute)) {
+		traceroute->watch_id = 0;
+		prv_traceroute_done(traceroute);
+
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void prv_traceroute_send(prv_traceroute_t *traceroute)
+{
+	guint8 *data;
+	int on = 1;
+	int fd;
+	int ttl;
+	int error;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0 || setsockopt(fd, SOL_IP, IP_RECVERR, &on,
+				 sizeof(on)) < 0) {
+		error = errno;
+		if (fd >= 0)
+			(void) close(fd);
+
+		prv_traceroute_finish(traceroute, "Error_Internal",
+				      g_strerror(error));
+		return;
+	}
+
+	traceroute->channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(traceroute->channel, TRUE);
+	traceroute->watch_id = g_io_add_watch(traceroute->channel,
+					      G_IO_IN | G_IO_ERR,
+					      prv_traceroute_read_cb,
+					      traceroute);
+
+	(void) setsockopt(fd, IPPROTO_IP, IP_TOS, &traceroute->tos,
+			  sizeof(traceroute->tos));
+
+	data = g_malloc0(traceroute->data_size);
+	traceroute->sent_time = g_get_monotonic_time();
+
+	for (ttl = 1; ttl <= (int)traceroute->max_hops; ++ttl) {
+		(void) setsockopt(fd, IPPROTO_IP, IP_TTL, &ttl, sizeof(ttl));
+		traceroute->addr.sin_port =
+			htons(DLD_LOCAL_TRACEROUTE_BASE_PORT + ttl);
+
+		if (sendto(fd, data, traceroute->data_size, 0,
+			   (struct sockaddr *)&traceroute->addr,
+			   sizeof(traceroute->addr)) < 0)
+			DLEYNA_LOG_WARNING("Traceroute test %u: TTL %d: %s",
+					   traceroute->test->id, ttl,
+					   g_strerror(errno));
+	}
+
+	g_free(data);
+
+	traceroute->timeout_id = g_timeout_add(traceroute->timeout,
+					       prv_traceroute_timeout_cb,
+					       traceroute);
+}
+
+static void prv_traceroute_resolved(GInetAddress *address,
+				    const gchar *error,
+				    gpointer user_data)
+{
+	prv_traceroute_t *traceroute = user_data;
+
+	g_object_unref(traceroute->cancellable);
+	traceroute->cancellable = NULL;
+
+	if (!address) {
+		prv_traceroute_finish(traceroute,
+				      "Error_CannotResolveHostName", error);
+		return;
+	}
+
+	memcpy(&traceroute->addr.sin_addr, g_inet_address_to_bytes(address),
+	       sizeof(traceroute->addr.sin_addr));
+
+	prv_traceroute_send(traceroute);
+}
+
+void dld_local_traceroute_start(dld_local_test_t *test, dld_task_t *task)
+{
+	dld_task_traceroute_t *task_data = &task->ut.traceroute;
+	prv_traceroute_t *traceroute;
+
+	traceroute = g_new0(prv_traceroute_t, 1);
+	traceroute->test = test;
+	traceroute->addr.sin_family = AF_INET;
+	traceroute->timeout = task_data->timeout;
+	traceroute->data_size = MIN(task_data->data_block_size,
+				    DLD_LOCAL_TRACEROUTE_MAX_DATA_SIZE);
+	traceroute->max_hops = MIN(task_data->max_hop_count,
+				   DLD_LOCAL_TRACEROUTE_MAX_HOPS);
+	traceroute->tos = (task_data->dscp & 0x3f) << 2;
+
+	if (!traceroute->timeout)
+		traceroute->timeout = DLD_LOCAL_TRACEROUTE_DEFAULT_TIMEOUT;
+
+	if (!traceroute->max_hops)
+		traceroute->max_hops = DLD_LOCAL_TRACEROUTE_DEFAULT_MAX_HOPS;
+
+	test->engine = traceroute;
+	test->cancel = prv_traceroute_cancel;
+
+	traceroute->cancellable = g_cancellable_new();
+	dld_local_resolve(task_data->host, traceroute->cancellable,
+			  prv_traceroute_resolved, traceroute);
+}
@@ -0,0 +1,415 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include <string.h>
+
+#include <libdleyna/core/error.h>
+#include <libdleyna/core/log.h>
+
+#include "async.h"
+#include "device.h"
+#include "local.h"
+
+#define DLD_LOCAL_MAX_FINISHED_TESTS 32
+
+struct dld_local_t_ {
+	dld_device_t *device;
+	GHashTable *tests;
+	GQueue finished;
+	guint next_id;
+};
+
+typedef void (*prv_test_start_t)(dld_local_test_t *test, dld_task_t *task);
+
+typedef struct prv_test_def_t_ prv_test_def_t;
+struct prv_test_def_t_ {
+	const gchar *type;
+	dld_task_type_t start_task;
+	dld_task_type_t result_task;
+	prv_test_start_t start;
+};
+
+typedef struct prv_resolve_t_ prv_resolve_t;
+struct prv_resolve_t_ {
+	dld_local_resolve_cb_t cb;
+	gpointer user_data;
+};
+
+static const prv_test_def_t g_test_defs[] = {
+	{ "Ping", DLD_TASK_PING, DLD_TASK_GET_PING_RESULT,
+	  dld_local_ping_start },
+	{ "NSLookup", DLD_TASK_NSLOOKUP, DLD_TASK_GET_NSLOOKUP_RESULT,
+	  dld_local_nslookup_start },
+	{ "Traceroute", DLD_TASK_TRACEROUTE, DLD_TASK_GET_TRACEROUTE_RESULT,
+	  dld_local_traceroute_start }
+};
+
+static const prv_test_def_t *prv_test_def_lookup(dld_task_type_t type)
+{
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(g_test_defs); ++i)
+		if (g_test_defs[i].start_task == type ||
+		    g_test_defs[i].result_task == type)
+			return &g_test_defs[i];
+
+	return NULL;
+}
+
+static void prv_test_free(gpointer data)
+{
+	dld_local_test_t *test = data;
+
+	if (test->cancel)
+		test->cancel(test);
+
+	if (test->result)
+		g_variant_unref(test->result);
+
+	g_free(test);
+}
+
+static gint prv_compare_ids(gconstpointer a, gconstpointer b)
+{
+	guint id_a = GPOINTER_TO_UINT(a);
+	guint id_b = GPOINTER_TO_UINT(b);
+
+	return (id_a > id_b) - (id_a < id_b);
+}
+
+static void prv_tests_changed(dld_local_t *local)
+{
+	GVariantBuilder ids_vb;
+	GVariantBuilder active_vb;
+	GList *ids;
+	GList *l;
+	dld_local_test_t *test;
+
+	g_variant_builder_init(&ids_vb, G_VARIANT_TYPE("au"));
+	g_variant_builder_init(&active_vb, G_VARIANT_TYPE("au"));
+
+	ids = g_list_sort(g_hash_table_get_keys(local->tests),
+			  prv_compare_ids);
+
+	for (l = ids; l; l = l->next) {
+		test = g_hash_table_lookup(local->tests, l->data);
+
+		g_variant_builder_add(&ids_vb, "u", test->id);
+		if (test->cancel)
+			g_variant_builder_add(&active_vb, "u", test->id);
+	}
+
+	g_list_free(ids);
+
+	dld_device_tests_changed(local->device,
+				 g_variant_builder_end(&ids_vb),
+				 g_variant_builder_end(&active_vb));
+}
+
+/* Only the last DLD_LOCAL_MAX_FINISHED_TESTS results are kept */
+static void prv_test_finished(dld_local_t *local, dld_local_test_t *test)
+{
+	gpointer id;
+
+	test->engine = NULL;
+	test->cancel = NULL;
+
+	g_queue_push_tail(&local->finished, GUINT_TO_POINTER(test->id));
+
+	while (local->finished.length > DLD_LOCAL_MAX_FINISHED_TESTS) {
+		id = g_queue_pop_head(&local->finished);
+		(void) g_hash_table_remove(local->tests, id);
+	}
+
+	prv_tests_changed(local);
+}
+
+static void prv_task_complete(dld_task_t *task, dld_upnp_task_complete_t cb,
+			      GError *error)
+{
+	dld_async_task_t *cb_data = (dld_async_task_t *)task;
+
+	cb_data->cb = cb;
+	cb_data->error = error;
+
+	(void) g_idle_add(dld_async_task_complete, cb_data);
+}
+
+static dld_local_test_t *prv_test_lookup(dld_local_t *local,
+					 dld_task_t *task,
+					 GError **error)
+{
+	dld_local_test_t *test;
+
+	test = g_hash_table_lookup(local->tests,
+				   GUINT_TO_POINTER(task->ut.test.id));
+	if (!test)
+		*error = g_error_new(DLEYNA_SERVER_ERROR,
+				     DLEYNA_ERROR_OBJECT_NOT_FOUND,
+				     "Unknown test %u", task->ut.test.id);
+
+	return test;
+}
+
+dld_local_t *dld_local_new(dld_device_t *device)
+{
+	dld_local_t *local;
+
+	local = g_new0(dld_local_t, 1);
+
+	local->device = device;
+	local->tests = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					     NULL, prv_test_free);
+	g_queue_init(&local->finished);
+	local->next_id = 1;
+
+	return local;
+}
+
+void dld_local_delete(dld_local_t *local)
+{
+	if (local) {
+		g_hash_table_unref(local->tests);
+		g_queue_clear(&local->finished);
+		dld_local_ping_cleanup();
+
+		g_free(local);
+	}
+}
+
+void dld_local_get_test_info(dld_local_t *local, dld_task_t *task,
+			     dld_upnp_task_complete_t cb)
+{
+	dld_local_test_t *test;
+	GError *error = NULL;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	test = prv_test_lookup(local, task, &error);
+	if (test)
+		task->result = g_variant_ref_sink(g_variant_new("(ss)",
+								test->type,
+								test->state));
+
+	prv_task_complete(task, cb, error);
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
+void dld_local_cancel_test(dld_local_t *local, dld_task_t *task,
+			   dld_upnp_task_complete_t cb)
+{
+	dld_local_test_t *test;
+	GError *error = NULL;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	test = prv_test_lookup(local, task, &error);
+	if (!test)
+		goto on_exit;
+
+	if (!test->cancel) {
+		error = g_error_new(DLEYNA_SERVER_ERROR,
+				    DLEYNA_ERROR_OPERATION_FAILED,
+				    "Test %u is not running", test->id);
+		goto on_exit;
+	}
+
+	DLEYNA_LOG_DEBUG("Cancelling %s test %u", test->type, test->id);
+
+	test->cancel(test);
+	test->state = DLD_LOCAL_TEST_STATE_CANCELED;
+	prv_test_finished(local, test);
+
+on_exit:
+
+	prv_task_complete(task, cb, error);
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
+void dld_local_start_test(dld_local_t *local, dld_task_t *task,
+			  dld_upnp_task_complete_t cb)
+{
+	const prv_test_def_t *def;
+	dld_local_test_t *test;
+	GError *error = NULL;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	def = prv_test_def_lookup(task->type);
+	if (!def) {
+		error = g_error_new(DLEYNA_SERVER_ERROR,
+				    DLEYNA_ERROR_NOT_SUPPORTED,
+				    "Test not supported by the local device");
+		goto on_exit;
+	}
+
+	test = g_new0(dld_local_test_t, 1);
+	test->local = local;
+	test->id = local->next_id++;
+	test->type = def->type;
+	test->state = DLD_LOCAL_TEST_STATE_IN_PROGRESS;
+
+	g_hash_table_insert(local->tests, GUINT_TO_POINTER(test->id), test);
+
+	task->result = g_variant_ref_sink(g_variant_new_uint32(test->id));
+
+	DLEYNA_LOG_DEBUG("Starting %s test %u", test->type, test->id);
+
+	/* The engine may complete the test before returning */
+	def->start(test, task);
+
+	if (test->cancel)
+		prv_tests_changed(local);
+
+on_exit:
+
+	prv_task_complete(task, cb, error);
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
+void dld_local_get_test_result(dld_local_t *local, dld_task_t *task,
+			       dld_upnp_task_complete_t cb)
+{
+	const prv_test_def_t *def;
+	dld_local_test_t *test;
+	GError *error = NULL;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	def = prv_test_def_lookup(task->type);
+	test = prv_test_lookup(local, task, &error);
+	if (!test)
+		goto on_exit;
+
+	if (!def || strcmp(def->type, test->type)) {
+		error = g_error_new(DLEYNA_SERVER_ERROR,
+				    DLEYNA_ERROR_BAD_QUERY,
+				    "Test %u is a %s test", test->id,
+				    test->type);
+		goto on_exit;
+	}
+
+	if (!test->result) {
+		error = g_error_new(DLEYNA_SERVER_ERROR,
+				    DLEYNA_ERROR_OPERATION_FAILED,
+				    "Test %u is %s", test->id, test->state);
+		goto on_exit;
+	}
+
+	task->result = g_variant_ref(test->result);
+
+on_exit:
+
+	prv_task_complete(task, cb, error);
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
+void dld_local_test_complete(dld_local_test_t *test, GVariant *result)
+{
+	dld_local_t *local = test->local;
+
+	DLEYNA_LOG_DEBUG("%s test %u completed", test->type, test->id);
+
+	test->state = DLD_LOCAL_TEST_STATE_COMPLETED;
+	test->result = g_variant_ref_sink(result);
+
+	dld_device_test_completed(local->device, test->id, test->type,
+				  test->result);
+
+	prv_test_finished(local, test);
+}
+
+static void prv_resolve_cb(GObject *source, GAsyncResult *res,
+			   gpointer user_data)
+{
+	prv_resolve_t *resolve = user_data;
+	GList *addresses;
+	GList *l;
+	GError *error = NULL;
+
+	addresses = g_resolver_lookup_by_name_finish(G_RESOLVER(source), res,
+						     &error);
+
+	/* A cancelled lookup means the test is gone */
+	if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		goto on_exit;
+
+	if (!addresses) {
+		resolve->cb(NULL, error->message, resolve->user_data);
+		goto on_exit;
+	}
+
+	for (l = addresses; l; l = l->next)
+		if (g_inet_address_get_family(l->data) ==
+		    G_SOCKET_FAMILY_IPV4)
+			break;
+
+	if (l)
+		resolve->cb(l->data, NULL, resolve->user_data);
+	else
+		resolve->cb(NULL, "No IPv4 address", resolve->user_data);
+
+on_exit:
+
+	if (addresses)
+		g_resolver_free_addresses(addresses);
+
+	if (error)
+		g_error_free(error);
+
+	g_free(resolve);
+}
+
+/* Host names are resolved asynchronously, IP addresses before returning.
+ * cb is not called once 'cancellable' has been cancelled.
+ */
+void dld_local_resolve(const gchar *host, GCancellable *cancellable,
+		       dld_local_resolve_cb_t cb, gpointer user_data)
+{
+	prv_resolve_t *resolve;
+	GInetAddress *address;
+	GResolver *resolver;
+
+	address = g_inet_address_new_from_string(host);
+	if (address) {
+		if (g_inet_address_get_family(address) == G_SOCKET_FAMILY_IPV4)
+			cb(address, NULL, user_data);
+		else
+			cb(NULL, "Only IPv4 hosts are supported", user_data);
+
+		g_object_unref(address);
+		return;
+	}
+
+	resolve = g_new0(prv_resolve_t, 1);
+	resolve->cb = cb;
+	resolve->user_data = user_data;
+
+	resolver = g_resolver_get_default();
+	g_resolver_lookup_by_name_async(resolver, host, cancellable,
+					prv_resolve_cb, resolve);
+	g_object_unref(resolver);
+}
@@ -0,0 +1,88 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#ifndef DLD_LOCAL_H__
+#define DLD_LOCAL_H__
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "server.h"
+#include "task.h"
+#include "upnp.h"
+
+#define DLD_LOCAL_TEST_STATE_IN_PROGRESS "InProgress"
+#define DLD_LOCAL_TEST_STATE_COMPLETED "Completed"
+#define DLD_LOCAL_TEST_STATE_CANCELED "Canceled"
+
+typedef struct dld_local_test_t_ dld_local_test_t;
+
+typedef void (*dld_local_test_cancel_t)(dld_local_test_t *test);
+
+typedef void (*dld_local_resolve_cb_t)(GInetAddress *address,
+				       const gchar *error,
+				       gpointer user_data);
+
+/* A test run by the host itself.  While it runs, the engine owns
+ * 'engine' and sets 'cancel', until it hands the result over with
+ * dld_local_test_complete().
+ */
+struct dld_local_test_t_ {
+	dld_local_t *local;
+	guint id;
+	const gchar *type;
+	const gchar *state;
+	GVariant *result;
+	gpointer engine;
+	dld_local_test_cancel_t cancel;
+};
+
+dld_local_t *dld_local_new(dld_device_t *device);
+
+void dld_local_delete(dld_local_t *local);
+
+void dld_local_get_test_info(dld_local_t *local, dld_task_t *task,
+			     dld_upnp_task_complete_t cb);
+
+void dld_local_cancel_test(dld_local_t *local, dld_task_t *task,
+			   dld_upnp_task_complete_t cb);
+
+void dld_local_start_test(dld_local_t *local, dld_task_t *task,
+			  dld_upnp_task_complete_t cb);
+
+void dld_local_get_test_result(dld_local_t *local, dld_task_t *task,
+			       dld_upnp_task_complete_t cb);
+
+void dld_local_test_complete(dld_local_test_t *test, GVariant *result);
+
+void dld_local_resolve(const gchar *host, GCancellable *cancellable,
+		       dld_local_resolve_cb_t cb, gpointer user_data);
+
+void dld_local_ping_start(dld_local_test_t *test, dld_task_t *task);
+
+void dld_local_ping_cleanup(void);
+
+void dld_local_nslookup_start(dld_local_test_t *test, dld_task_t *task);
+
+void dld_local_traceroute_start(dld_local_test_t *test, dld_task_t *task);
+
+#endif /* DLD_LOCAL_H__ */
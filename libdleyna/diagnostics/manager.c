@@ -31,12 +31,14 @@
 #include "async.h"
 #include "manager.h"
 #include "prop-defs.h"
+#include "scheduler.h"
 #include "server.h"
 
 struct dld_manager_t_ {
 	dleyna_connector_id_t connection;
 	GUPnPContextManager *cm;
 	dleyna_white_list_t *wl;
+	dld_scheduler_t *scheduler;
 };
 
 static GVariant *prv_build_wl_entries(dleyna_settings_t *settings)
@@ -51,7 +53,8 @@ static GVariant *prv_build_wl_entries(dleyna_settings_t *settings)
 	return result;
 }
 
-static void prv_add_all_props(dleyna_settings_t *settings, GVariantBuilder *vb)
+static void prv_add_all_props(dld_manager_t *manager,
+			      dleyna_settings_t *settings, GVariantBuilder *vb)
 {
 	g_variant_builder_add(vb, "{sv}", DLD_INTERFACE_PROP_NEVER_QUIT,
 			      g_variant_new_boolean(
@@ -65,9 +68,25 @@ static void prv_add_all_props(dleyna_settings_t *settings, GVariantBuilder *vb)
 
 	g_variant_builder_add(vb, "{sv}", DLD_INTERFACE_PROP_WHITE_LIST_ENTRIES,
 			      prv_build_wl_entries(settings));
+
+	g_variant_builder_add(vb, "{sv}", DLD_INTERFACE_PROP_MAX_DEVICE_ACTIONS,
+			      g_variant_new_uint32(
+				dld_scheduler_get_max_device_actions(
+							manager->scheduler)));
+
+	g_variant_builder_add(vb, "{sv}", DLD_INTERFACE_PROP_QUEUED_ACTIONS,
+			      g_variant_new_uint32(
+				dld_scheduler_get_queued_count(
+							manager->scheduler)));
+
+	g_variant_builder_add(vb, "{sv}", DLD_INTERFACE_PROP_RUNNING_ACTIONS,
+			      g_variant_new_uint32(
+				dld_scheduler_get_running_count(
+							manager->scheduler)));
 }
 
-static GVariant *prv_get_prop(dleyna_settings_t *settings, const gchar *prop)
+static GVariant *prv_get_prop(dld_manager_t *manager,
+			      dleyna_settings_t *settings, const gchar *prop)
 {
 	GVariant *retval = NULL;
 #if DLEYNA_LOG_LEVEL & DLEYNA_LOG_LEVEL_DEBUG
@@ -84,6 +103,18 @@ static GVariant *prv_get_prop(dleyna_settings_t *settings, const gchar *prop)
 								settings)));
 	else if (!strcmp(prop, DLD_INTERFACE_PROP_WHITE_LIST_ENTRIES))
 		retval = g_variant_ref_sink(prv_build_wl_entries(settings));
+	else if (!strcmp(prop, DLD_INTERFACE_PROP_MAX_DEVICE_ACTIONS))
+		retval = g_variant_ref_sink(g_variant_new_uint32(
+				dld_scheduler_get_max_device_actions(
+							manager->scheduler)));
+	else if (!strcmp(prop, DLD_INTERFACE_PROP_QUEUED_ACTIONS))
+		retval = g_variant_ref_sink(g_variant_new_uint32(
+				dld_scheduler_get_queued_count(
+							manager->scheduler)));
+	else if (!strcmp(prop, DLD_INTERFACE_PROP_RUNNING_ACTIONS))
+		retval = g_variant_ref_sink(g_variant_new_uint32(
+				dld_scheduler_get_running_count(
+							manager->scheduler)));
 
 #if DLEYNA_LOG_LEVEL & DLEYNA_LOG_LEVEL_DEBUG
 	if (retval) {
@@ -120,7 +151,8 @@ static void prv_wl_notify_prop(dld_manager_t *manager,
 }
 
 dld_manager_t *dld_manager_new(dleyna_connector_id_t connection,
-			       GUPnPContextManager *connection_manager)
+			       GUPnPContextManager *connection_manager,
+			       dld_scheduler_t *scheduler)
 {
 	dld_manager_t *manager = g_new0(dld_manager_t, 1);
 	GUPnPWhiteList *gupnp_wl;
@@ -129,6 +161,7 @@ dld_manager_t *dld_manager_new(dleyna_connector_id_t connection,
 
 	manager->connection = connection;
 	manager->cm = connection_manager;
+	manager->scheduler = scheduler;
 
 	manager->wl = dleyna_white_list_new(gupnp_wl);
 
@@ -168,7 +201,7 @@ void dld_manager_get_all_props(dld_manager_t *manager,
 
 	if (!strcmp(i_name, DLEYNA_DIAGNOSTICS_INTERFACE_MANAGER) ||
 	    !strcmp(i_name, "")) {
-		prv_add_all_props(settings, &vb);
+		prv_add_all_props(manager, settings, &vb);
 
 		cb_data->task.result = g_variant_ref_sink(
 						g_variant_builder_end(&vb));
@@ -204,7 +237,7 @@ void dld_manager_get_prop(dld_manager_t *manager,
 
 	if (!strcmp(i_name, DLEYNA_DIAGNOSTICS_INTERFACE_MANAGER) ||
 	    !strcmp(i_name, "")) {
-		cb_data->task.result = prv_get_prop(settings, name);
+		cb_data->task.result = prv_get_prop(manager, settings, name);
 
 		if (!cb_data->task.result)
 			cb_data->error = g_error_new(
@@ -320,6 +353,47 @@ exit:
 	DLEYNA_LOG_DEBUG("Exit");
 }
 
+static void prv_set_prop_max_device_actions(dld_manager_t *manager,
+					    GVariant *max_actions,
+					    GError **error)
+{
+	guint value;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	if (strcmp(g_variant_get_type_string(max_actions), "u")) {
+		DLEYNA_LOG_WARNING("Invalid parameter type. 'u' expected.");
+
+		*error = g_error_new(DLEYNA_SERVER_ERROR,
+				     DLEYNA_ERROR_BAD_QUERY,
+				     "Invalid parameter type. 'u' expected.");
+		goto exit;
+	}
+
+	value = g_variant_get_uint32(max_actions);
+
+	if (value == 0) {
+		DLEYNA_LOG_WARNING("At least one action must be allowed.");
+
+		*error = g_error_new(DLEYNA_SERVER_ERROR,
+				     DLEYNA_ERROR_BAD_QUERY,
+				     "At least one action must be allowed.");
+		goto exit;
+	}
+
+	if (value == dld_scheduler_get_max_device_actions(manager->scheduler))
+		goto exit;
+
+	/* Not part of dleyna_settings: lasts until the service quits */
+	dld_scheduler_set_max_device_actions(manager->scheduler, value);
+
+	prv_wl_notify_prop(manager, DLD_INTERFACE_PROP_MAX_DEVICE_ACTIONS,
+			   max_actions);
+
+exit:
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
 void dld_manager_set_prop(dld_manager_t *manager,
 			  dleyna_settings_t *settings,
 			  dld_task_t *task,
@@ -359,6 +433,8 @@ void dld_manager_set_prop(dld_manager_t *manager,
 					&error);
 	else if (!strcmp(name, DLD_INTERFACE_PROP_WHITE_LIST_ENTRIES))
 		prv_set_prop_wl_entries(manager, settings, param, &error);
+	else if (!strcmp(name, DLD_INTERFACE_PROP_MAX_DEVICE_ACTIONS))
+		prv_set_prop_max_device_actions(manager, param, &error);
 	else
 		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
 					     DLEYNA_ERROR_UNKNOWN_PROPERTY,
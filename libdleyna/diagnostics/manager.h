@@ -27,13 +27,15 @@
 #include <libdleyna/core/settings.h>
 #include <libgupnp/gupnp-context-manager.h>
 
+#include "server.h"
 #include "task.h"
 
 typedef struct dld_manager_t_ dld_manager_t;
 typedef void (*dld_manager_task_complete_t)(dld_task_t *task, GError *error);
 
 dld_manager_t *dld_manager_new(dleyna_connector_id_t connection,
-			       GUPnPContextManager *connection_manager);
+			       GUPnPContextManager *connection_manager,
+			       dld_scheduler_t *scheduler);
 
 void dld_manager_delete(dld_manager_t *manager);
 
@@ -0,0 +1,416 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include <libdleyna/core/error.h>
+#include <libdleyna/core/log.h>
+
+#include "metrics.h"
+
+#define DLD_METRICS_KEY_QUEUE_WAIT "QueueWait"
+#define DLD_METRICS_KEY_SOAP_TIME "SoapTime"
+#define DLD_METRICS_KEY_REPLY_TIME "ReplyTime"
+#define DLD_METRICS_KEY_ERRORS "Errors"
+#define DLD_METRICS_KEY_CANCELLATIONS "Cancellations"
+#define DLD_METRICS_KEY_EVENTS "Events"
+#define DLD_METRICS_KEY_COUNT "Count"
+#define DLD_METRICS_KEY_SUM "Sum"
+#define DLD_METRICS_KEY_MIN "Min"
+#define DLD_METRICS_KEY_MAX "Max"
+#define DLD_METRICS_KEY_BUCKETS "Buckets"
+#define DLD_METRICS_KEY_TASKS "Tasks"
+#define DLD_METRICS_KEY_TASK_ALLOCATIONS "TaskAllocations"
+#define DLD_METRICS_KEY_STRING_ALLOCATIONS "StringAllocations"
+
+/* Log-linear histograms: every power of two is split into
+ * DLD_METRICS_SUB_BUCKETS linear buckets, up to 2^DLD_METRICS_MAX_EXPONENT
+ * microseconds.  Larger values land in the last bucket. */
+#define DLD_METRICS_SUB_BUCKET_BITS 2
+#define DLD_METRICS_SUB_BUCKETS (1 << DLD_METRICS_SUB_BUCKET_BITS)
+#define DLD_METRICS_MAX_EXPONENT 36
+#define DLD_METRICS_BUCKETS ((DLD_METRICS_MAX_EXPONENT - \
+			      DLD_METRICS_SUB_BUCKET_BITS + 1) * \
+			     DLD_METRICS_SUB_BUCKETS)
+
+enum prv_histogram_type_t_ {
+	PRV_HISTOGRAM_QUEUE_WAIT,
+	PRV_HISTOGRAM_SOAP_TIME,
+	PRV_HISTOGRAM_REPLY_TIME,
+	PRV_HISTOGRAM_MAX
+};
+typedef enum prv_histogram_type_t_ prv_histogram_type_t;
+
+typedef struct prv_histogram_t_ prv_histogram_t;
+struct prv_histogram_t_ {
+	guint64 count;
+	guint64 sum;
+	guint64 min;
+	guint64 max;
+	guint32 buckets[DLD_METRICS_BUCKETS];
+};
+
+typedef struct prv_series_t_ prv_series_t;
+struct prv_series_t_ {
+	prv_histogram_t histograms[PRV_HISTOGRAM_MAX];
+	guint64 errors;
+	guint64 cancellations;
+	guint64 events;
+};
+
+static const gchar *g_histogram_keys[PRV_HISTOGRAM_MAX] = {
+	DLD_METRICS_KEY_QUEUE_WAIT,
+	DLD_METRICS_KEY_SOAP_TIME,
+	DLD_METRICS_KEY_REPLY_TIME
+};
+
+/* Device path -> action name -> prv_series_t */
+static GHashTable *g_metrics;
+
+static const gchar *prv_task_get_action(dld_task_t *task)
+{
+	const gchar *action;
+
+	switch (task->type) {
+	case DLD_TASK_GET_VERSION:
+		action = "GetVersion";
+		break;
+	case DLD_TASK_GET_DEVICES:
+		action = "GetDevices";
+		break;
+	case DLD_TASK_RESCAN:
+		action = "Rescan";
+		break;
+	case DLD_TASK_GET_STATISTICS:
+		action = "GetStatistics";
+		break;
+	case DLD_TASK_GET_ALL_PROPS:
+	case DLD_TASK_MANAGER_GET_ALL_PROPS:
+		action = "GetAll";
+		break;
+	case DLD_TASK_GET_PROP:
+	case DLD_TASK_MANAGER_GET_PROP:
+		action = "Get";
+		break;
+	case DLD_TASK_MANAGER_SET_PROP:
+		action = "Set";
+		break;
+	case DLD_TASK_GET_ICON:
+		action = "GetIcon";
+		break;
+	case DLD_TASK_GET_TEST_INFO:
+		action = "GetTestInfo";
+		break;
+	case DLD_TASK_CANCEL_TEST:
+		action = "CancelTest";
+		break;
+	case DLD_TASK_PING:
+		action = "Ping";
+		break;
+	case DLD_TASK_GET_PING_RESULT:
+		action = "GetPingResult";
+		break;
+	case DLD_TASK_NSLOOKUP:
+		action = "NSLookup";
+		break;
+	case DLD_TASK_GET_NSLOOKUP_RESULT:
+		action = "GetNSLookupResult";
+		break;
+	case DLD_TASK_TRACEROUTE:
+		action = "Traceroute";
+		break;
+	case DLD_TASK_GET_TRACEROUTE_RESULT:
+		action = "GetTracerouteResult";
+		break;
+	case DLD_TASK_BATCH_PING:
+		action = "BatchPing";
+		break;
+	case DLD_TASK_BATCH_NSLOOKUP:
+		action = "BatchNSLookup";
+		break;
+	case DLD_TASK_BATCH_TRACEROUTE:
+		action = "BatchTraceroute";
+		break;
+	default:
+		action = "Unknown";
+		break;
+	}
+
+	return action;
+}
+
+static prv_series_t *prv_series_get(const gchar *path, const gchar *action)
+{
+	GHashTable *device;
+	prv_series_t *series;
+
+	if (!g_metrics)
+		g_metrics = g_hash_table_new_full(
+					g_str_hash, g_str_equal, g_free,
+					(GDestroyNotify)g_hash_table_unref);
+
+	device = g_hash_table_lookup(g_metrics, path);
+	if (!device) {
+		device = g_hash_table_new_full(g_str_hash, g_str_equal,
+					       g_free, g_free);
+		g_hash_table_insert(g_metrics, g_strdup(path), device);
+	}
+
+	series = g_hash_table_lookup(device, action);
+	if (!series) {
+		series = g_new0(prv_series_t, 1);
+		g_hash_table_insert(device, g_strdup(action), series);
+	}
+
+	return series;
+}
+
+static prv_series_t *prv_task_series_get(dld_task_t *task)
+{
+	const gchar *path = task->path ? task->path : DLEYNA_DIAGNOSTICS_OBJECT;
+
+	return prv_series_get(path, prv_task_get_action(task));
+}
+
+static guint prv_bucket_index(guint64 value)
+{
+	guint exponent = DLD_METRICS_SUB_BUCKET_BITS;
+
+	if (value < DLD_METRICS_SUB_BUCKETS)
+		return value;
+
+	while (value >> (exponent + 1))
+		exponent++;
+
+	if (exponent >= DLD_METRICS_MAX_EXPONENT)
+		return DLD_METRICS_BUCKETS - 1;
+
+	return (exponent - DLD_METRICS_SUB_BUCKET_BITS + 1) *
+		DLD_METRICS_SUB_BUCKETS +
+		((value >> (exponent - DLD_METRICS_SUB_BUCKET_BITS)) &
+		 (DLD_METRICS_SUB_BUCKETS - 1));
+}
+
+static guint64 prv_bucket_lower_bound(guint index)
+{
+	guint64 mantissa;
+
+	if (index < DLD_METRICS_SUB_BUCKETS)
+		return index;
+
+	mantissa = DLD_METRICS_SUB_BUCKETS + index % DLD_METRICS_SUB_BUCKETS;
+
+	return mantissa << (index / DLD_METRICS_SUB_BUCKETS - 1);
+}
+
+static void prv_histogram_record(prv_histogram_t *histogram, gint64 usecs)
+{
+	guint64 value = usecs > 0 ? usecs : 0;
+
+	if (!histogram->count || value < histogram->min)
+		histogram->min = value;
+
+	if (value > histogram->max)
+		histogram->max = value;
+
+	histogram->count++;
+	histogram->sum += value;
+	histogram->buckets[prv_bucket_index(value)]++;
+}
+
+static GVariant *prv_histogram_to_variant(const prv_histogram_t *histogram)
+{
+	GVariantBuilder vb;
+	GVariantBuilder buckets_vb;
+	guint i;
+
+	g_variant_builder_init(&buckets_vb, G_VARIANT_TYPE("a(tu)"));
+	for (i = 0; i < DLD_METRICS_BUCKETS; ++i)
+		if (histogram->buckets[i])
+			g_variant_builder_add(&buckets_vb, "(tu)",
+					      prv_bucket_lower_bound(i),
+					      histogram->buckets[i]);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_COUNT,
+			      g_variant_new_uint64(histogram->count));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_SUM,
+			      g_variant_new_uint64(histogram->sum));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_MIN,
+			      g_variant_new_uint64(histogram->min));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_MAX,
+			      g_variant_new_uint64(histogram->max));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_BUCKETS,
+			      g_variant_builder_end(&buckets_vb));
+
+	return g_variant_builder_end(&vb);
+}
+
+static GVariant *prv_series_to_variant(const prv_series_t *series)
+{
+	GVariantBuilder vb;
+	guint i;
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+
+	for (i = 0; i < PRV_HISTOGRAM_MAX; ++i)
+		if (series->histograms[i].count)
+			g_variant_builder_add(&vb, "{sv}", g_histogram_keys[i],
+					      prv_histogram_to_variant(
+						&series->histograms[i]));
+
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_ERRORS,
+			      g_variant_new_uint64(series->errors));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_CANCELLATIONS,
+			      g_variant_new_uint64(series->cancellations));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_EVENTS,
+			      g_variant_new_uint64(series->events));
+
+	return g_variant_builder_end(&vb);
+}
+
+void dld_metrics_task_started(dld_task_t *task)
+{
+	prv_series_t *series;
+
+	if (!task->queued_time)
+		goto on_exit;
+
+	series = prv_task_series_get(task);
+	prv_histogram_record(&series->histograms[PRV_HISTOGRAM_QUEUE_WAIT],
+			     g_get_monotonic_time() - task->queued_time);
+
+on_exit:
+
+	return;
+}
+
+void dld_metrics_task_replied(dld_task_t *task, const GError *error)
+{
+	prv_series_t *series;
+
+	if (!task->queued_time)
+		goto on_exit;
+
+	series = prv_task_series_get(task);
+	prv_histogram_record(&series->histograms[PRV_HISTOGRAM_REPLY_TIME],
+			     g_get_monotonic_time() - task->queued_time);
+
+	if (!error)
+		goto on_exit;
+
+	if (g_error_matches(error, DLEYNA_SERVER_ERROR,
+			    DLEYNA_ERROR_CANCELLED))
+		series->cancellations++;
+	else
+		series->errors++;
+
+on_exit:
+
+	return;
+}
+
+void dld_metrics_action_completed(const gchar *path, const gchar *action,
+				  gint64 begin_time)
+{
+	prv_series_t *series = prv_series_get(path, action);
+
+	prv_histogram_record(&series->histograms[PRV_HISTOGRAM_SOAP_TIME],
+			     g_get_monotonic_time() - begin_time);
+}
+
+void dld_metrics_event_received(const gchar *path, const gchar *variable)
+{
+	prv_series_get(path, variable)->events++;
+}
+
+static GVariant *prv_allocations_to_variant(void)
+{
+	GVariantBuilder vb;
+	dld_task_allocations_t allocations;
+
+	dld_task_get_allocations(&allocations);
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_TASKS,
+			      g_variant_new_uint64(allocations.tasks));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_TASK_ALLOCATIONS,
+			      g_variant_new_uint64(
+					allocations.task_allocations));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_STRING_ALLOCATIONS,
+			      g_variant_new_uint64(
+					allocations.string_allocations));
+
+	return g_variant_builder_end(&vb);
+}
+
+GVariant *dld_metrics_get_statistics(void)
+{
+	GVariantBuilder vb;
+	GVariantBuilder device_vb;
+	GHashTableIter iter;
+	GHashTableIter device_iter;
+	gpointer path;
+	gpointer device;
+	gpointer action;
+	gpointer series;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	g_variant_builder_init(&vb, G_VARIANT_TYPE("a{sv}"));
+	g_variant_builder_add(&vb, "{sv}", DLD_METRICS_KEY_TASKS,
+			      prv_allocations_to_variant());
+
+	if (!g_metrics)
+		goto on_exit;
+
+	g_hash_table_iter_init(&iter, g_metrics);
+	while (g_hash_table_iter_next(&iter, &path, &device)) {
+		g_variant_builder_init(&device_vb, G_VARIANT_TYPE("a{sv}"));
+
+		g_hash_table_iter_init(&device_iter, device);
+		while (g_hash_table_iter_next(&device_iter, &action, &series))
+			g_variant_builder_add(&device_vb, "{sv}", action,
+					      prv_series_to_variant(series));
+
+		g_variant_builder_add(&vb, "{sv}", path,
+				      g_variant_builder_end(&device_vb));
+	}
+
+on_exit:
+
+	DLEYNA_LOG_DEBUG("Exit");
+
+	return g_variant_ref_sink(g_variant_builder_end(&vb));
+}
+
+void dld_metrics_remove_device(const gchar *path)
+{
+	if (g_metrics)
+		(void) g_hash_table_remove(g_metrics, path);
+}
+
+void dld_metrics_delete(void)
+{
+	if (g_metrics) {
+		g_hash_table_unref(g_metrics);
+		g_metrics = NULL;
+	}
+}
@@ -0,0 +1,45 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#ifndef DLD_METRICS_H__
+#define DLD_METRICS_H__
+
+#include <glib.h>
+
+#include "task.h"
+
+void dld_metrics_task_started(dld_task_t *task);
+
+void dld_metrics_task_replied(dld_task_t *task, const GError *error);
+
+void dld_metrics_action_completed(const gchar *path, const gchar *action,
+				  gint64 begin_time);
+
+void dld_metrics_event_received(const gchar *path, const gchar *variable);
+
+GVariant *dld_metrics_get_statistics(void);
+
+void dld_metrics_remove_device(const gchar *path);
+
+void dld_metrics_delete(void);
+
+#endif /* DLD_METRICS_H__ */
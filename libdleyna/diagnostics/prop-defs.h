@@ -27,10 +27,18 @@
 
 #define DLD_INTERFACE_PROPERTIES_CHANGED "PropertiesChanged"
 
+/* Device Signals */
+#define DLD_INTERFACE_TEST_COMPLETED "TestCompleted"
+#define DLD_INTERFACE_TESTS_ADDED "TestsAdded"
+#define DLD_INTERFACE_TESTS_REMOVED "TestsRemoved"
+
 /* Manager Properties */
 #define DLD_INTERFACE_PROP_NEVER_QUIT "NeverQuit"
 #define DLD_INTERFACE_PROP_WHITE_LIST_ENTRIES "WhiteListEntries"
 #define DLD_INTERFACE_PROP_WHITE_LIST_ENABLED "WhiteListEnabled"
+#define DLD_INTERFACE_PROP_MAX_DEVICE_ACTIONS "MaxDeviceActions"
+#define DLD_INTERFACE_PROP_QUEUED_ACTIONS "QueuedActions"
+#define DLD_INTERFACE_PROP_RUNNING_ACTIONS "RunningActions"
 
 #define DLD_INTERFACE_PROP_DEVICE_TYPE "DeviceType"
 #define DLD_INTERFACE_PROP_UDN "UDN"
@@ -0,0 +1,412 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#include <libdleyna/core/error.h>
+#include <libdleyna/core/log.h>
+
+#include "async.h"
+#include "scheduler.h"
+
+typedef struct prv_device_queue_t_ prv_device_queue_t;
+typedef struct prv_client_queue_t_ prv_client_queue_t;
+
+/* A task waiting for, or holding, one of the action slots of a device.
+ * Actions the daemon sends on its own behalf have no task, they are
+ * started through slot_cb instead.
+ */
+typedef struct prv_entry_t_ prv_entry_t;
+struct prv_entry_t_ {
+	dld_scheduler_t *scheduler;
+	dld_task_t *task;
+	dld_upnp_task_complete_t cb;
+	dld_scheduler_slot_cb_t slot_cb;
+	gpointer user_data;
+	prv_device_queue_t *device;
+	prv_client_queue_t *client;
+	gulong cancel_id;
+};
+
+/* Tasks a single task queue is waiting to run on a device */
+struct prv_client_queue_t_ {
+	const dleyna_task_queue_key_t *queue_id;
+	GQueue entries;
+};
+
+struct prv_device_queue_t_ {
+	gchar *path;
+	guint running;
+	GQueue clients;
+	GHashTable *client_map;
+};
+
+struct dld_scheduler_t_ {
+	guint max_device_actions;
+	dld_scheduler_run_t run;
+	gpointer user_data;
+	GHashTable *devices;
+	GHashTable *running;
+	guint queued_count;
+};
+
+static void prv_entry_free(gpointer data)
+{
+	prv_entry_t *entry = data;
+	dld_async_task_t *cb_data = (dld_async_task_t *)entry->task;
+
+	if (entry->cancel_id)
+		g_cancellable_disconnect(cb_data->cancellable,
+					 entry->cancel_id);
+
+	g_free(entry);
+}
+
+static void prv_client_queue_free(gpointer data)
+{
+	prv_client_queue_t *client = data;
+	prv_entry_t *entry;
+
+	while ((entry = g_queue_pop_head(&client->entries)) != NULL)
+		prv_entry_free(entry);
+
+	g_free(client);
+}
+
+static prv_device_queue_t *prv_device_queue_new(const gchar *path)
+{
+	prv_device_queue_t *device = g_new0(prv_device_queue_t, 1);
+
+	device->path = g_strdup(path);
+	g_queue_init(&device->clients);
+	device->client_map = g_hash_table_new_full(g_direct_hash,
+						   g_direct_equal, NULL,
+						   prv_client_queue_free);
+
+	return device;
+}
+
+static void prv_device_queue_free(gpointer data)
+{
+	prv_device_queue_t *device = data;
+
+	g_queue_clear(&device->clients);
+	g_hash_table_unref(device->client_map);
+	g_free(device->path);
+	g_free(device);
+}
+
+static void prv_device_queue_release(dld_scheduler_t *scheduler,
+				     prv_device_queue_t *device)
+{
+	if (!device->running && g_queue_is_empty(&device->clients))
+		(void) g_hash_table_remove(scheduler->devices, device->path);
+}
+
+static void prv_client_queue_remove(prv_device_queue_t *device,
+				    prv_client_queue_t *client)
+{
+	g_queue_remove(&device->clients, client);
+	(void) g_hash_table_remove(device->client_map, client->queue_id);
+}
+
+/* Clients take turns: each gets one task started before the next one */
+static prv_entry_t *prv_device_queue_pop(prv_device_queue_t *device)
+{
+	prv_client_queue_t *client;
+	prv_entry_t *entry;
+
+	client = g_queue_pop_head(&device->clients);
+	entry = g_queue_pop_head(&client->entries);
+
+	if (g_queue_is_empty(&client->entries))
+		(void) g_hash_table_remove(device->client_map,
+					   client->queue_id);
+	else
+		g_queue_push_tail(&device->clients, client);
+
+	entry->client = NULL;
+
+	return entry;
+}
+
+static void prv_entry_start(dld_scheduler_t *scheduler, prv_entry_t *entry)
+{
+	dld_async_task_t *cb_data = (dld_async_task_t *)entry->task;
+
+	if (entry->cancel_id) {
+		g_cancellable_disconnect(cb_data->cancellable,
+					 entry->cancel_id);
+		entry->cancel_id = 0;
+	}
+
+	entry->device->running++;
+
+	if (entry->task) {
+		g_hash_table_insert(scheduler->running, entry->task, entry);
+		scheduler->run(entry->task, scheduler->user_data);
+	} else {
+		g_hash_table_insert(scheduler->running, entry, entry);
+		entry->slot_cb(entry->user_data);
+	}
+}
+
+static void prv_device_queue_pump(dld_scheduler_t *scheduler,
+				  prv_device_queue_t *device)
+{
+	while (device->running < scheduler->max_device_actions &&
+	       !g_queue_is_empty(&device->clients)) {
+		scheduler->queued_count--;
+		prv_entry_start(scheduler, prv_device_queue_pop(device));
+	}
+}
+
+static void prv_entry_cancelled(GCancellable *cancellable, gpointer user_data)
+{
+	prv_entry_t *entry = user_data;
+	dld_scheduler_t *scheduler = entry->scheduler;
+	prv_device_queue_t *device = entry->device;
+	prv_client_queue_t *client = entry->client;
+	dld_async_task_t *cb_data = (dld_async_task_t *)entry->task;
+
+	DLEYNA_LOG_DEBUG("Queued task cancelled on %s", device->path);
+
+	g_queue_remove(&client->entries, entry);
+	if (g_queue_is_empty(&client->entries))
+		prv_client_queue_remove(device, client);
+
+	scheduler->queued_count--;
+
+	cb_data->cb = entry->cb;
+	if (!cb_data->error)
+		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
+					     DLEYNA_ERROR_CANCELLED,
+					     "Operation cancelled.");
+
+	(void) g_idle_add(dld_async_task_complete, cb_data);
+
+	/* Cannot disconnect from within the handler itself */
+	entry->cancel_id = 0;
+	prv_entry_free(entry);
+
+	prv_device_queue_release(scheduler, device);
+}
+
+dld_scheduler_t *dld_scheduler_new(guint max_device_actions,
+				   dld_scheduler_run_t run,
+				   gpointer user_data)
+{
+	dld_scheduler_t *scheduler = g_new0(dld_scheduler_t, 1);
+
+	scheduler->max_device_actions = max_device_actions;
+	scheduler->run = run;
+	scheduler->user_data = user_data;
+	scheduler->devices = g_hash_table_new_full(g_str_hash, g_str_equal,
+						   NULL,
+						   prv_device_queue_free);
+	scheduler->running = g_hash_table_new_full(g_direct_hash,
+						   g_direct_equal, NULL,
+						   prv_entry_free);
+
+	return scheduler;
+}
+
+void dld_scheduler_delete(dld_scheduler_t *scheduler)
+{
+	if (scheduler) {
+		g_hash_table_unref(scheduler->running);
+		g_hash_table_unref(scheduler->devices);
+		g_free(scheduler);
+	}
+}
+
+/* Starts 'entry' or queues it behind the other clients of the device.
+ * Returns TRUE if it was queued.
+ */
+static gboolean prv_entry_submit(dld_scheduler_t *scheduler,
+				 const gchar *path,
+				 const dleyna_task_queue_key_t *queue_id,
+				 prv_entry_t *entry)
+{
+	prv_device_queue_t *device;
+	prv_client_queue_t *client;
+
+	device = g_hash_table_lookup(scheduler->devices, path);
+	if (!device) {
+		device = prv_device_queue_new(path);
+		g_hash_table_insert(scheduler->devices, device->path, device);
+	}
+
+	entry->scheduler = scheduler;
+	entry->device = device;
+
+	if (device->running < scheduler->max_device_actions &&
+	    g_queue_is_empty(&device->clients)) {
+		prv_entry_start(scheduler, entry);
+		return FALSE;
+	}
+
+	client = g_hash_table_lookup(device->client_map, queue_id);
+	if (!client) {
+		client = g_new0(prv_client_queue_t, 1);
+		client->queue_id = queue_id;
+		g_queue_init(&client->entries);
+
+		g_hash_table_insert(device->client_map,
+				    (gpointer)client->queue_id, client);
+		g_queue_push_tail(&device->clients, client);
+	}
+
+	entry->client = client;
+	g_queue_push_tail(&client->entries, entry);
+	scheduler->queued_count++;
+
+	DLEYNA_LOG_DEBUG("%u actions running on %s, action queued",
+			 device->running, device->path);
+
+	return TRUE;
+}
+
+void dld_scheduler_submit(dld_scheduler_t *scheduler, dld_task_t *task,
+			  dld_upnp_task_complete_t cb)
+{
+	dld_async_task_t *cb_data = (dld_async_task_t *)task;
+	prv_entry_t *entry;
+
+	if (g_cancellable_is_cancelled(cb_data->cancellable)) {
+		cb_data->cb = cb;
+		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
+					     DLEYNA_ERROR_CANCELLED,
+					     "Operation cancelled.");
+		(void) g_idle_add(dld_async_task_complete, cb_data);
+
+		goto on_exit;
+	}
+
+	entry = g_new0(prv_entry_t, 1);
+	entry->task = task;
+	entry->cb = cb;
+
+	if (prv_entry_submit(scheduler, task->path, task->atom.queue_id,
+			     entry))
+		entry->cancel_id = g_cancellable_connect(
+						cb_data->cancellable,
+						G_CALLBACK(prv_entry_cancelled),
+						entry, NULL);
+
+on_exit:
+
+	return;
+}
+
+/* The daemon's own actions take turns with the clients, as one more
+ * client of the device.  'cb' may be called before this returns.
+ */
+dld_scheduler_slot_t *dld_scheduler_acquire(dld_scheduler_t *scheduler,
+					    const gchar *path,
+					    dld_scheduler_slot_cb_t cb,
+					    gpointer user_data)
+{
+	prv_entry_t *entry;
+
+	entry = g_new0(prv_entry_t, 1);
+	entry->slot_cb = cb;
+	entry->user_data = user_data;
+
+	(void) prv_entry_submit(scheduler, path, NULL, entry);
+
+	return (dld_scheduler_slot_t *)entry;
+}
+
+/* Gives a started slot back, or withdraws one that is still queued */
+void dld_scheduler_release(dld_scheduler_t *scheduler,
+			   dld_scheduler_slot_t *slot)
+{
+	prv_entry_t *entry = (prv_entry_t *)slot;
+	prv_device_queue_t *device = entry->device;
+	prv_client_queue_t *client = entry->client;
+
+	if (client) {
+		g_queue_remove(&client->entries, entry);
+		if (g_queue_is_empty(&client->entries))
+			prv_client_queue_remove(device, client);
+
+		scheduler->queued_count--;
+		prv_entry_free(entry);
+	} else {
+		(void) g_hash_table_remove(scheduler->running, entry);
+		device->running--;
+
+		prv_device_queue_pump(scheduler, device);
+	}
+
+	prv_device_queue_release(scheduler, device);
+}
+
+void dld_scheduler_task_done(dld_scheduler_t *scheduler, dld_task_t *task,
+			     GError *error)
+{
+	prv_entry_t *entry;
+	prv_device_queue_t *device;
+	dld_upnp_task_complete_t cb;
+
+	entry = g_hash_table_lookup(scheduler->running, task);
+	device = entry->device;
+	cb = entry->cb;
+
+	(void) g_hash_table_remove(scheduler->running, task);
+	device->running--;
+
+	/* Hand the slot over before the task queue can submit again */
+	prv_device_queue_pump(scheduler, device);
+	prv_device_queue_release(scheduler, device);
+
+	cb(task, error);
+}
+
+guint dld_scheduler_get_max_device_actions(dld_scheduler_t *scheduler)
+{
+	return scheduler->max_device_actions;
+}
+
+void dld_scheduler_set_max_device_actions(dld_scheduler_t *scheduler,
+					  guint max_device_actions)
+{
+	GHashTableIter iter;
+	gpointer value;
+
+	DLEYNA_LOG_DEBUG("Max device actions: %u", max_device_actions);
+
+	scheduler->max_device_actions = max_device_actions;
+
+	g_hash_table_iter_init(&iter, scheduler->devices);
+	while (g_hash_table_iter_next(&iter, NULL, &value))
+		prv_device_queue_pump(scheduler, value);
+}
+
+guint dld_scheduler_get_queued_count(dld_scheduler_t *scheduler)
+{
+	return scheduler->queued_count;
+}
+
+guint dld_scheduler_get_running_count(dld_scheduler_t *scheduler)
+{
+	return g_hash_table_size(scheduler->running);
+}
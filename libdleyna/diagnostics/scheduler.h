@@ -0,0 +1,67 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ * Mark Ryan <mark.d.ryan@intel.com>
+ *
+ */
+
+#ifndef DLD_SCHEDULER_H__
+#define DLD_SCHEDULER_H__
+
+#include <glib.h>
+
+#include "server.h"
+#include "task.h"
+#include "upnp.h"
+
+typedef struct dld_scheduler_slot_t_ dld_scheduler_slot_t;
+
+typedef void (*dld_scheduler_run_t)(dld_task_t *task, gpointer user_data);
+
+typedef void (*dld_scheduler_slot_cb_t)(gpointer user_data);
+
+dld_scheduler_t *dld_scheduler_new(guint max_device_actions,
+				   dld_scheduler_run_t run,
+				   gpointer user_data);
+
+void dld_scheduler_delete(dld_scheduler_t *scheduler);
+
+void dld_scheduler_submit(dld_scheduler_t *scheduler, dld_task_t *task,
+			  dld_upnp_task_complete_t cb);
+
+void dld_scheduler_task_done(dld_scheduler_t *scheduler, dld_task_t *task,
+			     GError *error);
+
+dld_scheduler_slot_t *dld_scheduler_acquire(dld_scheduler_t *scheduler,
+					    const gchar *path,
+					    dld_scheduler_slot_cb_t cb,
+					    gpointer user_data);
+
+void dld_scheduler_release(dld_scheduler_t *scheduler,
+			   dld_scheduler_slot_t *slot);
+
+guint dld_scheduler_get_max_device_actions(dld_scheduler_t *scheduler);
+
+void dld_scheduler_set_max_device_actions(dld_scheduler_t *scheduler,
+					  guint max_device_actions);
+
+guint dld_scheduler_get_queued_count(dld_scheduler_t *scheduler);
+
+guint dld_scheduler_get_running_count(dld_scheduler_t *scheduler);
+
+#endif /* DLD_SCHEDULER_H__ */
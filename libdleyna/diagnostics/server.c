@@ -40,6 +40,7 @@
 #include "control-point-diagnostics.h"
 #include "device.h"
 #include "manager.h"
+#include "metrics.h"
 #include "prop-defs.h"
 #include "server.h"
 #include "upnp.h"
@@ -53,13 +54,18 @@
 #define DLD_INTERFACE_GET_VERSION "GetVersion"
 #define DLD_INTERFACE_GET_DEVICES "GetDevices"
 #define DLD_INTERFACE_RESCAN "Rescan"
+#define DLD_INTERFACE_GET_STATISTICS "GetStatistics"
 #define DLD_INTERFACE_RELEASE "Release"
+#define DLD_INTERFACE_BATCH_PING "BatchPing"
+#define DLD_INTERFACE_BATCH_NSLOOKUP "BatchNSLookup"
+#define DLD_INTERFACE_BATCH_TRACEROUTE "BatchTraceroute"
 
 #define DLD_INTERFACE_FOUND_DEVICE "FoundDevice"
 #define DLD_INTERFACE_LOST_DEVICE "LostDevice"
 
 #define DLD_INTERFACE_VERSION "Version"
 #define DLD_INTERFACE_DEVICES "Devices"
+#define DLD_INTERFACE_STATISTICS "Statistics"
 
 #define DLD_INTERFACE_PATH "Path"
 
@@ -110,6 +116,8 @@
 #define DLD_INTERFACE_NSLOOKUP_RESULT "NSLookupResult"
 #define DLD_INTERFACE_RESPONSE_TIME "ResponseTime"
 #define DLD_INTERFACE_HOP_HOSTS "HopHosts"
+#define DLD_INTERFACE_TEST_RESULT "Result"
+#define DLD_INTERFACE_TEST_IDS "TestIds"
 
 enum dld_manager_interface_type_ {
 	DLD_MANAGER_INTERFACE_MANAGER,
@@ -117,6 +125,14 @@ enum dld_manager_interface_type_ {
 	DLD_MANAGER_INTERFACE_INFO_MAX
 };
 
+typedef struct prv_method_t_ prv_method_t;
+struct prv_method_t_ {
+	const gchar *name;
+	dld_task_type_t type;
+	dld_task_new_t task_new;
+	dld_upnp_task_run_t run;
+};
+
 typedef struct dld_context_t_ dld_context_t;
 struct dld_context_t_ {
 	guint dld_id[DLD_MANAGER_INTERFACE_INFO_MAX];
@@ -146,6 +162,56 @@ static const gchar g_root_introspection[] =
 	"    </method>"
 	"    <method name='"DLD_INTERFACE_RESCAN"'>"
 	"    </method>"
+	"    <method name='"DLD_INTERFACE_GET_STATISTICS"'>"
+	"      <arg type='a{sv}' name='"DLD_INTERFACE_STATISTICS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"DLD_INTERFACE_BATCH_PING"'>"
+	"      <arg type='ao' name='"DLD_INTERFACE_DEVICES"'"
+	"           direction='in'/>"
+	"      <arg type='s' name='"DLD_INTERFACE_HOST"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_REPEAT_COUNT"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_INTERVAL"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_DATA_BLOCK_SIZE"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_DSCP"'"
+	"           direction='in'/>"
+	"      <arg type='a{ou}' name='"DLD_INTERFACE_TEST_IDS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"DLD_INTERFACE_BATCH_NSLOOKUP"'>"
+	"      <arg type='ao' name='"DLD_INTERFACE_DEVICES"'"
+	"           direction='in'/>"
+	"      <arg type='s' name='"DLD_INTERFACE_HOSTNAME"'"
+	"           direction='in'/>"
+	"      <arg type='s' name='"DLD_INTERFACE_DNS_SERVER"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_REPEAT_COUNT"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_INTERVAL"'"
+	"           direction='in'/>"
+	"      <arg type='a{ou}' name='"DLD_INTERFACE_TEST_IDS"'"
+	"           direction='out'/>"
+	"    </method>"
+	"    <method name='"DLD_INTERFACE_BATCH_TRACEROUTE"'>"
+	"      <arg type='ao' name='"DLD_INTERFACE_DEVICES"'"
+	"           direction='in'/>"
+	"      <arg type='s' name='"DLD_INTERFACE_HOST"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_TIMEOUT"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_DATA_BLOCK_SIZE"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_MAX_HOP_COUNT"'"
+	"           direction='in'/>"
+	"      <arg type='u' name='"DLD_INTERFACE_DSCP"'"
+	"           direction='in'/>"
+	"      <arg type='a{ou}' name='"DLD_INTERFACE_TEST_IDS"'"
+	"           direction='out'/>"
+	"    </method>"
 	"    <signal name='"DLD_INTERFACE_FOUND_DEVICE"'>"
 	"      <arg type='o' name='"DLD_INTERFACE_PATH"'/>"
 	"    </signal>"
@@ -158,6 +224,12 @@ static const gchar g_root_introspection[] =
 	"       access='readwrite'/>"
 	"    <property type='b' name='"DLD_INTERFACE_PROP_WHITE_LIST_ENABLED"'"
 	"       access='readwrite'/>"
+	"    <property type='u' name='"DLD_INTERFACE_PROP_MAX_DEVICE_ACTIONS"'"
+	"       access='readwrite'/>"
+	"    <property type='u' name='"DLD_INTERFACE_PROP_QUEUED_ACTIONS"'"
+	"       access='read'/>"
+	"    <property type='u' name='"DLD_INTERFACE_PROP_RUNNING_ACTIONS"'"
+	"       access='read'/>"
 	"  </interface>"
 	"  <interface name='"DLD_INTERFACE_PROPERTIES"'>"
 	"    <method name='"DLD_INTERFACE_GET"'>"
@@ -320,6 +392,19 @@ static const gchar g_diagnostics_device_introspection[] =
 	"      <arg type='as' name='"DLD_INTERFACE_HOP_HOSTS"'"
 	"           direction='out'/>"
 	"    </method>"
+	"    <signal name='"DLD_INTERFACE_TEST_COMPLETED"'>"
+	"      <arg type='u' name='"DLD_INTERFACE_TEST_ID"'/>"
+	"      <arg type='s' name='"DLD_INTERFACE_TEST_TYPE"'/>"
+	"      <arg type='v' name='"DLD_INTERFACE_TEST_RESULT"'/>"
+	"    </signal>"
+	"    <signal name='"DLD_INTERFACE_TESTS_ADDED"'>"
+	"      <arg type='s' name='"DLD_INTERFACE_PROPERTY_NAME"'/>"
+	"      <arg type='au' name='"DLD_INTERFACE_TEST_IDS"'/>"
+	"    </signal>"
+	"    <signal name='"DLD_INTERFACE_TESTS_REMOVED"'>"
+	"      <arg type='s' name='"DLD_INTERFACE_PROPERTY_NAME"'/>"
+	"      <arg type='au' name='"DLD_INTERFACE_TEST_IDS"'/>"
+	"    </signal>"
 	"    <property type='s' name='"DLD_INTERFACE_PROP_DEVICE_TYPE"'"
 	"       access='read'/>"
 	"    <property type='s' name='"DLD_INTERFACE_PROP_UDN"'"
@@ -432,36 +517,7 @@ dld_upnp_t *dld_diagnostics_service_get_upnp(void)
 	return g_context.upnp;
 }
 
-static void prv_process_sync_task(dld_task_t *task)
-{
-	GError *error;
-
-	switch (task->type) {
-	case DLD_TASK_GET_VERSION:
-		task->result = g_variant_ref_sink(g_variant_new_string(
-								VERSION));
-		dld_task_complete(task);
-		break;
-	case DLD_TASK_GET_DEVICES:
-		task->result = dld_upnp_get_device_ids(g_context.upnp);
-		dld_task_complete(task);
-		break;
-	case DLD_TASK_RESCAN:
-		dld_upnp_rescan(g_context.upnp);
-		dld_task_complete(task);
-		break;
-	default:
-		goto finished;
-		break;
-	}
-
-	dleyna_task_queue_task_completed(task->atom.queue_id);
-
-finished:
-	return;
-}
-
-static void prv_async_task_complete(dld_task_t *task, GError *error)
+static void prv_task_complete(dld_task_t *task, GError *error)
 {
 	DLEYNA_LOG_DEBUG("Enter");
 
@@ -477,86 +533,149 @@ static void prv_async_task_complete(dld_task_t *task, GError *error)
 	DLEYNA_LOG_DEBUG("Exit");
 }
 
-static void prv_process_async_task(dld_task_t *task)
+static void prv_get_version(dld_upnp_t *upnp, dld_task_t *task,
+			    dld_upnp_task_complete_t cb)
 {
-	dld_async_task_t *async_task = (dld_async_task_t *)task;
+	cb(task, NULL);
+}
 
-	DLEYNA_LOG_DEBUG("Enter");
+static void prv_get_devices(dld_upnp_t *upnp, dld_task_t *task,
+			    dld_upnp_task_complete_t cb)
+{
+	task->result = dld_upnp_get_device_ids(upnp);
+	cb(task, NULL);
+}
+
+static void prv_rescan(dld_upnp_t *upnp, dld_task_t *task,
+		       dld_upnp_task_complete_t cb)
+{
+	dld_upnp_rescan(upnp);
+	cb(task, NULL);
+}
+
+static void prv_get_statistics(dld_upnp_t *upnp, dld_task_t *task,
+			       dld_upnp_task_complete_t cb)
+{
+	task->result = dld_metrics_get_statistics();
+	cb(task, NULL);
+}
+
+static void prv_manager_get_prop(dld_upnp_t *upnp, dld_task_t *task,
+				 dld_upnp_task_complete_t cb)
+{
+	dld_manager_get_prop(g_context.manager, g_context.settings, task, cb);
+}
+
+static void prv_manager_get_all_props(dld_upnp_t *upnp, dld_task_t *task,
+				      dld_upnp_task_complete_t cb)
+{
+	dld_manager_get_all_props(g_context.manager, g_context.settings, task,
+				  cb);
+}
+
+static void prv_manager_set_prop(dld_upnp_t *upnp, dld_task_t *task,
+				 dld_upnp_task_complete_t cb)
+{
+	dld_manager_set_prop(g_context.manager, g_context.settings, task, cb);
+}
+
+/* The rows of each table MUST be sorted by name, for prv_method_lookup */
+static const prv_method_t g_manager_methods[] = {
+	{ DLD_INTERFACE_BATCH_NSLOOKUP, DLD_TASK_BATCH_NSLOOKUP,
+	  dld_task_batch_nslookup_new, dld_upnp_batch_nslookup },
+	{ DLD_INTERFACE_BATCH_PING, DLD_TASK_BATCH_PING,
+	  dld_task_batch_ping_new, dld_upnp_batch_ping },
+	{ DLD_INTERFACE_BATCH_TRACEROUTE, DLD_TASK_BATCH_TRACEROUTE,
+	  dld_task_batch_traceroute_new, dld_upnp_batch_traceroute },
+	{ DLD_INTERFACE_GET_DEVICES, DLD_TASK_GET_DEVICES,
+	  dld_task_get_devices_new, prv_get_devices },
+	{ DLD_INTERFACE_GET_STATISTICS, DLD_TASK_GET_STATISTICS,
+	  dld_task_get_statistics_new, prv_get_statistics },
+	{ DLD_INTERFACE_GET_VERSION, DLD_TASK_GET_VERSION,
+	  dld_task_get_version_new, prv_get_version },
+	{ DLD_INTERFACE_RESCAN, DLD_TASK_RESCAN,
+	  dld_task_rescan_new, prv_rescan }
+};
+
+static const prv_method_t g_manager_props_methods[] = {
+	{ DLD_INTERFACE_GET, DLD_TASK_MANAGER_GET_PROP,
+	  dld_task_manager_get_prop_new, prv_manager_get_prop },
+	{ DLD_INTERFACE_GET_ALL, DLD_TASK_MANAGER_GET_ALL_PROPS,
+	  dld_task_manager_get_props_new, prv_manager_get_all_props },
+	{ DLD_INTERFACE_SET, DLD_TASK_MANAGER_SET_PROP,
+	  dld_task_manager_set_prop_new, prv_manager_set_prop }
+};
 
-	async_task->cancellable = g_cancellable_new();
-
-	switch (task->type) {
-	case DLD_TASK_GET_PROP:
-		dld_upnp_get_prop(g_context.upnp, task,
-				  prv_async_task_complete);
-		break;
-	case DLD_TASK_GET_ALL_PROPS:
-		dld_upnp_get_all_props(g_context.upnp, task,
-				       prv_async_task_complete);
-		break;
-	case DLD_TASK_GET_ICON:
-		dld_upnp_get_icon(g_context.upnp, task,
-				  prv_async_task_complete);
-		break;
-	case DLD_TASK_MANAGER_GET_PROP:
-		dld_manager_get_prop(g_context.manager, g_context.settings,
-				     task, prv_async_task_complete);
-		break;
-	case DLD_TASK_MANAGER_GET_ALL_PROPS:
-		dld_manager_get_all_props(g_context.manager, g_context.settings,
-					  task, prv_async_task_complete);
-		break;
-	case DLD_TASK_MANAGER_SET_PROP:
-		dld_manager_set_prop(g_context.manager, g_context.settings,
-				     task, prv_async_task_complete);
-		break;
-	case DLD_TASK_GET_TEST_INFO:
-		dld_upnp_get_test_info(g_context.upnp, task,
-				       prv_async_task_complete);
-		break;
-	case DLD_TASK_CANCEL_TEST:
-		dld_upnp_cancel_test(g_context.upnp, task,
-				     prv_async_task_complete);
-		break;
-	case DLD_TASK_PING:
-		dld_upnp_ping(g_context.upnp, task,
-			      prv_async_task_complete);
-		break;
-	case DLD_TASK_GET_PING_RESULT:
-		dld_upnp_get_ping_result(g_context.upnp, task,
-					 prv_async_task_complete);
-		break;
-	case DLD_TASK_NSLOOKUP:
-		dld_upnp_nslookup(g_context.upnp, task,
-				  prv_async_task_complete);
-		break;
-	case DLD_TASK_GET_NSLOOKUP_RESULT:
-		dld_upnp_get_nslookup_result(g_context.upnp, task,
-					     prv_async_task_complete);
-		break;
-	case DLD_TASK_TRACEROUTE:
-		dld_upnp_traceroute(g_context.upnp, task,
-				    prv_async_task_complete);
-		break;
-	case DLD_TASK_GET_TRACEROUTE_RESULT:
-		dld_upnp_get_traceroute_result(g_context.upnp, task,
-					       prv_async_task_complete);
-		break;
-	default:
-		break;
+static const prv_method_t g_props_methods[] = {
+	{ DLD_INTERFACE_GET, DLD_TASK_GET_PROP,
+	  dld_task_get_prop_new, dld_upnp_get_prop },
+	{ DLD_INTERFACE_GET_ALL, DLD_TASK_GET_ALL_PROPS,
+	  dld_task_get_props_new, dld_upnp_get_all_props }
+};
+
+static const prv_method_t g_device_methods[] = {
+	{ DLD_INTERFACE_CANCEL_TEST, DLD_TASK_CANCEL_TEST,
+	  dld_task_cancel_test_new, dld_upnp_cancel_test },
+	{ DLD_INTERFACE_GET_ICON, DLD_TASK_GET_ICON,
+	  dld_task_get_icon_new, dld_upnp_get_icon },
+	{ DLD_INTERFACE_GET_NSLOOKUP_RESULT, DLD_TASK_GET_NSLOOKUP_RESULT,
+	  dld_task_get_nslookup_result_new, dld_upnp_get_nslookup_result },
+	{ DLD_INTERFACE_GET_PING_RESULT, DLD_TASK_GET_PING_RESULT,
+	  dld_task_get_ping_result_new, dld_upnp_get_ping_result },
+	{ DLD_INTERFACE_GET_TEST_INFO, DLD_TASK_GET_TEST_INFO,
+	  dld_task_get_test_info_new, dld_upnp_get_test_info },
+	{ DLD_INTERFACE_GET_TRACEROUTE_RESULT, DLD_TASK_GET_TRACEROUTE_RESULT,
+	  dld_task_get_traceroute_result_new, dld_upnp_get_traceroute_result },
+	{ DLD_INTERFACE_NSLOOKUP, DLD_TASK_NSLOOKUP,
+	  dld_task_nslookup_new, dld_upnp_nslookup },
+	{ DLD_INTERFACE_PING, DLD_TASK_PING,
+	  dld_task_ping_new, dld_upnp_ping },
+	{ DLD_INTERFACE_TRACEROUTE, DLD_TASK_TRACEROUTE,
+	  dld_task_traceroute_new, dld_upnp_traceroute }
+};
+
+/* Indexed by task type, filled from the tables above */
+static const prv_method_t *g_task_methods[DLD_TASK_MAX];
+
+static void prv_method_table_index(const prv_method_t *methods, gsize count)
+{
+	gsize i;
+
+	for (i = 0; i < count; ++i) {
+		g_assert(!i ||
+			 strcmp(methods[i - 1].name, methods[i].name) < 0);
+		g_task_methods[methods[i].type] = &methods[i];
 	}
+}
 
-	DLEYNA_LOG_DEBUG("Exit");
+static int prv_method_cmp(const void *name, const void *method)
+{
+	return strcmp(name, ((const prv_method_t *)method)->name);
+}
+
+static const prv_method_t *prv_method_lookup(const prv_method_t *methods,
+					     gsize count, const gchar *name)
+{
+	return bsearch(name, methods, count, sizeof(*methods),
+		       prv_method_cmp);
 }
 
 static void prv_process_task(dleyna_task_atom_t *task, gpointer user_data)
 {
 	dld_task_t *client_task = (dld_task_t *)task;
+	dld_async_task_t *async_task = (dld_async_task_t *)task;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	dld_metrics_task_started(client_task);
 
-	if (client_task->synchronous)
-		prv_process_sync_task(client_task);
-	else
-		prv_process_async_task(client_task);
+	if (!client_task->synchronous)
+		async_task->cancellable = g_cancellable_new();
+
+	g_task_methods[client_task->type]->run(g_context.upnp, client_task,
+					       prv_task_complete);
+
+	DLEYNA_LOG_DEBUG("Exit");
 }
 
 static void prv_cancel_task(dleyna_task_atom_t *task, gpointer user_data)
@@ -597,6 +716,14 @@ static void prv_control_point_initialize(const dleyna_connector_t *connector,
 	g_context.connector = connector;
 	g_context.connector->set_client_lost_cb(prv_lost_client);
 
+	prv_method_table_index(g_manager_methods,
+			       G_N_ELEMENTS(g_manager_methods));
+	prv_method_table_index(g_manager_props_methods,
+			       G_N_ELEMENTS(g_manager_props_methods));
+	prv_method_table_index(g_props_methods, G_N_ELEMENTS(g_props_methods));
+	prv_method_table_index(g_device_methods,
+			       G_N_ELEMENTS(g_device_methods));
+
 	g_set_prgname(DLD_PRG_NAME);
 }
 
@@ -609,6 +736,9 @@ static void prv_control_point_stop_service(void)
 		dld_upnp_delete(g_context.upnp);
 	}
 
+	dld_metrics_delete();
+	dld_task_pool_delete();
+
 	if (g_context.connection) {
 		for (i = 0; i < DLD_MANAGER_INTERFACE_INFO_MAX; i++)
 			if (g_context.dld_id[i])
@@ -642,40 +772,42 @@ static void prv_add_task(dld_task_t *task, const gchar *source,
 					prv_cancel_task,
 					prv_delete_task);
 
+	task->queued_time = g_get_monotonic_time();
 	dleyna_task_queue_add_task(queue_id, &task->atom);
 }
 
+static void prv_method_dispatch(const prv_method_t *methods, gsize count,
+				const gchar *sender, const gchar *sink,
+				const gchar *object, const gchar *method,
+				GVariant *parameters,
+				dleyna_connector_msg_id_t invocation)
+{
+	const prv_method_t *entry;
+
+	entry = prv_method_lookup(methods, count, method);
+	if (entry)
+		prv_add_task(entry->task_new(invocation, object, parameters),
+			     sender, sink);
+}
+
 static void prv_manager_root_method_call(dleyna_connector_id_t conn,
 				const gchar *sender, const gchar *object,
 				const gchar *interface,
 				const gchar *method, GVariant *parameters,
 				dleyna_connector_msg_id_t invocation)
 {
-	dld_task_t *task;
-
 	DLEYNA_LOG_INFO("Calling %s method", method);
 
 	if (!strcmp(method, DLD_INTERFACE_RELEASE)) {
 		g_context.connector->unwatch_client(sender);
 		prv_remove_client(sender);
 		g_context.connector->return_response(invocation, NULL);
-
-		goto finished;
-	} else  {
-		if (!strcmp(method, DLD_INTERFACE_GET_VERSION))
-			task = dld_task_get_version_new(invocation);
-		else if (!strcmp(method, DLD_INTERFACE_GET_DEVICES))
-			task = dld_task_get_devices_new(invocation);
-		else if (!strcmp(method, DLD_INTERFACE_RESCAN))
-			task = dld_task_rescan_new(invocation);
-		else
-			goto finished;
+	} else {
+		prv_method_dispatch(g_manager_methods,
+				    G_N_ELEMENTS(g_manager_methods),
+				    sender, DLD_DIAGNOSTICS_SINK, object,
+				    method, parameters, invocation);
 	}
-
-	prv_add_task(task, sender, DLD_DIAGNOSTICS_SINK);
-
-finished:
-	return;
 }
 
 static void prv_manager_props_method_call(dleyna_connector_id_t conn,
@@ -686,33 +818,10 @@ static void prv_manager_props_method_call(dleyna_connector_id_t conn,
 					  GVariant *parameters,
 					  dleyna_connector_msg_id_t invocation)
 {
-	dld_task_t *task;
-	GError *error = NULL;
-
-	if (!strcmp(method, DLD_INTERFACE_GET_ALL))
-		task = dld_task_manager_get_props_new(invocation, object,
-						      parameters, &error);
-	else if (!strcmp(method, DLD_INTERFACE_GET))
-		task = dld_task_manager_get_prop_new(invocation, object,
-						     parameters, &error);
-	else if (!strcmp(method, DLD_INTERFACE_SET))
-		task = dld_task_manager_set_prop_new(invocation, object,
-						     parameters, &error);
-	else
-		goto finished;
-
-	if (!task) {
-		g_context.connector->return_error(invocation, error);
-		g_error_free(error);
-
-		goto finished;
-	}
-
-	prv_add_task(task, sender, task->path);
-
-finished:
-
-	return;
+	prv_method_dispatch(g_manager_props_methods,
+			    G_N_ELEMENTS(g_manager_props_methods),
+			    sender, object, object, method, parameters,
+			    invocation);
 }
 
 static const gchar *prv_get_device_id(const gchar *object, GError **error)
@@ -720,7 +829,7 @@ static const gchar *prv_get_device_id(const gchar *object, GError **error)
 	dld_device_t *device;
 
 	device = dld_device_from_path(object,
-				dld_upnp_get_device_udn_map(g_context.upnp));
+				dld_upnp_get_device_path_map(g_context.upnp));
 
 
 	if (!device) {
@@ -747,7 +856,6 @@ static void prv_props_method_call(dleyna_connector_id_t conn,
 				  GVariant *parameters,
 				  dleyna_connector_msg_id_t invocation)
 {
-	dld_task_t *task;
 	const gchar *device_id;
 	GError *error = NULL;
 
@@ -759,14 +867,9 @@ static void prv_props_method_call(dleyna_connector_id_t conn,
 		goto finished;
 	}
 
-	if (!strcmp(method, DLD_INTERFACE_GET_ALL))
-		task = dld_task_get_props_new(invocation, object, parameters);
-	else if (!strcmp(method, DLD_INTERFACE_GET))
-		task = dld_task_get_prop_new(invocation, object, parameters);
-	else
-		goto finished;
-
-	prv_add_task(task, sender, device_id);
+	prv_method_dispatch(g_props_methods, G_N_ELEMENTS(g_props_methods),
+			    sender, device_id, object, method, parameters,
+			    invocation);
 
 finished:
 
@@ -781,7 +884,6 @@ static void prv_device_method_call(dleyna_connector_id_t conn,
 				   GVariant *parameters,
 				   dleyna_connector_msg_id_t invocation)
 {
-	dld_task_t *task;
 	const gchar *device_id = NULL;
 	GError *error = NULL;
 	const dleyna_task_queue_key_t *queue_id;
@@ -802,38 +904,11 @@ static void prv_device_method_call(dleyna_connector_id_t conn,
 			dleyna_task_processor_cancel_queue(queue_id);
 
 		g_context.connector->return_response(invocation, NULL);
-	} else if (!strcmp(method, DLD_INTERFACE_GET_ICON)) {
-		task = dld_task_get_icon_new(invocation, object, parameters);
-		prv_add_task(task, sender, device_id);
-	} else if (!strcmp(method, DLD_INTERFACE_GET_TEST_INFO)) {
-		task = dld_task_get_test_info_new(invocation, object,
-						  parameters);
-		prv_add_task(task, sender, device_id);
-	} else if (!strcmp(method, DLD_INTERFACE_CANCEL_TEST)) {
-		task = dld_task_cancel_test_new(invocation, object,
-						parameters);
-		prv_add_task(task, sender, device_id);
-	} else if (!strcmp(method, DLD_INTERFACE_PING)) {
-		task = dld_task_ping_new(invocation, object, parameters);
-		prv_add_task(task, sender, device_id);
-	} else if (!strcmp(method, DLD_INTERFACE_GET_PING_RESULT)) {
-		task = dld_task_get_ping_result_new(invocation, object,
-						    parameters);
-		prv_add_task(task, sender, device_id);
-	} else if (!strcmp(method, DLD_INTERFACE_NSLOOKUP)) {
-		task = dld_task_nslookup_new(invocation, object, parameters);
-		prv_add_task(task, sender, device_id);
-	} else if (!strcmp(method, DLD_INTERFACE_GET_NSLOOKUP_RESULT)) {
-		task = dld_task_get_nslookup_result_new(invocation, object,
-							parameters);
-		prv_add_task(task, sender, device_id);
-	} else if (!strcmp(method, DLD_INTERFACE_TRACEROUTE)) {
-		task = dld_task_traceroute_new(invocation, object, parameters);
-		prv_add_task(task, sender, device_id);
-	} else if (!strcmp(method, DLD_INTERFACE_GET_TRACEROUTE_RESULT)) {
-		task = dld_task_get_traceroute_result_new(invocation, object,
-							  parameters);
-		prv_add_task(task, sender, device_id);
+	} else {
+		prv_method_dispatch(g_device_methods,
+				    G_N_ELEMENTS(g_device_methods),
+				    sender, device_id, object, method,
+				    parameters, invocation);
 	}
 
 finished:
@@ -865,6 +940,7 @@ static void prv_lost_diagnostics_device(const gchar *path)
 					   NULL);
 
 	dleyna_task_processor_remove_queues_for_sink(g_context.processor, path);
+	dld_metrics_remove_device(path);
 }
 
 static void prv_white_list_init(void)
@@ -909,7 +985,8 @@ static gboolean prv_control_point_start_service(
 					     prv_lost_diagnostics_device);
 
 		g_context.manager = dld_manager_new(connection,
-			       dld_upnp_get_context_manager(g_context.upnp));
+			       dld_upnp_get_context_manager(g_context.upnp),
+			       dld_upnp_get_scheduler(g_context.upnp));
 
 		prv_white_list_init();
 	} else {
@@ -30,6 +30,8 @@
 
 typedef struct dld_device_t_ dld_device_t;
 typedef struct dld_upnp_t_ dld_upnp_t;
+typedef struct dld_scheduler_t_ dld_scheduler_t;
+typedef struct dld_local_t_ dld_local_t;
 
 dld_upnp_t *dld_diagnostics_service_get_upnp(void);
 
@@ -20,44 +20,158 @@
  *
  */
 
+#include <string.h>
+
 #include <libdleyna/core/error.h>
 #include <libdleyna/core/task-processor.h>
 
 #include "async.h"
+#include "intern.h"
+#include "metrics.h"
 #include "server.h"
 
-dld_task_t *dld_task_rescan_new(dleyna_connector_msg_id_t invocation)
+#define DLD_TASK_POOL_MAX_SIZE 64
+
+/* Released tasks are chained through their first bytes */
+typedef struct prv_task_free_t_ prv_task_free_t;
+struct prv_task_free_t_ {
+	prv_task_free_t *next;
+};
+
+typedef struct prv_task_pool_t_ prv_task_pool_t;
+struct prv_task_pool_t_ {
+	gsize size;
+	prv_task_free_t *head;
+	guint count;
+};
+
+enum prv_task_pool_type_t_ {
+	PRV_TASK_POOL_SYNC,
+	PRV_TASK_POOL_ASYNC,
+	PRV_TASK_POOL_MAX
+};
+
+static prv_task_pool_t g_task_pools[PRV_TASK_POOL_MAX] = {
+	{ sizeof(dld_task_t), NULL, 0 },
+	{ sizeof(dld_async_task_t), NULL, 0 }
+};
+
+static dld_task_allocations_t g_allocations;
+
+static dld_task_t *prv_task_alloc(gboolean synchronous)
+{
+	prv_task_pool_t *pool;
+	prv_task_free_t *entry;
+	dld_task_t *task;
+
+	pool = &g_task_pools[synchronous ? PRV_TASK_POOL_SYNC :
+			     PRV_TASK_POOL_ASYNC];
+	entry = pool->head;
+
+	if (entry) {
+		pool->head = entry->next;
+		pool->count--;
+		memset(entry, 0, pool->size);
+	} else {
+		entry = g_malloc0(pool->size);
+		g_allocations.task_allocations++;
+	}
+
+	g_allocations.tasks++;
+
+	task = (dld_task_t *)entry;
+	task->synchronous = synchronous;
+
+	return task;
+}
+
+static void prv_task_release(dld_task_t *task)
+{
+	prv_task_pool_t *pool;
+	prv_task_free_t *entry = (prv_task_free_t *)task;
+
+	pool = &g_task_pools[task->synchronous ? PRV_TASK_POOL_SYNC :
+			     PRV_TASK_POOL_ASYNC];
+
+	if (pool->count >= DLD_TASK_POOL_MAX_SIZE) {
+		g_free(task);
+	} else {
+		entry->next = pool->head;
+		pool->head = entry;
+		pool->count++;
+	}
+}
+
+/* Copies str in the arena of the task, or on the heap once it is full */
+static gchar *prv_task_strdup(dld_task_t *task, const gchar *str)
+{
+	gsize size = strlen(str) + 1;
+	gchar *copy;
+
+	if (size > sizeof(task->arena) - task->arena_used) {
+		g_allocations.string_allocations++;
+
+		return g_strdup(str);
+	}
+
+	copy = task->arena + task->arena_used;
+	memcpy(copy, str, size);
+	task->arena_used += size;
+
+	return copy;
+}
+
+static void prv_task_strfree(dld_task_t *task, gchar *str)
 {
-	dld_task_t *task = g_new0(dld_task_t, 1);
+	if (str < task->arena || str >= task->arena + sizeof(task->arena))
+		g_free(str);
+}
+
+dld_task_t *dld_task_rescan_new(dleyna_connector_msg_id_t invocation,
+				const gchar *path, GVariant *parameters)
+{
+	dld_task_t *task = prv_task_alloc(TRUE);
 
 	task->type = DLD_TASK_RESCAN;
 	task->invocation = invocation;
-	task->synchronous = TRUE;
 
 	return task;
 }
 
-dld_task_t *dld_task_get_version_new(dleyna_connector_msg_id_t invocation)
+dld_task_t *dld_task_get_version_new(dleyna_connector_msg_id_t invocation,
+				     const gchar *path, GVariant *parameters)
 {
-	dld_task_t *task = g_new0(dld_task_t, 1);
+	dld_task_t *task = prv_task_alloc(TRUE);
 
 	task->type = DLD_TASK_GET_VERSION;
 	task->invocation = invocation;
 	task->result_format = "(@s)";
 	task->result = g_variant_ref_sink(g_variant_new_string(VERSION));
-	task->synchronous = TRUE;
 
 	return task;
 }
 
-dld_task_t *dld_task_get_devices_new(dleyna_connector_msg_id_t invocation)
+dld_task_t *dld_task_get_devices_new(dleyna_connector_msg_id_t invocation,
+				     const gchar *path, GVariant *parameters)
 {
-	dld_task_t *task = g_new0(dld_task_t, 1);
+	dld_task_t *task = prv_task_alloc(TRUE);
 
 	task->type = DLD_TASK_GET_DEVICES;
 	task->invocation = invocation;
 	task->result_format = "(@ao)";
-	task->synchronous = TRUE;
+
+	return task;
+}
+
+dld_task_t *dld_task_get_statistics_new(dleyna_connector_msg_id_t invocation,
+					const gchar *path,
+					GVariant *parameters)
+{
+	dld_task_t *task = prv_task_alloc(TRUE);
+
+	task->type = DLD_TASK_GET_STATISTICS;
+	task->invocation = invocation;
+	task->result_format = "(@a{sv})";
 
 	return task;
 }
@@ -71,51 +185,60 @@ static void prv_dld_task_delete(dld_task_t *task)
 	switch (task->type) {
 	case DLD_TASK_GET_ALL_PROPS:
 	case DLD_TASK_MANAGER_GET_ALL_PROPS:
-		g_free(task->ut.get_props.interface_name);
+		prv_task_strfree(task, task->ut.get_props.interface_name);
 		break;
 	case DLD_TASK_GET_PROP:
 	case DLD_TASK_MANAGER_GET_PROP:
-		g_free(task->ut.get_prop.interface_name);
-		g_free(task->ut.get_prop.prop_name);
+		prv_task_strfree(task, task->ut.get_prop.interface_name);
+		prv_task_strfree(task, task->ut.get_prop.prop_name);
 		break;
 	case DLD_TASK_MANAGER_SET_PROP:
-		g_free(task->ut.set_prop.interface_name);
-		g_free(task->ut.set_prop.prop_name);
+		prv_task_strfree(task, task->ut.set_prop.interface_name);
+		prv_task_strfree(task, task->ut.set_prop.prop_name);
 		g_variant_unref(task->ut.set_prop.params);
 		break;
 	case DLD_TASK_GET_ICON:
-		g_free(task->ut.get_icon.mime_type);
-		g_free(task->ut.get_icon.resolution);
+		prv_task_strfree(task, task->ut.get_icon.mime_type);
+		prv_task_strfree(task, task->ut.get_icon.resolution);
 		break;
 	case DLD_TASK_GET_TEST_INFO:
 		break;
 	case DLD_TASK_CANCEL_TEST:
 		break;
 	case DLD_TASK_PING:
-		g_free(task->ut.ping.host);
+		prv_task_strfree(task, task->ut.ping.host);
 		break;
 	case DLD_TASK_GET_PING_RESULT:
 		break;
 	case DLD_TASK_NSLOOKUP:
-		g_free(task->ut.nslookup.hostname);
-		g_free(task->ut.nslookup.dns_server);
+		prv_task_strfree(task, task->ut.nslookup.hostname);
+		prv_task_strfree(task, task->ut.nslookup.dns_server);
 		break;
 	case DLD_TASK_GET_NSLOOKUP_RESULT:
 		break;
 	case DLD_TASK_TRACEROUTE:
-		g_free(task->ut.traceroute.host);
+		prv_task_strfree(task, task->ut.traceroute.host);
 		break;
 	case DLD_TASK_GET_TRACEROUTE_RESULT:
 		break;
+	case DLD_TASK_BATCH_PING:
+	case DLD_TASK_BATCH_NSLOOKUP:
+	case DLD_TASK_BATCH_TRACEROUTE:
+		g_strfreev(task->ut.batch.paths);
+		g_variant_unref(task->ut.batch.params);
+		break;
 	default:
 		break;
 	}
 
-	g_free(task->path);
+	if (task->path_interned)
+		dld_intern_unref(task->path);
+	else
+		prv_task_strfree(task, (gchar *)task->path);
 	if (task->result)
 		g_variant_unref(task->result);
 
-	g_free(task);
+	prv_task_release(task);
 }
 
 static dld_task_t *prv_device_task_new(dld_task_type_t type,
@@ -123,14 +246,21 @@ static dld_task_t *prv_device_task_new(dld_task_type_t type,
 				       const gchar *path,
 				       const gchar *result_format)
 {
-	dld_task_t *task = (dld_task_t *)g_new0(dld_async_task_t, 1);
+	dld_task_t *task = prv_task_alloc(FALSE);
+	const gchar *interned;
 
 	task->type = type;
 	task->invocation = invocation;
 	task->result_format = result_format;
 
-	task->path = g_strdup(path);
-	g_strstrip(task->path);
+	/* Only batch paths can name an object that is not published */
+	interned = dld_intern_lookup(path);
+	if (interned) {
+		task->path = dld_intern_ref(interned);
+		task->path_interned = TRUE;
+	} else {
+		task->path = prv_task_strdup(task, path);
+	}
 
 	return task;
 }
@@ -139,11 +269,16 @@ dld_task_t *dld_task_get_prop_new(dleyna_connector_msg_id_t invocation,
 				  const gchar *path, GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *interface_name;
+	const gchar *prop_name;
 
 	task = prv_device_task_new(DLD_TASK_GET_PROP, invocation, path, "(v)");
 
-	g_variant_get(parameters, "(ss)", &task->ut.get_prop.interface_name,
-		      &task->ut.get_prop.prop_name);
+	g_variant_get(parameters, "(&s&s)", &interface_name, &prop_name);
+
+	task->ut.get_prop.interface_name = prv_task_strdup(task,
+							   interface_name);
+	task->ut.get_prop.prop_name = prv_task_strdup(task, prop_name);
 
 	g_strstrip(task->ut.get_prop.interface_name);
 	g_strstrip(task->ut.get_prop.prop_name);
@@ -155,11 +290,14 @@ dld_task_t *dld_task_get_props_new(dleyna_connector_msg_id_t invocation,
 				   const gchar *path, GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *interface_name;
 
 	task = prv_device_task_new(DLD_TASK_GET_ALL_PROPS, invocation, path,
 				   "(@a{sv})");
 
-	g_variant_get(parameters, "(s)", &task->ut.get_props.interface_name);
+	g_variant_get(parameters, "(&s)", &interface_name);
+	task->ut.get_props.interface_name = prv_task_strdup(task,
+							    interface_name);
 	g_strstrip(task->ut.get_props.interface_name);
 
 	return task;
@@ -169,29 +307,37 @@ dld_task_t *dld_task_get_icon_new(dleyna_connector_msg_id_t invocation,
 				  const gchar *path, GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *mime_type;
+	const gchar *resolution;
 
 	task = prv_device_task_new(DLD_TASK_GET_ICON, invocation, path,
 				   "(@ays)");
 	task->multiple_retvals = TRUE;
 
-	g_variant_get(parameters, "(ss)", &task->ut.get_icon.mime_type,
-		      &task->ut.get_icon.resolution);
+	g_variant_get(parameters, "(&s&s)", &mime_type, &resolution);
+
+	task->ut.get_icon.mime_type = prv_task_strdup(task, mime_type);
+	task->ut.get_icon.resolution = prv_task_strdup(task, resolution);
 
 	return task;
 }
 
 dld_task_t *dld_task_manager_get_prop_new(dleyna_connector_msg_id_t invocation,
 					  const gchar *path,
-					  GVariant *parameters,
-					  GError **error)
+					  GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *interface_name;
+	const gchar *prop_name;
 
 	task = prv_device_task_new(DLD_TASK_MANAGER_GET_PROP, invocation, path,
 				   "(v)");
 
-	g_variant_get(parameters, "(ss)", &task->ut.get_prop.interface_name,
-		      &task->ut.get_prop.prop_name);
+	g_variant_get(parameters, "(&s&s)", &interface_name, &prop_name);
+
+	task->ut.get_prop.interface_name = prv_task_strdup(task,
+							   interface_name);
+	task->ut.get_prop.prop_name = prv_task_strdup(task, prop_name);
 
 	g_strstrip(task->ut.get_prop.interface_name);
 	g_strstrip(task->ut.get_prop.prop_name);
@@ -201,15 +347,17 @@ dld_task_t *dld_task_manager_get_prop_new(dleyna_connector_msg_id_t invocation,
 
 dld_task_t *dld_task_manager_get_props_new(dleyna_connector_msg_id_t invocation,
 					   const gchar *path,
-					   GVariant *parameters,
-					   GError **error)
+					   GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *interface_name;
 
 	task = prv_device_task_new(DLD_TASK_MANAGER_GET_ALL_PROPS, invocation,
 				   path, "(@a{sv})");
 
-	g_variant_get(parameters, "(s)", &task->ut.get_props.interface_name);
+	g_variant_get(parameters, "(&s)", &interface_name);
+	task->ut.get_props.interface_name = prv_task_strdup(task,
+							    interface_name);
 
 	g_strstrip(task->ut.get_props.interface_name);
 
@@ -218,16 +366,21 @@ dld_task_t *dld_task_manager_get_props_new(dleyna_connector_msg_id_t invocation,
 
 dld_task_t *dld_task_manager_set_prop_new(dleyna_connector_msg_id_t invocation,
 					  const gchar *path,
-					  GVariant *parameters,
-					  GError **error)
+					  GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *interface_name;
+	const gchar *prop_name;
 
 	task = prv_device_task_new(DLD_TASK_MANAGER_SET_PROP, invocation, path,
 				   NULL);
 
-	g_variant_get(parameters, "(ssv)", &task->ut.set_prop.interface_name,
-		      &task->ut.set_prop.prop_name, &task->ut.set_prop.params);
+	g_variant_get(parameters, "(&s&sv)", &interface_name, &prop_name,
+		      &task->ut.set_prop.params);
+
+	task->ut.set_prop.interface_name = prv_task_strdup(task,
+							   interface_name);
+	task->ut.set_prop.prop_name = prv_task_strdup(task, prop_name);
 
 	g_strstrip(task->ut.set_prop.interface_name);
 	g_strstrip(task->ut.set_prop.prop_name);
@@ -266,16 +419,19 @@ dld_task_t *dld_task_ping_new(dleyna_connector_msg_id_t invocation,
 			      const gchar *path, GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *host;
 
 	task = prv_device_task_new(DLD_TASK_PING, invocation, path, "(@u)");
 
-	g_variant_get(parameters, "(suuuu)",
-		      &task->ut.ping.host,
+	g_variant_get(parameters, "(&suuuu)",
+		      &host,
 		      &task->ut.ping.repeat_count,
 		      &task->ut.ping.interval,
 		      &task->ut.ping.data_block_size,
 		      &task->ut.ping.dscp);
 
+	task->ut.ping.host = prv_task_strdup(task, host);
+
 	return task;
 }
 
@@ -298,15 +454,20 @@ dld_task_t *dld_task_nslookup_new(dleyna_connector_msg_id_t invocation,
 				  const gchar *path, GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *hostname;
+	const gchar *dns_server;
 
 	task = prv_device_task_new(DLD_TASK_NSLOOKUP, invocation, path, "(@u)");
 
-	g_variant_get(parameters, "(ssuu)",
-		      &task->ut.nslookup.hostname,
-		      &task->ut.nslookup.dns_server,
+	g_variant_get(parameters, "(&s&suu)",
+		      &hostname,
+		      &dns_server,
 		      &task->ut.nslookup.repeat_count,
 		      &task->ut.nslookup.interval);
 
+	task->ut.nslookup.hostname = prv_task_strdup(task, hostname);
+	task->ut.nslookup.dns_server = prv_task_strdup(task, dns_server);
+
 	return task;
 }
 
@@ -330,17 +491,20 @@ dld_task_t *dld_task_traceroute_new(dleyna_connector_msg_id_t invocation,
 				    const gchar *path, GVariant *parameters)
 {
 	dld_task_t *task;
+	const gchar *host;
 
 	task = prv_device_task_new(DLD_TASK_TRACEROUTE,
 				   invocation, path, "(@u)");
 
-	g_variant_get(parameters, "(suuuu)",
-		      &task->ut.traceroute.host,
+	g_variant_get(parameters, "(&suuuu)",
+		      &host,
 		      &task->ut.traceroute.timeout,
 		      &task->ut.traceroute.data_block_size,
 		      &task->ut.traceroute.max_hop_count,
 		      &task->ut.traceroute.dscp);
 
+	task->ut.traceroute.host = prv_task_strdup(task, host);
+
 	return task;
 }
 
@@ -359,6 +523,60 @@ dld_task_t *dld_task_get_traceroute_result_new(
 	return task;
 }
 
+static dld_task_t *prv_batch_task_new(dld_task_type_t type,
+				      dleyna_connector_msg_id_t invocation,
+				      const gchar *path,
+				      GVariant *parameters)
+{
+	dld_task_t *task;
+	gsize count;
+	gsize i;
+	GVariant **params;
+
+	task = prv_device_task_new(type, invocation, path, "(@a{ou})");
+
+	g_variant_get_child(parameters, 0, "^ao", &task->ut.batch.paths);
+
+	count = g_variant_n_children(parameters) - 1;
+	params = g_new(GVariant *, count);
+
+	for (i = 0; i < count; ++i)
+		params[i] = g_variant_get_child_value(parameters, i + 1);
+
+	task->ut.batch.params = g_variant_ref_sink(
+					g_variant_new_tuple(params, count));
+
+	for (i = 0; i < count; ++i)
+		g_variant_unref(params[i]);
+	g_free(params);
+
+	return task;
+}
+
+dld_task_t *dld_task_batch_ping_new(dleyna_connector_msg_id_t invocation,
+				    const gchar *path, GVariant *parameters)
+{
+	return prv_batch_task_new(DLD_TASK_BATCH_PING, invocation, path,
+				  parameters);
+}
+
+dld_task_t *dld_task_batch_nslookup_new(dleyna_connector_msg_id_t invocation,
+					const gchar *path,
+					GVariant *parameters)
+{
+	return prv_batch_task_new(DLD_TASK_BATCH_NSLOOKUP, invocation, path,
+				  parameters);
+}
+
+dld_task_t *dld_task_batch_traceroute_new(
+					dleyna_connector_msg_id_t invocation,
+					const gchar *path,
+					GVariant *parameters)
+{
+	return prv_batch_task_new(DLD_TASK_BATCH_TRACEROUTE, invocation, path,
+				  parameters);
+}
+
 void dld_task_complete(dld_task_t *task)
 {
 	GVariant *result;
@@ -385,6 +603,7 @@ void dld_task_complete(dld_task_t *task)
 							NULL);
 		}
 
+		dld_metrics_task_replied(task, NULL);
 		task->invocation = NULL;
 	}
 
@@ -401,6 +620,7 @@ void dld_task_fail(dld_task_t *task, GError *error)
 	if (task->invocation) {
 		dld_diagnostics_get_connector()->return_error(task->invocation,
 							      error);
+		dld_metrics_task_replied(task, error);
 		task->invocation = NULL;
 	}
 
@@ -421,6 +641,7 @@ void dld_task_cancel(dld_task_t *task)
 				    "Operation cancelled.");
 		dld_diagnostics_get_connector()->return_error(task->invocation,
 							      error);
+		dld_metrics_task_replied(task, error);
 		task->invocation = NULL;
 		g_error_free(error);
 	}
@@ -445,6 +666,7 @@ void dld_task_delete(dld_task_t *task)
 				    "Unable to complete command.");
 		dld_diagnostics_get_connector()->return_error(task->invocation,
 							      error);
+		dld_metrics_task_replied(task, error);
 		g_error_free(error);
 	}
 
@@ -454,3 +676,24 @@ finished:
 
 	return;
 }
+
+void dld_task_get_allocations(dld_task_allocations_t *allocations)
+{
+	*allocations = g_allocations;
+}
+
+void dld_task_pool_delete(void)
+{
+	prv_task_free_t *entry;
+	guint i;
+
+	for (i = 0; i < PRV_TASK_POOL_MAX; ++i) {
+		while (g_task_pools[i].head) {
+			entry = g_task_pools[i].head;
+			g_task_pools[i].head = entry->next;
+			g_free(entry);
+		}
+
+		g_task_pools[i].count = 0;
+	}
+}
@@ -29,10 +29,13 @@
 #include <libdleyna/core/connector.h>
 #include <libdleyna/core/task-atom.h>
 
+#define DLD_TASK_ARENA_SIZE 256
+
 enum dld_task_type_t_ {
 	DLD_TASK_GET_VERSION,
 	DLD_TASK_GET_DEVICES,
 	DLD_TASK_RESCAN,
+	DLD_TASK_GET_STATISTICS,
 	DLD_TASK_GET_ALL_PROPS,
 	DLD_TASK_GET_PROP,
 	DLD_TASK_GET_ICON,
@@ -46,7 +49,11 @@ enum dld_task_type_t_ {
 	DLD_TASK_NSLOOKUP,
 	DLD_TASK_GET_NSLOOKUP_RESULT,
 	DLD_TASK_TRACEROUTE,
-	DLD_TASK_GET_TRACEROUTE_RESULT
+	DLD_TASK_GET_TRACEROUTE_RESULT,
+	DLD_TASK_BATCH_PING,
+	DLD_TASK_BATCH_NSLOOKUP,
+	DLD_TASK_BATCH_TRACEROUTE,
+	DLD_TASK_MAX
 };
 typedef enum dld_task_type_t_ dld_task_type_t;
 
@@ -107,16 +114,25 @@ struct dld_task_traceroute_t_ {
 	guint dscp;
 };
 
+/* params holds the arguments of the per device test, without the paths */
+typedef struct dld_task_batch_t_ dld_task_batch_t;
+struct dld_task_batch_t_ {
+	gchar **paths;
+	GVariant *params;
+};
+
 typedef struct dld_task_t_ dld_task_t;
 struct dld_task_t_ {
 	dleyna_task_atom_t atom; /* pseudo inheritance - MUST be first field */
 	dld_task_type_t type;
-	gchar *path;
+	const gchar *path;
+	gboolean path_interned;
 	const gchar *result_format;
 	GVariant *result;
 	dleyna_connector_msg_id_t invocation;
 	gboolean synchronous;
 	gboolean multiple_retvals;
+	gint64 queued_time;
 	union {
 		dld_task_get_props_t get_props;
 		dld_task_get_prop_t get_prop;
@@ -126,14 +142,35 @@ struct dld_task_t_ {
 		dld_task_ping_t ping;
 		dld_task_nslookup_t nslookup;
 		dld_task_traceroute_t traceroute;
+		dld_task_batch_t batch;
 	} ut;
+	gsize arena_used;
+	gchar arena[DLD_TASK_ARENA_SIZE]; /* holds the strings of the task */
+};
+
+typedef struct dld_task_allocations_t_ dld_task_allocations_t;
+struct dld_task_allocations_t_ {
+	guint64 tasks;
+	guint64 task_allocations;
+	guint64 string_allocations;
 };
 
-dld_task_t *dld_task_rescan_new(dleyna_connector_msg_id_t invocation);
+typedef dld_task_t *(*dld_task_new_t)(dleyna_connector_msg_id_t invocation,
+				      const gchar *path,
+				      GVariant *parameters);
 
-dld_task_t *dld_task_get_version_new(dleyna_connector_msg_id_t invocation);
+dld_task_t *dld_task_rescan_new(dleyna_connector_msg_id_t invocation,
+				const gchar *path, GVariant *parameters);
 
-dld_task_t *dld_task_get_devices_new(dleyna_connector_msg_id_t invocation);
+dld_task_t *dld_task_get_version_new(dleyna_connector_msg_id_t invocation,
+				     const gchar *path, GVariant *parameters);
+
+dld_task_t *dld_task_get_devices_new(dleyna_connector_msg_id_t invocation,
+				     const gchar *path, GVariant *parameters);
+
+dld_task_t *dld_task_get_statistics_new(dleyna_connector_msg_id_t invocation,
+					const gchar *path,
+					GVariant *parameters);
 
 dld_task_t *dld_task_get_prop_new(dleyna_connector_msg_id_t invocation,
 				  const gchar *path, GVariant *parameters);
@@ -146,18 +183,15 @@ dld_task_t *dld_task_get_icon_new(dleyna_connector_msg_id_t invocation,
 
 dld_task_t *dld_task_manager_get_prop_new(dleyna_connector_msg_id_t invocation,
 					  const gchar *path,
-					  GVariant *parameters,
-					  GError **error);
+					  GVariant *parameters);
 
 dld_task_t *dld_task_manager_set_prop_new(dleyna_connector_msg_id_t invocation,
 					  const gchar *path,
-					  GVariant *parameters,
-					  GError **error);
+					  GVariant *parameters);
 
 dld_task_t *dld_task_manager_get_props_new(dleyna_connector_msg_id_t invocation,
 					   const gchar *path,
-					   GVariant *parameters,
-					   GError **error);
+					   GVariant *parameters);
 
 dld_task_t *dld_task_get_test_info_new(dleyna_connector_msg_id_t invocation,
 				       const gchar *path, GVariant *parameters);
@@ -189,6 +223,18 @@ dld_task_t *dld_task_get_traceroute_result_new(
 					const gchar *path,
 					GVariant *parameters);
 
+dld_task_t *dld_task_batch_ping_new(dleyna_connector_msg_id_t invocation,
+				    const gchar *path, GVariant *parameters);
+
+dld_task_t *dld_task_batch_nslookup_new(dleyna_connector_msg_id_t invocation,
+					const gchar *path,
+					GVariant *parameters);
+
+dld_task_t *dld_task_batch_traceroute_new(
+					dleyna_connector_msg_id_t invocation,
+					const gchar *path,
+					GVariant *parameters);
+
 void dld_task_complete(dld_task_t *task);
 
 void dld_task_fail(dld_task_t *task, GError *error);
@@ -197,4 +243,8 @@ void dld_task_delete(dld_task_t *task);
 
 void dld_task_cancel(dld_task_t *task);
 
+void dld_task_get_allocations(dld_task_allocations_t *allocations);
+
+void dld_task_pool_delete(void);
+
 #endif
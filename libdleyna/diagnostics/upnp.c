@@ -32,12 +32,22 @@
 
 #include "async.h"
 #include "device.h"
+#include "icon-cache.h"
+#include "intern.h"
 #include "prop-defs.h"
+#include "scheduler.h"
 #include "upnp.h"
 
 #define DLD_BASIC_MANAGEMENT_SERVICE_TYPE \
 				"urn:schemas-upnp-org:service:BasicManagement"
 
+#define DLD_UPNP_BATCH_MAX_RUNNING 16
+
+#define DLD_UPNP_CACHE_DIR "dleyna-diagnostics"
+#define DLD_UPNP_CACHE_FILE "devices"
+#define DLD_UPNP_CACHE_EXPIRY_TIMEOUT 15
+#define DLD_UPNP_CACHE_SAVE_DELAY 2
+
 struct dld_upnp_t_ {
 	dleyna_connector_id_t connection;
 	const dleyna_connector_dispatch_cb_t *interface_info;
@@ -46,7 +56,14 @@ struct dld_upnp_t_ {
 	GUPnPContextManager *context_manager;
 	void *user_data;
 	GHashTable *device_udn_map;
+	GHashTable *device_path_map;
 	GHashTable *device_uc_map;
+	dld_device_t *local_device;
+	dld_scheduler_t *scheduler;
+	GKeyFile *cache;
+	gchar *cache_path;
+	guint cache_timeout_id;
+	guint cache_save_id;
 	guint counter;
 };
 
@@ -54,21 +71,220 @@ struct dld_upnp_t_ {
 typedef struct prv_device_new_ct_t_ prv_device_new_ct_t;
 struct prv_device_new_ct_t_ {
 	dld_upnp_t *upnp;
-	char *udn;
+	const char *udn;
 	gchar *ip_address;
 	dld_device_t *device;
 	const dleyna_task_queue_key_t *queue_id;
 };
 
+/* Private structure used to fan a batch task out to its devices */
+typedef struct prv_batch_t_ prv_batch_t;
+struct prv_batch_t_ {
+	dld_upnp_t *upnp;
+	dld_async_task_t *cb_data;
+	dld_task_new_t task_new;
+	dld_upnp_task_run_t task_start;
+	guint next;
+	GList *running;
+	guint running_count;
+	gboolean cancelled;
+	GVariantBuilder results;
+};
+
 static void prv_device_new_free(prv_device_new_ct_t *priv_t)
 {
 	if (priv_t) {
-		g_free(priv_t->udn);
+		dld_intern_unref(priv_t->udn);
 		g_free(priv_t->ip_address);
 		g_free(priv_t);
 	}
 }
 
+static void prv_registry_add(dld_upnp_t *upnp, const char *udn,
+			     dld_device_t *device)
+{
+	g_hash_table_insert(upnp->device_udn_map,
+			    (gpointer)dld_intern_ref(udn), device);
+	g_hash_table_insert(upnp->device_path_map, (gpointer)device->path,
+			    device);
+}
+
+static void prv_registry_remove(dld_upnp_t *upnp, const char *udn,
+				dld_device_t *device)
+{
+	/* The UDN map owns the device, so the path map must go first */
+	g_hash_table_remove(upnp->device_path_map, device->path);
+	g_hash_table_remove(upnp->device_udn_map, udn);
+}
+
+/* The local device runs its tests on the host, it is never lost */
+static void prv_local_device_add(dld_upnp_t *upnp)
+{
+	dld_device_t *device;
+
+	device = dld_device_new_local(upnp->connection, upnp->counter,
+				      upnp->interface_info);
+	if (!device)
+		return;
+
+	upnp->counter++;
+	upnp->local_device = device;
+
+	g_hash_table_insert(upnp->device_path_map, (gpointer)device->path,
+			    device);
+	upnp->found_device(device->path);
+}
+
+static void prv_cache_save(dld_upnp_t *upnp)
+{
+	gchar *data;
+	gsize length;
+	GError *error = NULL;
+
+	data = g_key_file_to_data(upnp->cache, &length, NULL);
+
+	if (!g_file_set_contents(upnp->cache_path, data, length, &error)) {
+		DLEYNA_LOG_WARNING("Unable to save device cache: %s",
+				   error->message);
+		g_error_free(error);
+	}
+
+	g_free(data);
+}
+
+static gboolean prv_cache_save_cb(gpointer user_data)
+{
+	dld_upnp_t *upnp = user_data;
+
+	upnp->cache_save_id = 0;
+	prv_cache_save(upnp);
+
+	return FALSE;
+}
+
+/* Devices are announced in bursts, the file is written once per burst */
+static void prv_cache_schedule_save(dld_upnp_t *upnp)
+{
+	if (!upnp->cache_save_id)
+		upnp->cache_save_id = g_timeout_add_seconds(
+						DLD_UPNP_CACHE_SAVE_DELAY,
+						prv_cache_save_cb, upnp);
+}
+
+static void prv_cache_store_device(dld_upnp_t *upnp, dld_device_t *device)
+{
+	dld_device_cache_save(device, upnp->cache);
+	prv_cache_schedule_save(upnp);
+}
+
+static void prv_cache_forget_device(dld_upnp_t *upnp, const char *udn)
+{
+	if (g_key_file_remove_group(upnp->cache, udn, NULL))
+		prv_cache_schedule_save(upnp);
+}
+
+static gboolean prv_cache_expire(gpointer user_data)
+{
+	dld_upnp_t *upnp = user_data;
+	GHashTableIter iter;
+	gpointer key;
+	gpointer value;
+	dld_device_t *device;
+	GPtrArray *expired;
+	unsigned int i;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	upnp->cache_timeout_id = 0;
+	expired = g_ptr_array_new();
+
+	g_hash_table_iter_init(&iter, upnp->device_udn_map);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		device = value;
+		if (!device->contexts->len)
+			g_ptr_array_add(expired, key);
+	}
+
+	for (i = 0; i < expired->len; ++i) {
+		device = g_hash_table_lookup(upnp->device_udn_map,
+					     g_ptr_array_index(expired, i));
+
+		DLEYNA_LOG_DEBUG("Cached device %s not seen. Expiring",
+				 device->path);
+
+		upnp->lost_device(device->path);
+		(void) g_key_file_remove_group(upnp->cache,
+					       g_ptr_array_index(expired, i),
+					       NULL);
+		prv_registry_remove(upnp, g_ptr_array_index(expired, i),
+				    device);
+	}
+
+	if (expired->len)
+		prv_cache_schedule_save(upnp);
+
+	g_ptr_array_unref(expired);
+
+	DLEYNA_LOG_DEBUG("Exit");
+
+	return FALSE;
+}
+
+/* Publishes the devices seen by the previous instance until SSDP
+ * revalidates them, or until they expire.
+ */
+static void prv_cache_load(dld_upnp_t *upnp)
+{
+	gchar *dir;
+	gchar **groups;
+	gsize i;
+	dld_device_t *device;
+
+	DLEYNA_LOG_DEBUG("Enter");
+
+	upnp->cache = g_key_file_new();
+
+	dir = g_build_filename(g_get_user_cache_dir(), DLD_UPNP_CACHE_DIR,
+			       NULL);
+	(void) g_mkdir_with_parents(dir, 0700);
+	upnp->cache_path = g_build_filename(dir, DLD_UPNP_CACHE_FILE, NULL);
+	g_free(dir);
+
+	if (!g_key_file_load_from_file(upnp->cache, upnp->cache_path,
+				       G_KEY_FILE_NONE, NULL))
+		goto on_exit;
+
+	groups = g_key_file_get_groups(upnp->cache, NULL);
+
+	for (i = 0; groups[i]; ++i) {
+		device = dld_device_new_from_cache(upnp->connection,
+						   upnp->cache, groups[i],
+						   upnp->counter,
+						   upnp->interface_info);
+		if (!device) {
+			(void) g_key_file_remove_group(upnp->cache, groups[i],
+						       NULL);
+			continue;
+		}
+
+		upnp->counter++;
+
+		prv_registry_add(upnp, groups[i], device);
+		upnp->found_device(device->path);
+	}
+
+	if (i)
+		upnp->cache_timeout_id = g_timeout_add_seconds(
+						DLD_UPNP_CACHE_EXPIRY_TIMEOUT,
+						prv_cache_expire, upnp);
+
+	g_strfreev(groups);
+
+on_exit:
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
 static void prv_device_chain_end(gboolean cancelled, gpointer data)
 {
 	dld_device_t *device;
@@ -82,9 +298,9 @@ static void prv_device_chain_end(gboolean cancelled, gpointer data)
 		goto on_clear;
 
 	DLEYNA_LOG_DEBUG("Notify new device available: %s", device->path);
-	g_hash_table_insert(priv_t->upnp->device_udn_map, g_strdup(priv_t->udn),
-			    device);
+	prv_registry_add(priv_t->upnp, priv_t->udn, device);
 	priv_t->upnp->found_device(device->path);
+	prv_cache_store_device(priv_t->upnp, device);
 
 on_clear:
 
@@ -138,12 +354,13 @@ static void prv_update_device_context(prv_device_new_ct_t *priv_t,
 				      const dleyna_task_queue_key_t *queue_id)
 {
 	priv_t->upnp = upnp;
-	priv_t->udn = g_strdup(udn);
+	priv_t->udn = dld_intern_ref(udn);
 	priv_t->ip_address = g_strdup(ip_address);
 	priv_t->queue_id = queue_id;
 	priv_t->device = device;
 
-	g_hash_table_insert(upnp->device_uc_map, g_strdup(udn), priv_t);
+	g_hash_table_insert(upnp->device_uc_map, (gpointer)priv_t->udn,
+			    priv_t);
 }
 
 static void prv_add_device(dld_upnp_t *upnp, GUPnPDeviceProxy *dev_proxy,
@@ -155,13 +372,16 @@ static void prv_add_device(dld_upnp_t *upnp, GUPnPDeviceProxy *dev_proxy,
 	const dleyna_task_queue_key_t *queue_id;
 	unsigned int i;
 	prv_device_new_ct_t *priv_t;
+	gboolean cached;
+	const char *key;
 
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = g_hash_table_lookup(upnp->device_udn_map, udn);
+	key = dld_intern_lookup(udn);
+	device = g_hash_table_lookup(upnp->device_udn_map, key);
 
 	if (!device) {
-		priv_t = g_hash_table_lookup(upnp->device_uc_map, udn);
+		priv_t = g_hash_table_lookup(upnp->device_uc_map, key);
 
 		if (priv_t)
 			device = priv_t->device;
@@ -191,11 +411,19 @@ static void prv_add_device(dld_upnp_t *upnp, GUPnPDeviceProxy *dev_proxy,
 				break;
 		}
 
+		cached = !device->contexts->len;
+
 		if (i == device->contexts->len) {
 			DLEYNA_LOG_DEBUG("Adding Context");
 			dld_device_append_new_context(device, ip_address,
 						      dev_proxy, bms_proxy);
 		}
+
+		if (cached) {
+			DLEYNA_LOG_DEBUG("Cached device revalidated");
+			dld_device_refresh_props(device);
+			prv_cache_store_device(upnp, device);
+		}
 	}
 
 	return;
@@ -337,13 +565,15 @@ static void prv_remove_device(dld_upnp_t *upnp, const gchar *ip_address,
 	prv_device_new_ct_t *priv_t;
 	gboolean construction_ctx = FALSE;
 	const dleyna_task_queue_key_t *queue_id;
+	const char *key;
 
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = g_hash_table_lookup(upnp->device_udn_map, udn);
+	key = dld_intern_lookup(udn);
+	device = g_hash_table_lookup(upnp->device_udn_map, key);
 
 	if (!device) {
-		priv_t = g_hash_table_lookup(upnp->device_uc_map, udn);
+		priv_t = g_hash_table_lookup(upnp->device_uc_map, key);
 
 		if (priv_t) {
 			device = priv_t->device;
@@ -377,7 +607,8 @@ static void prv_remove_device(dld_upnp_t *upnp, const gchar *ip_address,
 					"Last Context lost. Delete device");
 
 				upnp->lost_device(device->path);
-				g_hash_table_remove(upnp->device_udn_map, udn);
+				prv_cache_forget_device(upnp, udn);
+				prv_registry_remove(upnp, key, device);
 			} else {
 				DLEYNA_LOG_WARNING(
 				       "Device under construction. Cancelling");
@@ -528,6 +759,8 @@ on_error:
 	return;
 }
 
+static void prv_scheduler_run(dld_task_t *task, gpointer user_data);
+
 static void prv_on_context_available(GUPnPContextManager *context_manager,
 				     GUPnPContext *context,
 				     gpointer user_data)
@@ -560,12 +793,22 @@ dld_upnp_t *dld_upnp_new(dleyna_connector_id_t connection,
 	upnp->found_device = found_device;
 	upnp->lost_device = lost_device;
 
-	upnp->device_udn_map = g_hash_table_new_full(g_str_hash, g_str_equal,
-						     g_free,
-						     dld_device_delete);
+	/* Keys are interned, so they are hashed and compared by pointer */
+	upnp->device_udn_map = g_hash_table_new_full(
+					g_direct_hash, g_direct_equal,
+					(GDestroyNotify)dld_intern_unref,
+					dld_device_delete);
+
+	upnp->device_path_map = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	upnp->device_uc_map = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	upnp->scheduler = dld_scheduler_new(DLD_MAX_DEVICE_ACTIONS,
+					    prv_scheduler_run, upnp);
 
-	upnp->device_uc_map = g_hash_table_new_full(g_str_hash, g_str_equal,
-						    g_free, NULL);
+	prv_local_device_add(upnp);
+
+	prv_cache_load(upnp);
 
 	upnp->context_manager = gupnp_context_manager_create(0);
 
@@ -579,9 +822,24 @@ dld_upnp_t *dld_upnp_new(dleyna_connector_id_t connection,
 void dld_upnp_delete(dld_upnp_t *upnp)
 {
 	if (upnp) {
+		if (upnp->cache_timeout_id)
+			(void) g_source_remove(upnp->cache_timeout_id);
+
+		if (upnp->cache_save_id) {
+			(void) g_source_remove(upnp->cache_save_id);
+			prv_cache_save(upnp);
+		}
+
 		g_object_unref(upnp->context_manager);
+		g_hash_table_unref(upnp->device_path_map);
 		g_hash_table_unref(upnp->device_udn_map);
+		dld_device_delete(upnp->local_device);
 		g_hash_table_unref(upnp->device_uc_map);
+		dld_device_icon_session_delete();
+		dld_icon_cache_delete();
+		dld_scheduler_delete(upnp->scheduler);
+		g_key_file_free(upnp->cache);
+		g_free(upnp->cache_path);
 
 		g_free(upnp);
 	}
@@ -597,6 +855,10 @@ GVariant *dld_upnp_get_device_ids(dld_upnp_t *upnp)
 	DLEYNA_LOG_DEBUG("Enter");
 
 	g_variant_builder_init(&vb, G_VARIANT_TYPE("ao"));
+
+	if (upnp->local_device)
+		g_variant_builder_add(&vb, "o", upnp->local_device->path);
+
 	g_hash_table_iter_init(&iter, upnp->device_udn_map);
 
 	while (g_hash_table_iter_next(&iter, NULL, &value)) {
@@ -614,6 +876,11 @@ GHashTable *dld_upnp_get_device_udn_map(dld_upnp_t *upnp)
 	return upnp->device_udn_map;
 }
 
+GHashTable *dld_upnp_get_device_path_map(dld_upnp_t *upnp)
+{
+	return upnp->device_path_map;
+}
+
 static dld_device_t *prv_get_and_check_device(dld_upnp_t *upnp,
 					      dld_task_t *task,
 					      dld_upnp_task_complete_t cb)
@@ -621,7 +888,7 @@ static dld_device_t *prv_get_and_check_device(dld_upnp_t *upnp,
 	dld_device_t *device;
 	dld_async_task_t *cb_data = (dld_async_task_t *)task;
 
-	device = dld_device_from_path(task->path, upnp->device_udn_map);
+	device = dld_device_from_path(task->path, upnp->device_path_map);
 
 	if (!device) {
 		DLEYNA_LOG_WARNING("Cannot locate device");
@@ -638,6 +905,31 @@ static dld_device_t *prv_get_and_check_device(dld_upnp_t *upnp,
 	return device;
 }
 
+/* Cached devices are only reachable once SSDP has revalidated them */
+static dld_device_t *prv_get_and_check_context(dld_upnp_t *upnp,
+					       dld_task_t *task,
+					       dld_upnp_task_complete_t cb)
+{
+	dld_device_t *device;
+	dld_async_task_t *cb_data = (dld_async_task_t *)task;
+
+	device = prv_get_and_check_device(upnp, task, cb);
+
+	if (device && !device->contexts->len && !device->local) {
+		DLEYNA_LOG_WARNING("Device not reachable yet");
+
+		cb_data->cb = cb;
+		cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
+					     DLEYNA_ERROR_OPERATION_FAILED,
+					     "Device not reachable yet");
+
+		(void) g_idle_add(dld_async_task_complete, cb_data);
+		device = NULL;
+	}
+
+	return device;
+}
+
 void dld_upnp_get_prop(dld_upnp_t *upnp, dld_task_t *task,
 		       dld_upnp_task_complete_t cb)
 {
@@ -680,23 +972,70 @@ void dld_upnp_get_icon(dld_upnp_t *upnp, dld_task_t *task,
 
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = prv_get_and_check_device(upnp, task, cb);
+	device = prv_get_and_check_context(upnp, task, cb);
 	if (device != NULL)
 		dld_device_get_icon(device, task, cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
 
-void dld_upnp_get_test_info(dld_upnp_t *upnp, dld_task_t *task,
-			    dld_upnp_task_complete_t cb)
+static void prv_scheduled_task_complete(dld_task_t *task, GError *error)
+{
+	dld_upnp_t *upnp = dld_diagnostics_service_get_upnp();
+
+	dld_scheduler_task_done(upnp->scheduler, task, error);
+}
+
+static void prv_scheduler_run(dld_task_t *task, gpointer user_data)
 {
+	dld_upnp_t *upnp = user_data;
+	dld_upnp_task_complete_t cb = prv_scheduled_task_complete;
 	dld_device_t *device;
 
-	DLEYNA_LOG_DEBUG("Enter");
+	device = prv_get_and_check_context(upnp, task, cb);
+	if (device == NULL)
+		goto on_exit;
 
-	device = prv_get_and_check_device(upnp, task, cb);
-	if (device != NULL)
+	switch (task->type) {
+	case DLD_TASK_GET_TEST_INFO:
 		dld_device_get_test_info(device, task, cb);
+		break;
+	case DLD_TASK_CANCEL_TEST:
+		dld_device_cancel_test(device, task, cb);
+		break;
+	case DLD_TASK_PING:
+		dld_device_ping(device, task, cb);
+		break;
+	case DLD_TASK_GET_PING_RESULT:
+		dld_device_get_ping_result(device, task, cb);
+		break;
+	case DLD_TASK_NSLOOKUP:
+		dld_device_nslookup(device, task, cb);
+		break;
+	case DLD_TASK_GET_NSLOOKUP_RESULT:
+		dld_device_get_nslookup_result(device, task, cb);
+		break;
+	case DLD_TASK_TRACEROUTE:
+		dld_device_traceroute(device, task, cb);
+		break;
+	case DLD_TASK_GET_TRACEROUTE_RESULT:
+		dld_device_get_traceroute_result(device, task, cb);
+		break;
+	default:
+		break;
+	}
+
+on_exit:
+
+	return;
+}
+
+void dld_upnp_get_test_info(dld_upnp_t *upnp, dld_task_t *task,
+			    dld_upnp_task_complete_t cb)
+{
+	DLEYNA_LOG_DEBUG("Enter");
+
+	dld_scheduler_submit(upnp->scheduler, task, cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -704,13 +1043,9 @@ void dld_upnp_get_test_info(dld_upnp_t *upnp, dld_task_t *task,
 void dld_upnp_cancel_test(dld_upnp_t *upnp, dld_task_t *task,
 			  dld_upnp_task_complete_t cb)
 {
-	dld_device_t *device;
-
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = prv_get_and_check_device(upnp, task, cb);
-	if (device != NULL)
-		dld_device_cancel_test(device, task, cb);
+	dld_scheduler_submit(upnp->scheduler, task, cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -718,13 +1053,9 @@ void dld_upnp_cancel_test(dld_upnp_t *upnp, dld_task_t *task,
 void dld_upnp_ping(dld_upnp_t *upnp, dld_task_t *task,
 		   dld_upnp_task_complete_t cb)
 {
-	dld_device_t *device;
-
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = prv_get_and_check_device(upnp, task, cb);
-	if (device != NULL)
-		dld_device_ping(device, task, cb);
+	dld_scheduler_submit(upnp->scheduler, task, cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -732,13 +1063,9 @@ void dld_upnp_ping(dld_upnp_t *upnp, dld_task_t *task,
 void dld_upnp_get_ping_result(dld_upnp_t *upnp, dld_task_t *task,
 			      dld_upnp_task_complete_t cb)
 {
-	dld_device_t *device;
-
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = prv_get_and_check_device(upnp, task, cb);
-	if (device != NULL)
-		dld_device_get_ping_result(device, task, cb);
+	dld_scheduler_submit(upnp->scheduler, task, cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -746,13 +1073,9 @@ void dld_upnp_get_ping_result(dld_upnp_t *upnp, dld_task_t *task,
 void dld_upnp_nslookup(dld_upnp_t *upnp, dld_task_t *task,
 		       dld_upnp_task_complete_t cb)
 {
-	dld_device_t *device;
-
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = prv_get_and_check_device(upnp, task, cb);
-	if (device != NULL)
-		dld_device_nslookup(device, task, cb);
+	dld_scheduler_submit(upnp->scheduler, task, cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -760,13 +1083,9 @@ void dld_upnp_nslookup(dld_upnp_t *upnp, dld_task_t *task,
 void dld_upnp_get_nslookup_result(dld_upnp_t *upnp, dld_task_t *task,
 				  dld_upnp_task_complete_t cb)
 {
-	dld_device_t *device;
-
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = prv_get_and_check_device(upnp, task, cb);
-	if (device != NULL)
-		dld_device_get_nslookup_result(device, task, cb);
+	dld_scheduler_submit(upnp->scheduler, task, cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -774,13 +1093,9 @@ void dld_upnp_get_nslookup_result(dld_upnp_t *upnp, dld_task_t *task,
 void dld_upnp_traceroute(dld_upnp_t *upnp, dld_task_t *task,
 			 dld_upnp_task_complete_t cb)
 {
-	dld_device_t *device;
-
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = prv_get_and_check_device(upnp, task, cb);
-	if (device != NULL)
-		dld_device_traceroute(device, task, cb);
+	dld_scheduler_submit(upnp->scheduler, task, cb);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
@@ -788,17 +1103,155 @@ void dld_upnp_traceroute(dld_upnp_t *upnp, dld_task_t *task,
 void dld_upnp_get_traceroute_result(dld_upnp_t *upnp, dld_task_t *task,
 				    dld_upnp_task_complete_t cb)
 {
-	dld_device_t *device;
+	DLEYNA_LOG_DEBUG("Enter");
+
+	dld_scheduler_submit(upnp->scheduler, task, cb);
+
+	DLEYNA_LOG_DEBUG("Exit");
+}
+
+static void prv_batch_free(gpointer data)
+{
+	prv_batch_t *batch = data;
+
+	g_variant_builder_clear(&batch->results);
+	g_free(batch);
+}
+
+static void prv_batch_end(prv_batch_t *batch)
+{
+	dld_async_task_t *cb_data = batch->cb_data;
+
+	DLEYNA_LOG_DEBUG("Batch of %u tests over", batch->next);
+
+	if (batch->cancelled) {
+		if (!cb_data->error)
+			cb_data->error = g_error_new(DLEYNA_SERVER_ERROR,
+						     DLEYNA_ERROR_CANCELLED,
+						     "Operation cancelled.");
+	} else {
+		cb_data->task.result = g_variant_ref_sink(
+				g_variant_builder_end(&batch->results));
+	}
+
+	(void) g_idle_add(dld_async_task_complete, cb_data);
+	g_cancellable_disconnect(cb_data->cancellable, cb_data->cancel_id);
+}
+
+static void prv_batch_fill(prv_batch_t *batch);
+
+static void prv_batch_task_complete(dld_task_t *task, GError *error)
+{
+	dld_async_task_t *sub_data = (dld_async_task_t *)task;
+	prv_batch_t *batch = sub_data->private;
+
+	if (error) {
+		DLEYNA_LOG_WARNING("Batch test on %s failed: %s", task->path,
+				   error->message);
+		g_error_free(error);
+	} else {
+		g_variant_builder_add(&batch->results, "{ou}", task->path,
+				      g_variant_get_uint32(task->result));
+	}
+
+	batch->running = g_list_remove(batch->running, task);
+	batch->running_count--;
+	dld_task_delete(task);
+
+	prv_batch_fill(batch);
+}
+
+static void prv_batch_fill(prv_batch_t *batch)
+{
+	gchar **paths = batch->cb_data->task.ut.batch.paths;
+	GVariant *params = batch->cb_data->task.ut.batch.params;
+	dld_async_task_t *sub_data;
+	dld_task_t *task;
+
+	while (!batch->cancelled && paths[batch->next] &&
+	       batch->running_count < DLD_UPNP_BATCH_MAX_RUNNING) {
+		task = batch->task_new(NULL, paths[batch->next], params);
+		batch->next++;
+
+		sub_data = (dld_async_task_t *)task;
+		sub_data->cancellable = g_cancellable_new();
+		sub_data->private = batch;
+
+		/* Lets the scheduler interleave the batch with other clients */
+		task->atom.queue_id = batch->cb_data->task.atom.queue_id;
+
+		batch->running = g_list_prepend(batch->running, task);
+		batch->running_count++;
+
+		/* Always completes from an idle or a SOAP callback */
+		batch->task_start(batch->upnp, task, prv_batch_task_complete);
+	}
+
+	if (!batch->running_count)
+		prv_batch_end(batch);
+}
+
+static void prv_batch_cancelled(GCancellable *cancellable, gpointer user_data)
+{
+	prv_batch_t *batch = user_data;
+	GList *l;
+
+	batch->cancelled = TRUE;
+
+	for (l = batch->running; l != NULL; l = l->next)
+		dld_async_task_cancel(l->data);
+}
+
+static void prv_batch_run(dld_upnp_t *upnp, dld_task_t *task,
+			  dld_upnp_task_complete_t cb,
+			  dld_task_new_t task_new,
+			  dld_upnp_task_run_t task_start)
+{
+	dld_async_task_t *cb_data = (dld_async_task_t *)task;
+	prv_batch_t *batch;
 
 	DLEYNA_LOG_DEBUG("Enter");
 
-	device = prv_get_and_check_device(upnp, task, cb);
-	if (device != NULL)
-		dld_device_get_traceroute_result(device, task, cb);
+	batch = g_new0(prv_batch_t, 1);
+	batch->upnp = upnp;
+	batch->cb_data = cb_data;
+	batch->task_new = task_new;
+	batch->task_start = task_start;
+	g_variant_builder_init(&batch->results, G_VARIANT_TYPE("a{ou}"));
+
+	cb_data->cb = cb;
+	cb_data->private = batch;
+	cb_data->free_private = prv_batch_free;
+	cb_data->cancel_id = g_cancellable_connect(
+					cb_data->cancellable,
+					G_CALLBACK(prv_batch_cancelled),
+					batch, NULL);
+
+	prv_batch_fill(batch);
 
 	DLEYNA_LOG_DEBUG("Exit");
 }
 
+void dld_upnp_batch_ping(dld_upnp_t *upnp, dld_task_t *task,
+			 dld_upnp_task_complete_t cb)
+{
+	prv_batch_run(upnp, task, cb, dld_task_ping_new, dld_upnp_ping);
+}
+
+void dld_upnp_batch_nslookup(dld_upnp_t *upnp, dld_task_t *task,
+			     dld_upnp_task_complete_t cb)
+{
+	prv_batch_run(upnp, task, cb, dld_task_nslookup_new,
+		      dld_upnp_nslookup);
+}
+
+void dld_upnp_batch_traceroute(dld_upnp_t *upnp, dld_task_t *task,
+			       dld_upnp_task_complete_t cb)
+{
+	prv_batch_run(upnp, task, cb, dld_task_traceroute_new,
+		      dld_upnp_traceroute);
+}
+
 void dld_upnp_unsubscribe(dld_upnp_t *upnp)
 {
 	GHashTableIter iter;
@@ -824,3 +1277,8 @@ GUPnPContextManager *dld_upnp_get_context_manager(dld_upnp_t *upnp)
 {
 	return upnp->context_manager;
 }
+
+dld_scheduler_t *dld_upnp_get_scheduler(dld_upnp_t *upnp)
+{
+	return upnp->scheduler;
+}
@@ -37,6 +37,8 @@ enum dld_interface_type_ {
 
 typedef void (*dld_upnp_callback_t)(const gchar *path);
 typedef void (*dld_upnp_task_complete_t)(dld_task_t *task, GError *error);
+typedef void (*dld_upnp_task_run_t)(dld_upnp_t *upnp, dld_task_t *task,
+				    dld_upnp_task_complete_t cb);
 
 dld_upnp_t *dld_upnp_new(dleyna_connector_id_t connection,
 			 const dleyna_connector_dispatch_cb_t *dispatch_table,
@@ -49,6 +51,8 @@ GVariant *dld_upnp_get_device_ids(dld_upnp_t *upnp);
 
 GHashTable *dld_upnp_get_device_udn_map(dld_upnp_t *upnp);
 
+GHashTable *dld_upnp_get_device_path_map(dld_upnp_t *upnp);
+
 void dld_upnp_get_prop(dld_upnp_t *upnp, dld_task_t *task,
 		       dld_upnp_task_complete_t cb);
 
@@ -82,10 +86,21 @@ void dld_upnp_traceroute(dld_upnp_t *upnp, dld_task_t *task,
 void dld_upnp_get_traceroute_result(dld_upnp_t *upnp, dld_task_t *task,
 				    dld_upnp_task_complete_t cb);
 
+void dld_upnp_batch_ping(dld_upnp_t *upnp, dld_task_t *task,
+			 dld_upnp_task_complete_t cb);
+
+void dld_upnp_batch_nslookup(dld_upnp_t *upnp, dld_task_t *task,
+			     dld_upnp_task_complete_t cb);
+
+void dld_upnp_batch_traceroute(dld_upnp_t *upnp, dld_task_t *task,
+			       dld_upnp_task_complete_t cb);
+
 void dld_upnp_unsubscribe(dld_upnp_t *upnp);
 
 void dld_upnp_rescan(dld_upnp_t *upnp);
 
 GUPnPContextManager *dld_upnp_get_context_manager(dld_upnp_t *upnp);
 
+dld_scheduler_t *dld_upnp_get_scheduler(dld_upnp_t *upnp);
+
 #endif /* DLD_UPNP_H__ */
@@ -23,6 +23,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <libxml/parser.h>
+
 #include "xml-util.h"
 
 static xmlNode *prv_get_child_node(xmlNode *node, va_list args)
@@ -131,3 +133,161 @@ gchar *xml_util_get_child_string_content_by_name(xmlNode *node, ...)
 
 	return str;
 }
+
+#define XML_UTIL_DEPTH_ROOT 1
+#define XML_UTIL_DEPTH_RECORD 2
+#define XML_UTIL_DEPTH_FIELD 3
+
+#define prv_field_slot(record, field) \
+	G_STRUCT_MEMBER(const gchar *, (record), (field)->offset)
+
+typedef struct prv_record_parser_t_ prv_record_parser_t;
+struct prv_record_parser_t_ {
+	const gchar *root_name;
+	const gchar *record_name;
+	const xml_util_field_t *fields;
+	guint n_fields;
+	gpointer record;
+	xml_util_record_cb_t cb;
+	gpointer user_data;
+	GString **values;
+	guint depth;
+	gboolean valid;
+	gboolean in_record;
+	gint field;
+};
+
+static void prv_clear_fields(const xml_util_field_t *fields, guint n_fields,
+			     gpointer record)
+{
+	unsigned int i;
+
+	for (i = 0; i < n_fields; ++i)
+		prv_field_slot(record, &fields[i]) = NULL;
+}
+
+static void prv_record_start_element(void *ctx,
+				     const xmlChar *localname,
+				     const xmlChar *prefix,
+				     const xmlChar *uri,
+				     int nb_namespaces,
+				     const xmlChar **namespaces,
+				     int nb_attributes,
+				     int nb_defaulted,
+				     const xmlChar **attributes)
+{
+	prv_record_parser_t *parser = ctx;
+	const gchar *name = (const gchar *)localname;
+	unsigned int i;
+
+	switch (++parser->depth) {
+	case XML_UTIL_DEPTH_ROOT:
+		parser->valid = !strcmp(name, parser->root_name);
+		break;
+	case XML_UTIL_DEPTH_RECORD:
+		parser->in_record = parser->valid &&
+				    !strcmp(name, parser->record_name);
+		if (parser->in_record)
+			prv_clear_fields(parser->fields, parser->n_fields,
+					 parser->record);
+		break;
+	case XML_UTIL_DEPTH_FIELD:
+		if (!parser->in_record)
+			break;
+
+		for (i = 0; i < parser->n_fields; ++i) {
+			if (prv_field_slot(parser->record,
+					   &parser->fields[i]) == NULL &&
+			    !strcmp(name, parser->fields[i].name)) {
+				g_string_truncate(parser->values[i], 0);
+				parser->field = i;
+				break;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static void prv_record_end_element(void *ctx,
+				   const xmlChar *localname,
+				   const xmlChar *prefix,
+				   const xmlChar *uri)
+{
+	prv_record_parser_t *parser = ctx;
+	const xml_util_field_t *field;
+
+	switch (parser->depth--) {
+	case XML_UTIL_DEPTH_RECORD:
+		if (parser->in_record)
+			parser->cb(parser->record, parser->user_data);
+		parser->in_record = FALSE;
+		break;
+	case XML_UTIL_DEPTH_FIELD:
+		if (parser->field < 0)
+			break;
+
+		field = &parser->fields[parser->field];
+		prv_field_slot(parser->record, field) =
+					parser->values[parser->field]->str;
+		parser->field = -1;
+		break;
+	default:
+		break;
+	}
+}
+
+static void prv_record_characters(void *ctx, const xmlChar *ch, int len)
+{
+	prv_record_parser_t *parser = ctx;
+
+	if (parser->field >= 0)
+		g_string_append_len(parser->values[parser->field],
+				    (const gchar *)ch, len);
+}
+
+gboolean xml_util_parse_records(const gchar *xml,
+				const gchar *root_name,
+				const gchar *record_name,
+				const xml_util_field_t *fields,
+				guint n_fields,
+				gpointer record,
+				xml_util_record_cb_t cb,
+				gpointer user_data)
+{
+	xmlSAXHandler handler;
+	prv_record_parser_t parser;
+	gboolean retval;
+	unsigned int i;
+
+	memset(&handler, 0, sizeof(handler));
+	handler.initialized = XML_SAX2_MAGIC;
+	handler.startElementNs = prv_record_start_element;
+	handler.endElementNs = prv_record_end_element;
+	handler.characters = prv_record_characters;
+	handler.cdataBlock = prv_record_characters;
+
+	memset(&parser, 0, sizeof(parser));
+	parser.root_name = root_name;
+	parser.record_name = record_name;
+	parser.fields = fields;
+	parser.n_fields = n_fields;
+	parser.record = record;
+	parser.cb = cb;
+	parser.user_data = user_data;
+	parser.field = -1;
+
+	parser.values = g_new(GString *, n_fields);
+	for (i = 0; i < n_fields; ++i)
+		parser.values[i] = g_string_sized_new(64);
+
+	retval = xmlSAXUserParseMemory(&handler, &parser, xml,
+				       strlen(xml)) == 0 && parser.valid;
+
+	for (i = 0; i < n_fields; ++i)
+		(void) g_string_free(parser.values[i], TRUE);
+	g_free(parser.values);
+
+	return retval;
+}
@@ -28,8 +28,29 @@
 #include <stdarg.h>
 #include <libxml/tree.h>
 
+/* Maps the text of a child element to a 'const gchar *' member of a
+ * record, located at 'offset' (see G_STRUCT_OFFSET).  Strings stored in
+ * records are borrowed from the parser and must not be freed.
+ */
+typedef struct xml_util_field_t_ xml_util_field_t;
+struct xml_util_field_t_ {
+	const gchar *name;
+	glong offset;
+};
+
+typedef void (*xml_util_record_cb_t)(gpointer record, gpointer user_data);
+
 GList *xml_util_get_child_string_list_content_by_name(xmlNode *node, ...);
 
 gchar *xml_util_get_child_string_content_by_name(xmlNode *node, ...);
 
+gboolean xml_util_parse_records(const gchar *xml,
+				const gchar *root_name,
+				const gchar *record_name,
+				const xml_util_field_t *fields,
+				guint n_fields,
+				gpointer record,
+				xml_util_record_cb_t cb,
+				gpointer user_data);
+
 #endif /* DLS_XML_UTIL_H__ */
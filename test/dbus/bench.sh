@@ -0,0 +1,10 @@
+SCRIPT=bms_bench.py
+
+case "$1" in
+--registry)
+	SCRIPT=registry_bench.py
+	shift
+	;;
+esac
+
+DLEYNA_BENCH_PRIVATE_BUS=1 dbus-run-session -- python $SCRIPT "$@"
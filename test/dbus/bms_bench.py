@@ -0,0 +1,490 @@
+# bms_bench
+#
+# Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU Lesser General Public License,
+# version 2.1, as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+# for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+# Starts simulated BasicManagement devices on the loopback interface and a
+# dleyna-diagnostics-service, then measures the throughput and latency of a
+# Ping/GetTestInfo/GetPingResult mix.  Run it through bench.sh so that the
+# service is driven over a private session bus.
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+import uuid
+
+import gi
+gi.require_version('GUPnP', '1.0')
+from gi.repository import GLib, GObject, GUPnP
+
+import dbus
+import dbus.mainloop.glib
+
+SERVICE_NAME = 'com.intel.dleyna-diagnostics'
+MANAGER_PATH = '/com/intel/dLeynaDiagnostics'
+MANAGER_IF = 'com.intel.dLeynaDiagnostics.Manager'
+DEVICE_IF = 'com.intel.dLeynaDiagnostics.Device'
+PROPS_IF = 'org.freedesktop.DBus.Properties'
+
+BMS_TYPE = 'urn:schemas-upnp-org:service:BasicManagement:2'
+FRIENDLY_NAME = 'dLeyna BMS mock'
+
+DEVICE_XML = '''<?xml version="1.0"?>
+<root xmlns="urn:schemas-upnp-org:device-1-0">
+  <specVersion><major>1</major><minor>0</minor></specVersion>
+  <device>
+    <deviceType>urn:schemas-upnp-org:device:Basic:1</deviceType>
+    <friendlyName>%(name)s</friendlyName>
+    <manufacturer>dLeyna</manufacturer>
+    <modelName>BMS mock</modelName>
+    <UDN>%(udn)s</UDN>
+    <serviceList>
+      <service>
+        <serviceType>''' + BMS_TYPE + '''</serviceType>
+        <serviceId>urn:upnp-org:serviceId:BasicManagement</serviceId>
+        <SCPDURL>/bms.xml</SCPDURL>
+        <controlURL>/BasicManagement/control</controlURL>
+        <eventSubURL>/BasicManagement/event</eventSubURL>
+      </service>
+    </serviceList>
+  </device>
+</root>
+'''
+
+def scpd_action(name, in_args, out_args):
+    args = ''
+    for arg, variable in in_args:
+        args += ('<argument><name>%s</name><direction>in</direction>'
+                 '<relatedStateVariable>%s</relatedStateVariable>'
+                 '</argument>' % (arg, variable))
+    for arg, variable in out_args:
+        args += ('<argument><name>%s</name><direction>out</direction>'
+                 '<relatedStateVariable>%s</relatedStateVariable>'
+                 '</argument>' % (arg, variable))
+    return ('<action><name>%s</name><argumentList>%s</argumentList>'
+            '</action>' % (name, args))
+
+def scpd_variable(name, data_type, evented = False):
+    return ('<stateVariable sendEvents="%s"><name>%s</name>'
+            '<dataType>%s</dataType></stateVariable>' %
+            ('yes' if evented else 'no', name, data_type))
+
+TEST_ID = [('TestID', 'A_ARG_TYPE_TestID')]
+
+SCPD_XML = ('<?xml version="1.0"?>'
+            '<scpd xmlns="urn:schemas-upnp-org:service-1-0">'
+            '<specVersion><major>1</major><minor>0</minor></specVersion>'
+            '<actionList>' +
+            scpd_action('Ping',
+                        [('Host', 'A_ARG_TYPE_String'),
+                         ('NumberOfRepetitions', 'A_ARG_TYPE_UInt'),
+                         ('Timeout', 'A_ARG_TYPE_UInt'),
+                         ('DataBlockSize', 'A_ARG_TYPE_UInt'),
+                         ('DSCP', 'A_ARG_TYPE_UInt')],
+                        TEST_ID) +
+            scpd_action('GetPingResult', TEST_ID,
+                        [('Status', 'A_ARG_TYPE_String'),
+                         ('AdditionalInfo', 'A_ARG_TYPE_String'),
+                         ('SuccessCount', 'A_ARG_TYPE_UInt'),
+                         ('FailureCount', 'A_ARG_TYPE_UInt'),
+                         ('AverageResponseTime', 'A_ARG_TYPE_UInt'),
+                         ('MinimumResponseTime', 'A_ARG_TYPE_UInt'),
+                         ('MaximumResponseTime', 'A_ARG_TYPE_UInt')]) +
+            scpd_action('GetTestInfo', TEST_ID,
+                        [('Type', 'A_ARG_TYPE_String'),
+                         ('State', 'A_ARG_TYPE_String')]) +
+            scpd_action('CancelTest', TEST_ID, []) +
+            '</actionList><serviceStateTable>' +
+            scpd_variable('A_ARG_TYPE_TestID', 'ui4') +
+            scpd_variable('A_ARG_TYPE_String', 'string') +
+            scpd_variable('A_ARG_TYPE_UInt', 'ui4') +
+            scpd_variable('DeviceStatus', 'string', True) +
+            scpd_variable('TestIDs', 'string', True) +
+            scpd_variable('ActiveTestIDs', 'string', True) +
+            '</serviceStateTable></scpd>')
+
+def string_value(value):
+    gvalue = GObject.Value()
+    gvalue.init(GObject.TYPE_STRING)
+    gvalue.set_string(value)
+    return gvalue
+
+def uint_value(value):
+    gvalue = GObject.Value()
+    gvalue.init(GObject.TYPE_UINT)
+    gvalue.set_uint(value)
+    return gvalue
+
+class MockBMS(object):
+
+    def __init__(self, context, folder, index, options):
+        self._options = options
+        self._tests = {}
+        self._next_id = 1
+        self._status = 0
+        self.udn = 'uuid:' + str(uuid.uuid4())
+
+        name = 'device%d.xml' % index
+        with open(os.path.join(folder, name), 'w') as f:
+            f.write(DEVICE_XML % {'name': '%s %d' % (FRIENDLY_NAME, index),
+                                  'udn': self.udn})
+
+        self._device = GUPnP.RootDevice.new(context, name, folder)
+        self._service = self._device.get_service(BMS_TYPE)
+
+        for action in ['Ping', 'GetPingResult', 'GetTestInfo', 'CancelTest']:
+            self._service.connect('action-invoked::' + action,
+                                  getattr(self, '_on_' + action))
+        self._service.connect('query-variable', self._on_query)
+
+        self._device.set_available(True)
+
+        if options.event_rate > 0:
+            GLib.timeout_add(int(1000 / options.event_rate),
+                             self._on_event_timer)
+
+    def _test_ids(self, active):
+        ids = [i for i, state in sorted(self._tests.items())
+               if not active or state == 'InProgress']
+        return ','.join(str(i) for i in ids)
+
+    def _notify_tests(self):
+        self._service.notify_value('TestIDs',
+                                   string_value(self._test_ids(False)))
+        self._service.notify_value('ActiveTestIDs',
+                                   string_value(self._test_ids(True)))
+
+    def _reply(self, action, values):
+        def reply():
+            for name, value in values:
+                action.set_value(name, value)
+            action.return_()
+            return False
+
+        if self._options.latency:
+            GLib.timeout_add(self._options.latency, reply)
+        else:
+            reply()
+
+    def _reply_error(self, action, code, message):
+        def reply():
+            action.return_error(code, message)
+            return False
+
+        GLib.timeout_add(self._options.latency, reply)
+
+    def _test(self, action):
+        test_id = action.get_gvalue('TestID', GObject.TYPE_UINT)
+        return test_id, self._tests.get(test_id)
+
+    def _complete(self, test_id):
+        if test_id in self._tests:
+            self._tests[test_id] = 'Completed'
+            self._notify_tests()
+        return False
+
+    def _on_Ping(self, service, action):
+        test_id = self._next_id
+        self._next_id += 1
+
+        self._tests[test_id] = 'InProgress'
+        if len(self._tests) > self._options.max_tests:
+            del self._tests[min(self._tests)]
+
+        GLib.timeout_add(self._options.test_duration, self._complete,
+                         test_id)
+        self._reply(action, [('TestID', uint_value(test_id))])
+        self._notify_tests()
+
+    def _on_GetPingResult(self, service, action):
+        test_id, state = self._test(action)
+        if state is None:
+            self._reply_error(action, 706, 'Invalid TestID')
+            return
+
+        self._reply(action, [('Status', string_value('Success')),
+                             ('AdditionalInfo', string_value('')),
+                             ('SuccessCount', uint_value(1)),
+                             ('FailureCount', uint_value(0)),
+                             ('AverageResponseTime', uint_value(1)),
+                             ('MinimumResponseTime', uint_value(1)),
+                             ('MaximumResponseTime', uint_value(1))])
+
+    def _on_GetTestInfo(self, service, action):
+        test_id, state = self._test(action)
+        if state is None:
+            self._reply_error(action, 706, 'Invalid TestID')
+            return
+
+        self._reply(action, [('Type', string_value('Ping')),
+                             ('State', string_value(state))])
+
+    def _on_CancelTest(self, service, action):
+        test_id, state = self._test(action)
+        if state is None:
+            self._reply_error(action, 706, 'Invalid TestID')
+            return
+
+        self._tests[test_id] = 'Canceled'
+        self._reply(action, [])
+        self._notify_tests()
+
+    def _on_query(self, service, variable, value):
+        if variable == 'DeviceStatus':
+            text = 'OK,%d' % self._status
+        elif variable == 'TestIDs':
+            text = self._test_ids(False)
+        elif variable == 'ActiveTestIDs':
+            text = self._test_ids(True)
+        else:
+            return
+
+        value.init(GObject.TYPE_STRING)
+        value.set_string(text)
+
+    def _on_event_timer(self):
+        self._status += 1
+        self._service.notify_value('DeviceStatus',
+                                   string_value('OK,%d' % self._status))
+        return True
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    return values[min(len(values) - 1, int(len(values) * fraction))]
+
+class Load(object):
+
+    def __init__(self, bus, paths, options, loop):
+        self._options = options
+        self._loop = loop
+        self._devices = [dbus.Interface(bus.get_object(SERVICE_NAME, path),
+                                        DEVICE_IF) for path in paths]
+        self._tests = dict((device, []) for device in self._devices)
+        self._mix = []
+        for entry in options.mix.split(','):
+            op, weight = entry.split(':')
+            self._mix += [op] * int(weight)
+        self._latencies = dict((op, []) for op in set(self._mix))
+        self._errors = dict((op, 0) for op in set(self._mix))
+        self._in_flight = 0
+        self._stopping = False
+
+    def start(self):
+        self._start_time = time.time()
+        for i in range(self._options.concurrency):
+            self._issue()
+        GLib.timeout_add(self._options.duration * 1000, self._stop)
+
+    def _stop(self):
+        self._stopping = True
+        self._elapsed = time.time() - self._start_time
+        if not self._in_flight:
+            self._loop.quit()
+        return False
+
+    def _done(self, op, begin, error = None):
+        self._in_flight -= 1
+        if error is None:
+            self._latencies[op].append(time.time() - begin)
+        else:
+            self._errors[op] += 1
+
+        if not self._stopping:
+            self._issue()
+        elif not self._in_flight:
+            self._loop.quit()
+
+    def _issue(self):
+        device = random.choice(self._devices)
+        tests = self._tests[device]
+        op = random.choice(self._mix)
+        if not tests:
+            op = 'ping'
+
+        begin = time.time()
+        on_error = lambda e: self._done(op, begin, e)
+
+        self._in_flight += 1
+        if op == 'ping':
+            def on_ping(test_id):
+                tests.append(test_id)
+                del tests[:-self._options.max_tests]
+                self._done(op, begin)
+
+            device.Ping('127.0.0.1', 1, 1000, 32, 0,
+                        reply_handler=on_ping, error_handler=on_error)
+        elif op == 'info':
+            device.GetTestInfo(random.choice(tests),
+                               reply_handler=lambda *r: self._done(op, begin),
+                               error_handler=on_error)
+        elif op == 'result':
+            device.GetPingResult(random.choice(tests),
+                                 reply_handler=lambda *r: self._done(op,
+                                                                     begin),
+                                 error_handler=on_error)
+        else:
+            raise ValueError('Unknown operation ' + op)
+
+    def report(self):
+        total = []
+        errors = 0
+        print('%-8s %8s %8s %10s %10s %10s' %
+              ('Action', 'Count', 'Errors', 'Req/s', 'p50 (ms)', 'p99 (ms)'))
+        for op in sorted(self._latencies):
+            latencies = sorted(self._latencies[op])
+            total += latencies
+            errors += self._errors[op]
+            print('%-8s %8d %8d %10.1f %10.2f %10.2f' %
+                  (op, len(latencies), self._errors[op],
+                   len(latencies) / self._elapsed,
+                   percentile(latencies, 0.5) * 1000,
+                   percentile(latencies, 0.99) * 1000))
+        total.sort()
+        print('%-8s %8d %8d %10.1f %10.2f %10.2f' %
+              ('total', len(total), errors, len(total) / self._elapsed,
+               percentile(total, 0.5) * 1000,
+               percentile(total, 0.99) * 1000))
+
+def allocations(manager):
+    tasks = manager.GetStatistics()['Tasks']
+    return (int(tasks['Tasks']),
+            int(tasks['TaskAllocations']) + int(tasks['StringAllocations']))
+
+def wait_for(loop, predicate, timeout):
+    deadline = time.time() + timeout
+    context = loop.get_context()
+    while not predicate():
+        if time.time() > deadline:
+            return False
+        context.iteration(False)
+        time.sleep(0.01)
+    return True
+
+def rss(pid):
+    values = {}
+    with open('/proc/%d/status' % pid) as f:
+        for line in f:
+            key, _, value = line.partition(':')
+            if key in ('VmRSS', 'VmHWM'):
+                values[key] = value.strip()
+    return values
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description='Load benchmark of dleyna-diagnostics-service')
+    parser.add_argument('service',
+                        help='path to the dleyna-diagnostics-service binary')
+    parser.add_argument('--devices', type=int, default=4,
+                        help='number of simulated devices')
+    parser.add_argument('--interface', default='lo',
+                        help='network interface of the simulated devices')
+    parser.add_argument('--latency', type=int, default=10,
+                        help='UPnP action latency in milliseconds')
+    parser.add_argument('--test-duration', type=int, default=100,
+                        help='duration of a simulated test in milliseconds')
+    parser.add_argument('--event-rate', type=float, default=1.0,
+                        help='DeviceStatus events per second and device')
+    parser.add_argument('--max-tests', type=int, default=64,
+                        help='number of tests remembered by a device')
+    parser.add_argument('--duration', type=int, default=30,
+                        help='duration of the measure in seconds')
+    parser.add_argument('--concurrency', type=int, default=16,
+                        help='number of requests in flight')
+    parser.add_argument('--mix', default='ping:1,info:4,result:4',
+                        help='weights of the ping, info and result requests')
+    return parser.parse_args()
+
+if __name__ == '__main__':
+    options = parse_args()
+
+    if 'DLEYNA_BENCH_PRIVATE_BUS' not in os.environ:
+        print('Run through bench.sh to use a private session bus',
+              file=sys.stderr)
+        sys.exit(1)
+
+    dbus.mainloop.glib.DBusGMainLoop(set_as_default=True)
+    loop = GLib.MainLoop()
+    bus = dbus.SessionBus()
+
+    folder = tempfile.mkdtemp()
+    with open(os.path.join(folder, 'bms.xml'), 'w') as f:
+        f.write(SCPD_XML)
+
+    try:
+        context = GUPnP.Context.new(None, options.interface, 0)
+    except TypeError:
+        context = GUPnP.Context.new(options.interface, 0)
+
+    devices = [MockBMS(context, folder, i, options)
+               for i in range(options.devices)]
+    udns = set(device.udn for device in devices)
+
+    service = subprocess.Popen([options.service])
+
+    try:
+        if not wait_for(loop, lambda: bus.name_has_owner(SERVICE_NAME), 10):
+            sys.exit('dleyna-diagnostics-service did not start')
+
+        pid = int(bus.get_object('org.freedesktop.DBus',
+                                 '/org/freedesktop/DBus').
+                  GetConnectionUnixProcessID(SERVICE_NAME))
+        manager = dbus.Interface(bus.get_object(SERVICE_NAME, MANAGER_PATH),
+                                 MANAGER_IF)
+
+        paths = []
+        def found():
+            del paths[:]
+            for path in manager.GetDevices():
+                props = dbus.Interface(bus.get_object(SERVICE_NAME, path),
+                                       PROPS_IF)
+                if props.Get('', 'UDN') in udns:
+                    paths.append(path)
+            return len(paths) == len(udns)
+
+        if not wait_for(loop, found, 30):
+            sys.exit('Found %d of %d devices' % (len(paths), len(udns)))
+
+        print('Devices: %d, latency: %d ms, concurrency: %d, duration: %d s' %
+              (len(paths), options.latency, options.concurrency,
+               options.duration))
+        print('RSS before: %(VmRSS)s' % rss(pid))
+
+        tasks_before, allocs_before = allocations(manager)
+
+        load = Load(bus, paths, options, loop)
+        load.start()
+        loop.run()
+        load.report()
+
+        tasks_after, allocs_after = allocations(manager)
+        print('Task heap allocations per request: %.3f' %
+              (float(allocs_after - allocs_before) /
+               max(1, tasks_after - tasks_before)))
+
+        values = rss(pid)
+        print('RSS after: %s, peak: %s' % (values['VmRSS'], values['VmHWM']))
+    finally:
+        service.terminate()
+        service.wait()
+        shutil.rmtree(folder)
@@ -0,0 +1,424 @@
+# local_test
+#
+# Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU Lesser General Public License,
+# version 2.1, as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+# for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+# Runs the tests of the local diagnostics device against the loopback
+# interface and checks their results.  NSLookup queries are answered by a
+# stub DNS server bound to 127.0.0.1.  Run it through test.sh so that the
+# service is driven over a private session bus.  The exit status is 1 if
+# any test failed.
+
+from __future__ import print_function
+
+import argparse
+import os
+import socket
+import struct
+import subprocess
+import sys
+import threading
+
+from gi.repository import GLib
+
+import dbus
+import dbus.mainloop.glib
+
+from bms_bench import SERVICE_NAME, MANAGER_PATH, MANAGER_IF, DEVICE_IF
+from bms_bench import PROPS_IF, wait_for
+
+LOCAL_TYPE = 'urn:dleyna-org:device:LocalDiagnostics:1'
+
+DNS_FLAG_RESPONSE = 0x8000
+DNS_FLAG_AUTHORITATIVE = 0x0400
+DNS_FLAG_TRUNCATED = 0x0200
+DNS_FLAG_RECURSION = 0x0180
+DNS_RCODE_SERVER_FAILURE = 2
+DNS_RCODE_NAME_ERROR = 3
+DNS_TYPE_A = 1
+DNS_TYPE_AAAA = 28
+DNS_CLASS_IN = 1
+
+# Compression pointer to the name of the question, right after the header
+DNS_QUESTION_NAME = b'\xc0\x0c'
+
+class Failure(Exception):
+    pass
+
+class Skip(Exception):
+    pass
+
+def expect(what, actual, expected):
+    if actual != expected:
+        raise Failure('%s is %r, expected %r' % (what, actual, expected))
+
+def dns_record(rtype, rdata, name = DNS_QUESTION_NAME):
+    return name + struct.pack('>HHIH', rtype, DNS_CLASS_IN, 60,
+                              len(rdata)) + rdata
+
+def dns_a(address):
+    return dns_record(DNS_TYPE_A, socket.inet_aton(address))
+
+def dns_aaaa(address):
+    return dns_record(DNS_TYPE_AAAA, socket.inet_pton(socket.AF_INET6,
+                                                      address))
+
+class DNSStub(object):
+
+    '''Answers A queries on 127.0.0.1 from canned responses.
+
+    Each response is a (flags, answers) tuple, where answers is a list of
+    resource records or a function building the answer section from the
+    offset at which it starts.  Unknown names get a server failure and
+    names mapped to None get no answer at all.
+    '''
+
+    RESPONSES = {
+        'a.test': (DNS_FLAG_AUTHORITATIVE,
+                   [dns_a('10.0.0.1'), dns_aaaa('fd00::1'),
+                    dns_a('10.0.0.2')]),
+        'aaaa.test': (0, [dns_aaaa('fd00::1')]),
+        'missing.test': (DNS_FLAG_AUTHORITATIVE | DNS_RCODE_NAME_ERROR, []),
+        'truncated.test': (DNS_FLAG_AUTHORITATIVE | DNS_FLAG_TRUNCATED,
+                           [dns_a('10.0.0.1')[:-2]]),
+        'loop.test': (DNS_FLAG_AUTHORITATIVE,
+                      lambda offset: [dns_record(
+                          DNS_TYPE_A, socket.inet_aton('10.0.0.1'),
+                          struct.pack('>H', 0xc000 | offset))]),
+        'silent.test': None
+    }
+
+    def __init__(self):
+        self._socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self._socket.bind(('127.0.0.1', 0))
+        self._socket.settimeout(0.1)
+        self.address = '127.0.0.1:%d' % self._socket.getsockname()[1]
+        self._stopping = False
+        self._thread = threading.Thread(target=self._serve)
+        self._thread.daemon = True
+        self._thread.start()
+
+    def close(self):
+        self._stopping = True
+        self._thread.join()
+        self._socket.close()
+
+    def _serve(self):
+        while not self._stopping:
+            try:
+                query, peer = self._socket.recvfrom(512)
+            except socket.timeout:
+                continue
+
+            reply = self._reply(bytearray(query))
+            if reply is not None:
+                self._socket.sendto(reply, peer)
+
+    def _reply(self, query):
+        labels = []
+        offset = 12
+        while query[offset]:
+            length = query[offset]
+            labels.append(query[offset + 1:offset + 1 + length].decode())
+            offset += 1 + length
+        question = bytes(query[12:offset + 5])
+
+        name = '.'.join(labels)
+        if name not in self.RESPONSES:
+            response = (DNS_RCODE_SERVER_FAILURE, [])
+        else:
+            response = self.RESPONSES[name]
+            if response is None:
+                return None
+
+        flags, answers = response
+        if callable(answers):
+            answers = answers(12 + len(question))
+
+        header = bytes(query[:2]) + struct.pack(
+            '>HHHHH', DNS_FLAG_RESPONSE | DNS_FLAG_RECURSION | flags, 1,
+            len(answers), 0, 0)
+
+        return header + question + b''.join(answers)
+
+class Context(object):
+
+    def __init__(self, loop, device, options):
+        self.loop = loop
+        self.device = device
+        self.options = options
+
+    def run(self, test, *args):
+        test_id = getattr(self.device, test)(*args)
+        if not wait_for(self.loop,
+                        lambda: self.device.GetTestInfo(test_id)[1] ==
+                        'Completed', self.options.timeout):
+            raise Failure('%s test %u did not complete' % (test, test_id))
+
+        return getattr(self.device, 'Get%sResult' % test)(test_id)
+
+def nslookup_expect(context, hostname, expected, repeat = 1,
+                    dns_server = None, timeout = 1000):
+    status, info, success, results = context.run(
+        'NSLookup', hostname, dns_server or context.dns.address, repeat,
+        timeout)
+
+    expect('TestStatus', status, 'Success')
+    expect('NSLookupResult count', len(results), repeat)
+    expect('SuccessCount', success,
+           repeat if expected[0] == 'Success' else 0)
+
+    for result in results:
+        expect('Result', tuple(result[:3]) +
+               (list(result[3]), result[4]), expected)
+
+def test_nslookup_a(context):
+    nslookup_expect(context, 'a.test',
+                    ('Success', 'Authoritative', 'a.test',
+                     ['10.0.0.1', '10.0.0.2'], '127.0.0.1'), repeat = 3)
+
+def test_nslookup_aaaa_only(context):
+    nslookup_expect(context, 'aaaa.test',
+                    ('Error_HostNameNotResolved', 'NonAuthoritative', '', [],
+                     '127.0.0.1'))
+
+def test_nslookup_nxdomain(context):
+    nslookup_expect(context, 'missing.test',
+                    ('Error_HostNameNotResolved', 'None', '', [],
+                     '127.0.0.1'))
+
+def test_nslookup_server_failure(context):
+    nslookup_expect(context, 'unknown.test',
+                    ('Error_Other', 'None', '', [], '127.0.0.1'))
+
+def test_nslookup_truncated(context):
+    nslookup_expect(context, 'truncated.test',
+                    ('Error_Other', 'None', '', [], '127.0.0.1'))
+
+def test_nslookup_pointer_loop(context):
+    nslookup_expect(context, 'loop.test',
+                    ('Error_Other', 'None', '', [], '127.0.0.1'))
+
+def test_nslookup_timeout(context):
+    nslookup_expect(context, 'silent.test',
+                    ('Error_Timeout', 'None', '', [], '127.0.0.1'),
+                    timeout = 200)
+
+def test_nslookup_refused(context):
+    closed = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    closed.bind(('127.0.0.1', 0))
+    port = closed.getsockname()[1]
+    closed.close()
+
+    nslookup_expect(context, 'a.test',
+                    ('Error_DNSServerNotAvailable', 'None', '', [],
+                     '127.0.0.1'), repeat = 2,
+                    dns_server = '127.0.0.1:%d' % port)
+
+def test_nslookup_bad_server(context):
+    status, info, success, results = context.run(
+        'NSLookup', 'a.test', 'not-an-address', 1, 0)
+
+    expect('TestStatus', status, 'Error_DNSServerNotResolved')
+    expect('NSLookupResult count', len(results), 0)
+
+def test_nslookup_bad_hostname(context):
+    status, info, success, results = context.run(
+        'NSLookup', 'a..test', context.dns.address, 1, 0)
+
+    expect('TestStatus', status, 'Error_Other')
+    expect('NSLookupResult count', len(results), 0)
+
+def ping_expect(context, repeat, count):
+    status, info, success, failure, avg, min_time, max_time = context.run(
+        'Ping', '127.0.0.1', repeat, 1000, 32, 0)
+
+    if status == 'Error_Internal':
+        raise Failure('%s, check the net.ipv4.ping_group_range sysctl' %
+                      info)
+
+    expect('TestStatus', status, 'Success')
+    expect('SuccessCount', success, count)
+    expect('FailureCount', failure, 0)
+
+    if not min_time <= avg <= max_time < 1000:
+        raise Failure('Response times are min %u, avg %u, max %u' %
+                      (min_time, avg, max_time))
+
+def test_ping_loopback(context):
+    ping_expect(context, 3, 3)
+
+def test_ping_default_repeat(context):
+    ping_expect(context, 0, 1)
+
+def test_ping_unresolved(context):
+    result = context.run('Ping', '::1', 1, 1000, 32, 0)
+
+    expect('TestStatus', result[0], 'Error_CannotResolveHostName')
+    expect('Counts and times', tuple(result[2:]), (0, 0, 0, 0, 0))
+
+def traceroute_expect(context, host, hops):
+    status, info, rsp_time, hop_hosts = context.run(
+        'Traceroute', host, 2000, 0, 5, 0)
+
+    expect('TestStatus', status, 'Success')
+    expect('HopHosts', list(hop_hosts), hops)
+
+    if not rsp_time:
+        raise Failure('ResponseTime is zero')
+
+def test_traceroute_loopback(context):
+    traceroute_expect(context, '127.0.0.1', ['127.0.0.1'])
+
+def test_traceroute_unresolved(context):
+    status, info, rsp_time, hop_hosts = context.run(
+        'Traceroute', '::1', 2000, 0, 5, 0)
+
+    expect('TestStatus', status, 'Error_CannotResolveHostName')
+    expect('HopHosts', list(hop_hosts), [])
+
+# The target namespace is reached from the host through a router namespace:
+# host 10.213.1.1 - 10.213.1.2 router 10.213.2.1 - 10.213.2.2 target
+NETNS_SETUP = [
+    'ip netns add dld-router',
+    'ip netns add dld-target',
+    'ip link add dld-h0 type veth peer name dld-r0',
+    'ip link set dld-r0 netns dld-router',
+    'ip -n dld-router link add dld-r1 type veth peer name dld-t0',
+    'ip -n dld-router link set dld-t0 netns dld-target',
+    'ip addr add 10.213.1.1/24 dev dld-h0',
+    'ip link set dld-h0 up',
+    'ip -n dld-router addr add 10.213.1.2/24 dev dld-r0',
+    'ip -n dld-router addr add 10.213.2.1/24 dev dld-r1',
+    'ip -n dld-router link set dld-r0 up',
+    'ip -n dld-router link set dld-r1 up',
+    'ip netns exec dld-router sysctl -qw net.ipv4.ip_forward=1',
+    'ip -n dld-target addr add 10.213.2.2/24 dev dld-t0',
+    'ip -n dld-target link set dld-t0 up',
+    'ip -n dld-target route add default via 10.213.2.1',
+    'ip route add 10.213.2.0/24 via 10.213.1.2'
+]
+
+NETNS_CLEANUP = [
+    'ip netns del dld-router',
+    'ip netns del dld-target'
+]
+
+def test_traceroute_multihop(context):
+    if not context.options.netns:
+        raise Skip('needs --netns, which creates the dld-router and '
+                   'dld-target network namespaces as root')
+
+    try:
+        for command in NETNS_SETUP:
+            if subprocess.call(command.split()):
+                raise Failure('%s failed' % command)
+
+        traceroute_expect(context, '10.213.2.2',
+                          ['10.213.1.2', '10.213.2.2'])
+    finally:
+        with open(os.devnull, 'w') as null:
+            for command in NETNS_CLEANUP:
+                subprocess.call(command.split(), stderr=null)
+
+TESTS = [
+    ('nslookup-a', test_nslookup_a),
+    ('nslookup-aaaa-only', test_nslookup_aaaa_only),
+    ('nslookup-nxdomain', test_nslookup_nxdomain),
+    ('nslookup-server-failure', test_nslookup_server_failure),
+    ('nslookup-truncated', test_nslookup_truncated),
+    ('nslookup-pointer-loop', test_nslookup_pointer_loop),
+    ('nslookup-timeout', test_nslookup_timeout),
+    ('nslookup-refused', test_nslookup_refused),
+    ('nslookup-bad-server', test_nslookup_bad_server),
+    ('nslookup-bad-hostname', test_nslookup_bad_hostname),
+    ('ping-loopback', test_ping_loopback),
+    ('ping-default-repeat', test_ping_default_repeat),
+    ('ping-unresolved', test_ping_unresolved),
+    ('traceroute-loopback', test_traceroute_loopback),
+    ('traceroute-unresolved', test_traceroute_unresolved),
+    ('traceroute-multihop', test_traceroute_multihop)
+]
+
+def local_device(bus, manager):
+    for path in manager.GetDevices():
+        props = dbus.Interface(bus.get_object(SERVICE_NAME, path), PROPS_IF)
+        if props.Get('', 'DeviceType') == LOCAL_TYPE:
+            return dbus.Interface(bus.get_object(SERVICE_NAME, path),
+                                  DEVICE_IF)
+    return None
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description='Loopback tests of the local diagnostics device')
+    parser.add_argument('service',
+                        help='path to the dleyna-diagnostics-service binary')
+    parser.add_argument('tests', nargs='*',
+                        help='names of the tests to run, all by default')
+    parser.add_argument('--timeout', type=int, default=10,
+                        help='time given to each test, in seconds')
+    parser.add_argument('--netns', action='store_true',
+                        help='run the multi-hop traceroute test in network '
+                        'namespaces, requires root')
+    return parser.parse_args()
+
+if __name__ == '__main__':
+    options = parse_args()
+
+    if 'DLEYNA_TEST_PRIVATE_BUS' not in os.environ:
+        print('Run through test.sh to use a private session bus',
+              file=sys.stderr)
+        sys.exit(1)
+
+    dbus.mainloop.glib.DBusGMainLoop(set_as_default=True)
+    loop = GLib.MainLoop()
+    bus = dbus.SessionBus()
+
+    service = subprocess.Popen([options.service])
+    failed = 0
+
+    try:
+        if not wait_for(loop, lambda: bus.name_has_owner(SERVICE_NAME), 10):
+            sys.exit('dleyna-diagnostics-service did not start')
+
+        manager = dbus.Interface(bus.get_object(SERVICE_NAME, MANAGER_PATH),
+                                 MANAGER_IF)
+        device = local_device(bus, manager)
+        if device is None:
+            sys.exit('No local diagnostics device')
+
+        context = Context(loop, device, options)
+        context.dns = DNSStub()
+
+        try:
+            for name, test in TESTS:
+                if options.tests and name not in options.tests:
+                    continue
+                try:
+                    test(context)
+                    print('PASS %s' % name)
+                except (Failure, dbus.DBusException) as e:
+                    print('FAIL %s: %s' % (name, e))
+                    failed += 1
+                except Skip as e:
+                    print('SKIP %s: %s' % (name, e))
+        finally:
+            context.dns.close()
+    finally:
+        service.terminate()
+        service.wait()
+
+    sys.exit(1 if failed else 0)
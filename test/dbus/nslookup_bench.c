@@ -0,0 +1,378 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Compares the former DOM decoder of GetNSLookupResult documents with the
+ * streaming one, on documents of 1 to 10,000 <Result> entries.  Both
+ * decoders build the same a(sssassu) GVariant as the service does.
+ *
+ * gcc -O2 -o nslookup_bench nslookup_bench.c \
+ *	../../libdleyna/diagnostics/xml-util.c \
+ *	-I../../libdleyna/diagnostics \
+ *	$(pkg-config --cflags --libs glib-2.0 libxml-2.0)
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <libxml/parser.h>
+
+#include "xml-util.h"
+
+#define BENCH_RESULTS_PER_RUN 200000
+
+typedef struct dom_result_t_ dom_result_t;
+struct dom_result_t_ {
+	gchar *status;
+	gchar *answer_type;
+	gchar *hostname_returned;
+	gchar *ip_addresses;
+	gchar *dns_server_ip;
+	gchar *response_time;
+};
+
+typedef struct sax_result_t_ sax_result_t;
+struct sax_result_t_ {
+	const gchar *status;
+	const gchar *answer_type;
+	const gchar *hostname_returned;
+	const gchar *ip_addresses;
+	const gchar *dns_server_ip;
+	const gchar *response_time;
+};
+
+/* DOM decoder, as it was before the streaming parser */
+
+static void prv_dom_result_free(dom_result_t *result)
+{
+	if (result == NULL)
+		return;
+
+	g_free(result->status);
+	g_free(result->answer_type);
+	g_free(result->hostname_returned);
+	g_free(result->ip_addresses);
+	g_free(result->dns_server_ip);
+	g_free(result->response_time);
+
+	g_free(result);
+}
+
+static dom_result_t *prv_dom_extract_result(xmlNode *node)
+{
+	dom_result_t *result = g_new0(dom_result_t, 1);
+
+	result->status = xml_util_get_child_string_content_by_name(
+						node, "Status", NULL);
+	result->answer_type = xml_util_get_child_string_content_by_name(
+						node, "AnswerType", NULL);
+	result->hostname_returned = xml_util_get_child_string_content_by_name(
+						node, "HostNameReturned", NULL);
+	result->ip_addresses = xml_util_get_child_string_content_by_name(
+						node, "IPAddresses", NULL);
+	result->dns_server_ip = xml_util_get_child_string_content_by_name(
+						node, "DNSServerIP", NULL);
+	result->response_time = xml_util_get_child_string_content_by_name(
+						node, "ResponseTime", NULL);
+
+	if ((result->hostname_returned == NULL ||
+	     strlen(result->hostname_returned) > 256) ||
+	    (result->ip_addresses == NULL ||
+	     strlen(result->ip_addresses) > 256) ||
+	    (result->status == NULL) || (result->answer_type == NULL) ||
+	    (result->dns_server_ip == NULL) || (result->response_time == NULL))
+		goto on_error;
+
+	return result;
+
+on_error:
+	prv_dom_result_free(result);
+
+	return NULL;
+}
+
+static GList *prv_dom_decode(const gchar *xml)
+{
+	xmlDoc *doc;
+	xmlNode *node;
+	GList *list = NULL;
+	dom_result_t *result;
+
+	doc = xmlParseMemory(xml, strlen(xml) + 1);
+	if (doc == NULL)
+		goto on_exit;
+
+	node = xmlDocGetRootElement(doc);
+	if (node == NULL || node->name == NULL ||
+	    strcmp((char *)node->name, "NSLookupResult"))
+		goto on_exit;
+
+	for (node = node->children; node; node = node->next) {
+		if (node->name != NULL &&
+		    !strcmp((char *)node->name, "Result")) {
+			result = prv_dom_extract_result(node);
+
+			if (result != NULL)
+				list = g_list_prepend(list, result);
+		}
+	}
+
+on_exit:
+	if (doc != NULL)
+		xmlFreeDoc(doc);
+
+	return list;
+}
+
+static GVariant *prv_dom_build(const gchar *xml)
+{
+	GList *list;
+	GList *next;
+	dom_result_t *result;
+	GVariantBuilder results_vb;
+	GVariantBuilder ip_addresses_vb;
+	gchar **ip_addresses;
+	guint i;
+
+	list = prv_dom_decode(xml);
+
+	g_variant_builder_init(&results_vb, G_VARIANT_TYPE("a(sssassu)"));
+
+	for (next = list; next != NULL; next = g_list_next(next)) {
+		result = next->data;
+
+		g_variant_builder_init(&ip_addresses_vb, G_VARIANT_TYPE("as"));
+
+		ip_addresses = g_strsplit(result->ip_addresses, ",", 0);
+		for (i = 0; ip_addresses[i]; ++i) {
+			g_strstrip(ip_addresses[i]);
+			g_variant_builder_add(&ip_addresses_vb, "s",
+					      ip_addresses[i]);
+		}
+		g_strfreev(ip_addresses);
+
+		g_variant_builder_add(&results_vb, "(sss@assu)",
+				      result->status, result->answer_type,
+				      result->hostname_returned,
+				      g_variant_builder_end(&ip_addresses_vb),
+				      result->dns_server_ip,
+				      atoi(result->response_time));
+	}
+
+	g_list_free_full(list, (GDestroyNotify)prv_dom_result_free);
+
+	return g_variant_builder_end(&results_vb);
+}
+
+/* Streaming decoder, as used by the service */
+
+static const xml_util_field_t g_sax_fields[] = {
+	{ "Status", G_STRUCT_OFFSET(sax_result_t, status) },
+	{ "AnswerType", G_STRUCT_OFFSET(sax_result_t, answer_type) },
+	{ "HostNameReturned",
+	  G_STRUCT_OFFSET(sax_result_t, hostname_returned) },
+	{ "IPAddresses", G_STRUCT_OFFSET(sax_result_t, ip_addresses) },
+	{ "DNSServerIP", G_STRUCT_OFFSET(sax_result_t, dns_server_ip) },
+	{ "ResponseTime", G_STRUCT_OFFSET(sax_result_t, response_time) }
+};
+
+static const gchar *prv_csv_next(const gchar **csv, gsize *length)
+{
+	const gchar *start = *csv;
+	const gchar *end;
+
+	if (start == NULL)
+		return NULL;
+
+	end = strchr(start, ',');
+	*csv = end ? end + 1 : NULL;
+	if (end == NULL)
+		end = start + strlen(start);
+
+	while (start < end && g_ascii_isspace(*start))
+		++start;
+	while (end > start && g_ascii_isspace(end[-1]))
+		--end;
+
+	*length = end - start;
+
+	return start;
+}
+
+static gboolean prv_parse_uint(const gchar *item, guint *value)
+{
+	gchar *end;
+	gulong number;
+
+	if (!g_ascii_isdigit(*item))
+		return FALSE;
+
+	errno = 0;
+	number = strtoul(item, &end, 10);
+	if (errno == ERANGE || number > G_MAXUINT32 || *end)
+		return FALSE;
+
+	*value = number;
+
+	return TRUE;
+}
+
+static void prv_sax_add_result(gpointer record, gpointer user_data)
+{
+	sax_result_t *result = record;
+	GVariantBuilder *results_vb = user_data;
+	GVariantBuilder ip_addresses_vb;
+	gchar ip_addresses[257];
+	const gchar *next;
+	gchar *item;
+	gsize length;
+	guint response_time;
+
+	if ((result->hostname_returned == NULL ||
+	     strlen(result->hostname_returned) > 256) ||
+	    (result->ip_addresses == NULL ||
+	     strlen(result->ip_addresses) > 256) ||
+	    (result->status == NULL) || (result->answer_type == NULL) ||
+	    (result->dns_server_ip == NULL) || (result->response_time == NULL))
+		return;
+
+	if (!prv_parse_uint(result->response_time, &response_time))
+		return;
+
+	g_variant_builder_init(&ip_addresses_vb, G_VARIANT_TYPE("as"));
+
+	(void) g_strlcpy(ip_addresses, result->ip_addresses,
+			 sizeof(ip_addresses));
+	next = *ip_addresses ? ip_addresses : NULL;
+	while ((item = (gchar *)prv_csv_next(&next, &length)) != NULL) {
+		item[length] = 0;
+		g_variant_builder_add(&ip_addresses_vb, "s", item);
+	}
+
+	g_variant_builder_add(results_vb, "(sss@assu)", result->status,
+			      result->answer_type, result->hostname_returned,
+			      g_variant_builder_end(&ip_addresses_vb),
+			      result->dns_server_ip, response_time);
+}
+
+static GVariant *prv_sax_build(const gchar *xml)
+{
+	sax_result_t result;
+	GVariantBuilder results_vb;
+
+	g_variant_builder_init(&results_vb, G_VARIANT_TYPE("a(sssassu)"));
+
+	if (!xml_util_parse_records(xml, "NSLookupResult", "Result",
+				    g_sax_fields, G_N_ELEMENTS(g_sax_fields),
+				    &result, prv_sax_add_result,
+				    &results_vb)) {
+		g_variant_builder_clear(&results_vb);
+		g_variant_builder_init(&results_vb,
+				       G_VARIANT_TYPE("a(sssassu)"));
+	}
+
+	return g_variant_builder_end(&results_vb);
+}
+
+/* Harness */
+
+static gchar *prv_make_document(guint count)
+{
+	GString *xml = g_string_new("<?xml version=\"1.0\"?>\n"
+				    "<NSLookupResult>\n");
+	guint i;
+
+	for (i = 0; i < count; ++i)
+		g_string_append_printf(
+			xml,
+			"<Result>"
+			"<Status>Success_DNSServerAuthoritative</Status>"
+			"<AnswerType>Authoritative</AnswerType>"
+			"<HostNameReturned>host%u.example.com"
+			"</HostNameReturned>"
+			"<IPAddresses>10.0.%u.%u, 10.1.%u.%u, 10.2.%u.%u"
+			"</IPAddresses>"
+			"<DNSServerIP>192.168.1.1</DNSServerIP>"
+			"<ResponseTime>%u</ResponseTime>"
+			"</Result>\n",
+			i, (i >> 8) & 0xff, i & 0xff, (i >> 8) & 0xff,
+			i & 0xff, (i >> 8) & 0xff, i & 0xff, i % 1000);
+
+	g_string_append(xml, "</NSLookupResult>\n");
+
+	return g_string_free(xml, FALSE);
+}
+
+static gdouble prv_run(GVariant *(*build)(const gchar *), const gchar *xml,
+		       guint count, guint runs)
+{
+	GVariant *results;
+	gint64 start;
+	guint i;
+
+	results = build(xml);
+	if (g_variant_n_children(results) != count) {
+		fprintf(stderr, "Decoded %" G_GSIZE_FORMAT " of %u results\n",
+			g_variant_n_children(results), count);
+		exit(EXIT_FAILURE);
+	}
+	g_variant_unref(g_variant_ref_sink(results));
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < runs; ++i)
+		g_variant_unref(g_variant_ref_sink(build(xml)));
+
+	return (gdouble)(g_get_monotonic_time() - start) / runs;
+}
+
+int main(int argc, char *argv[])
+{
+	static const guint counts[] = { 1, 10, 100, 1000, 10000 };
+	gchar *xml;
+	gdouble dom;
+	gdouble sax;
+	guint runs;
+	guint i;
+
+	LIBXML_TEST_VERSION;
+
+	printf("Decoding time per document, in microseconds\n");
+	printf("%8s %12s %12s %8s\n", "results", "dom", "sax", "speedup");
+
+	for (i = 0; i < G_N_ELEMENTS(counts); ++i) {
+		xml = prv_make_document(counts[i]);
+		runs = MAX(BENCH_RESULTS_PER_RUN / counts[i], 10);
+
+		dom = prv_run(prv_dom_build, xml, counts[i], runs);
+		sax = prv_run(prv_sax_build, xml, counts[i], runs);
+
+		printf("%8u %12.1f %12.1f %7.2fx\n", counts[i], dom, sax,
+		       dom / sax);
+
+		g_free(xml);
+	}
+
+	xmlCleanupParser();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,138 @@
+# registry_bench
+#
+# Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms and conditions of the GNU Lesser General Public License,
+# version 2.1, as published by the Free Software Foundation.
+#
+# This program is distributed in the hope it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+# FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+# for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+#
+
+# Measures how the cost of routing a call to its device grows with the
+# number of known devices.  The synthetic devices are written to the
+# device cache of a private XDG_CACHE_HOME, so the service publishes them
+# at startup without any network traffic.  Cached devices expire 15 s
+# after startup, each measure has to complete within that delay.  Run it
+# through bench.sh --registry.
+
+from __future__ import print_function
+
+import argparse
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+from gi.repository import GLib
+
+import dbus
+import dbus.mainloop.glib
+
+from bms_bench import SERVICE_NAME, MANAGER_PATH, MANAGER_IF, PROPS_IF
+from bms_bench import percentile, wait_for
+
+CACHE_EXPIRY = 15
+
+def write_cache(folder, count):
+    path = os.path.join(folder, 'dleyna-diagnostics')
+    os.makedirs(path)
+    with open(os.path.join(path, 'devices'), 'w') as f:
+        for i in range(count):
+            udn = 'uuid:00000000-0000-4000-8000-%012d' % i
+            f.write("[%s]\n"
+                    "DeviceType='urn:schemas-upnp-org:device:Basic:1'\n"
+                    "UDN='%s'\n"
+                    "FriendlyName='Synthetic device %d'\n\n" %
+                    (udn, udn, i))
+
+def measure(bus, loop, options, count):
+    folder = tempfile.mkdtemp()
+    write_cache(folder, count)
+
+    env = dict(os.environ, XDG_CACHE_HOME=folder)
+    service = subprocess.Popen([options.service], env=env)
+    started = time.time()
+
+    try:
+        if not wait_for(loop, lambda: bus.name_has_owner(SERVICE_NAME), 10):
+            sys.exit('dleyna-diagnostics-service did not start')
+
+        manager = dbus.Interface(bus.get_object(SERVICE_NAME, MANAGER_PATH),
+                                 MANAGER_IF)
+        paths = []
+        def found():
+            paths[:] = manager.GetDevices()
+            return len(paths) > count
+
+        if not wait_for(loop, found, CACHE_EXPIRY):
+            sys.exit('Found %d of %d devices' % (len(paths) - 1, count))
+
+        props = [dbus.Interface(bus.get_object(SERVICE_NAME, path,
+                                               introspect=False), PROPS_IF)
+                 for path in random.sample(paths, min(len(paths), 1000))]
+
+        for i in range(options.warmup):
+            random.choice(props).Get('', 'UDN')
+
+        latencies = []
+        for i in range(options.calls):
+            device = random.choice(props)
+            begin = time.time()
+            device.Get('', 'UDN')
+            latencies.append(time.time() - begin)
+
+        if time.time() - started > CACHE_EXPIRY:
+            print('Warning: measure of %d devices outlived the cache' %
+                  count, file=sys.stderr)
+    finally:
+        service.terminate()
+        service.wait()
+        shutil.rmtree(folder)
+
+    latencies.sort()
+    print('%8d %10.1f %10.1f %10.1f' %
+          (count, sum(latencies) / len(latencies) * 1e6,
+           percentile(latencies, 0.5) * 1e6,
+           percentile(latencies, 0.99) * 1e6))
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description='Device lookup benchmark of dleyna-diagnostics-service')
+    parser.add_argument('service',
+                        help='path to the dleyna-diagnostics-service binary')
+    parser.add_argument('--devices', default='10,100,1000,10000',
+                        help='comma separated numbers of devices')
+    parser.add_argument('--calls', type=int, default=2000,
+                        help='number of measured calls per run')
+    parser.add_argument('--warmup', type=int, default=200,
+                        help='number of calls before the measure')
+    return parser.parse_args()
+
+if __name__ == '__main__':
+    options = parse_args()
+
+    if 'DLEYNA_BENCH_PRIVATE_BUS' not in os.environ:
+        print('Run through bench.sh to use a private session bus',
+              file=sys.stderr)
+        sys.exit(1)
+
+    dbus.mainloop.glib.DBusGMainLoop(set_as_default=True)
+    loop = GLib.MainLoop()
+    bus = dbus.SessionBus()
+
+    print('Properties.Get round trip, in microseconds')
+    print('%8s %10s %10s %10s' % ('devices', 'mean', 'p50', 'p99'))
+
+    for count in options.devices.split(','):
+        measure(bus, loop, options, int(count))
@@ -0,0 +1,141 @@
+/*
+ * dLeyna
+ *
+ * Copyright (C) 2012-2017 Intel Corporation. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU Lesser General Public License,
+ * version 2.1, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St - Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Times dld_device_from_path() on a path to device registry filled the way
+ * dld_upnp_t fills it, with 10 to 10,000 devices.  The looked up paths are
+ * private copies, as the object paths of D-Bus calls are.  Lookups of
+ * known and unknown paths are reported separately.
+ *
+ * Build the tree first, then:
+ *
+ * gcc -O2 -o registry_lookup_bench registry_lookup_bench.c \
+ *	-I../../libdleyna/diagnostics \
+ *	$(pkg-config --cflags --libs gupnp-1.0 dleyna-core-1.0) \
+ *	-L../../libdleyna/diagnostics/.libs -ldleyna-diagnostics-1.0 \
+ *	-Wl,-rpath,$PWD/../../libdleyna/diagnostics/.libs
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "device.h"
+#include "intern.h"
+
+#define BENCH_DEVICE_PATH "/com/intel/dLeynaDiagnostics/device"
+#define BENCH_LOOKUPS 1000000
+
+static gchar **prv_make_paths(guint first, guint count)
+{
+	gchar **paths = g_new0(gchar *, count + 1);
+	guint i;
+
+	for (i = 0; i < count; ++i)
+		paths[i] = g_strdup_printf("%s/%u", BENCH_DEVICE_PATH,
+					   first + i);
+
+	return paths;
+}
+
+/* Returns the time of a lookup in nanoseconds */
+static gdouble prv_run(GHashTable *device_map, gchar **paths, guint count,
+		       gboolean known)
+{
+	gchar **queries;
+	dld_device_t *device;
+	gint64 start;
+	guint *indexes;
+	guint i;
+
+	queries = g_new(gchar *, BENCH_LOOKUPS);
+	indexes = g_new(guint, BENCH_LOOKUPS);
+
+	for (i = 0; i < BENCH_LOOKUPS; ++i) {
+		indexes[i] = g_random_int_range(0, count);
+		queries[i] = paths[indexes[i]];
+	}
+
+	for (i = 0; i < BENCH_LOOKUPS; ++i) {
+		device = dld_device_from_path(queries[i], device_map);
+		if (device != (known ? GUINT_TO_POINTER(indexes[i] + 1) :
+			       NULL)) {
+			fprintf(stderr, "Wrong device for %s\n", queries[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < BENCH_LOOKUPS; ++i)
+		(void) dld_device_from_path(queries[i], device_map);
+
+	g_free(indexes);
+	g_free(queries);
+
+	return (gdouble)(g_get_monotonic_time() - start) * 1000 /
+		BENCH_LOOKUPS;
+}
+
+int main(int argc, char *argv[])
+{
+	static const guint counts[] = { 10, 100, 1000, 10000 };
+	GHashTable *device_map;
+	const gchar **interned;
+	gchar **paths;
+	gchar **unknown;
+	gdouble hit;
+	gdouble miss;
+	guint count;
+	guint i;
+	guint j;
+
+	printf("dld_device_from_path() time, in nanoseconds\n");
+	printf("%8s %10s %10s\n", "devices", "known", "unknown");
+
+	for (i = 0; i < G_N_ELEMENTS(counts); ++i) {
+		count = counts[i];
+		paths = prv_make_paths(0, count);
+		unknown = prv_make_paths(count, count);
+		interned = g_new(const gchar *, count);
+
+		/* As dld_upnp_t: keyed by the interned path of each device */
+		device_map = g_hash_table_new(g_direct_hash, g_direct_equal);
+		for (j = 0; j < count; ++j) {
+			interned[j] = dld_intern_ref(paths[j]);
+			g_hash_table_insert(device_map, (gpointer)interned[j],
+					    GUINT_TO_POINTER(j + 1));
+		}
+
+		hit = prv_run(device_map, paths, count, TRUE);
+		miss = prv_run(device_map, unknown, count, FALSE);
+
+		printf("%8u %10.1f %10.1f\n", count, hit, miss);
+
+		g_hash_table_unref(device_map);
+		for (j = 0; j < count; ++j)
+			dld_intern_unref(interned[j]);
+		g_free(interned);
+		g_strfreev(unknown);
+		g_strfreev(paths);
+	}
+
+	return EXIT_SUCCESS;
+}
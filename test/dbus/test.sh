@@ -0,0 +1 @@
+DLEYNA_TEST_PRIVATE_BUS=1 dbus-run-session -- python local_test.py "$@"